@@ -7,7 +7,7 @@ SOURCES += ../../ttf2mesh.c ../src/common/glwindow.c
 HEADERS += ../../ttf2mesh.h ../src/common/glwindow.h
 
 linux* {
-    LIBS = -lm -lX11 -lGL
+    LIBS = -lm -lX11 -lGL -lpthread
 }
 
 win32* {
@@ -0,0 +1,9 @@
+TEMPLATE = app
+TARGET = ttfbench
+
+include(common.pri)
+
+SOURCES = ../src/ttfbench.c
+HEADERS = ../../ttf2mesh.h ../../ttf2mesh.c
+CONFIG = c99 utf8_source release
+QMAKE_CFLAGS = -std=c99 -D_POSIX_C_SOURCE=199309L
@@ -18,7 +18,11 @@ static const char *ttf_error_str[] =
     "unsupported table format",
     "unable to create mesh",
     "glyph has no outline",
-    "error writing file"
+    "error writing file",
+    "font was loaded without glyph metrics",
+    "output buffer is too small",
+    "mesher budget is exhausted",
+    "invalid argument"
 };
 
 static void usage(int ret)
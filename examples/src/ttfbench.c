@@ -0,0 +1,351 @@
+/*
+ * Headless benchmark of the library over a font directory.
+ *
+ * The library source is included directly with TTF_MESHER_STATS defined,
+ * so the glyph is meshed by the mesher() function of library and the times
+ * of its stages are taken from the mesher statistics. The mesher time is
+ * the time of the whole mesher() call, the total time is the sum of the
+ * linearization, create_mesher, mesher and 2d/3d output times.
+ * All times are measured in microseconds for every glyph separately,
+ * the report is written to stdout in JSON format. The monotone stage is
+ * the time of TTF_FEATURE_MONOTONE engine on the same outline, it is not
+ * included to the total time and the glyphs failed by this engine are
+ * not included to its samples.
+ */
+
+#define TTF_MESHER_STATS
+#include "ttf2mesh.c"
+
+#ifndef _WIN32
+#   include <time.h>
+#endif
+
+enum
+{
+    STAGE_LINEARIZE,
+    STAGE_CREATE,
+    STAGE_SWEEP,
+    STAGE_OPTIMIZE,
+    STAGE_CONSTRAINTS,
+    STAGE_CLEANUP,
+    STAGE_MESHER,
+    STAGE_OUTPUT_2D,
+    STAGE_OUTPUT_3D,
+    STAGE_TOTAL,
+    STAGE_MONOTONE,
+    STAGES_COUNT
+};
+
+static const char *stage_name[STAGES_COUNT] =
+{
+    "linearize",
+    "create_mesher",
+    "sweep_points",
+    "optimize",
+    "constraints",
+    "remove_excess",
+    "mesher",
+    "output_2d",
+    "output_3d",
+    "total",
+    "monotone"
+};
+
+typedef struct samples
+{
+    double *val;
+    int count;
+    int cap;
+} samples_t;
+
+typedef struct quality_stat
+{
+    int quality;
+    int glyphs;
+    int failed;
+    int monotone_failed;
+    samples_t stage[STAGES_COUNT];
+} quality_stat_t;
+
+static double now_us(void)
+{
+#ifdef _WIN32
+    LARGE_INTEGER freq, cnt;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&cnt);
+    return (double)cnt.QuadPart * 1e6 / (double)freq.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec * 1e-3;
+#endif
+}
+
+static void samples_add(samples_t *s, double value)
+{
+    if (s->count == s->cap)
+    {
+        s->cap = s->cap == 0 ? 1024 : s->cap * 2;
+        s->val = (double *)realloc(s->val, s->cap * sizeof(double));
+        if (s->val == NULL)
+        {
+            fprintf(stderr, "Not enough memory\n");
+            exit(1);
+        }
+    }
+    s->val[s->count++] = value;
+}
+
+static int compare_doubles(const void *a, const void *b)
+{
+    double da = *(const double *)a;
+    double db = *(const double *)b;
+    return da < db ? -1 : da > db ? 1 : 0;
+}
+
+static void print_samples(const char *name, samples_t *s, const char *tail)
+{
+    double total = 0;
+    int i;
+    for (i = 0; i < s->count; i++)
+        total += s->val[i];
+    qsort(s->val, s->count, sizeof(double), compare_doubles);
+    if (s->count == 0)
+    {
+        printf("        \"%s\": {\"p50\": 0, \"p99\": 0, \"max\": 0, \"total\": 0}%s\n", name, tail);
+        return;
+    }
+    printf("        \"%s\": {\"p50\": %.3f, \"p99\": %.3f, \"max\": %.3f, \"total\": %.3f}%s\n", name,
+           s->val[(int)(0.50 * (s->count - 1) + 0.5)],
+           s->val[(int)(0.99 * (s->count - 1) + 0.5)],
+           s->val[s->count - 1], total, tail);
+}
+
+/**
+ * @brief Timing of all stages of one glyph
+ * @param t Output times of stages, the monotone time is negative if this engine failed
+ * @param monotone_failed Output flag of the monotone engine fail (the default mesher is used)
+ * @return TTF_DONE, TTF_ERR_NO_OUTLINE for the empty glyph or other TTF_ERR_XXX if failed
+ */
+static int bench_glyph(ttf_glyph_t *glyph, int quality, double *t, bool *monotone_failed)
+{
+    ttf_outline_t *o;
+    mesher_t *m;
+    mesh_writer_t w;
+    float *vert;
+    int *faces;
+    int res, nt, ne;
+    bool nomem;
+    double t0;
+
+    memset(t, 0, STAGES_COUNT * sizeof(double));
+
+    t0 = now_us();
+    o = ttf_linear_outline(glyph, quality);
+    t[STAGE_LINEARIZE] = now_us() - t0;
+    if (o == NULL) return TTF_ERR_NOMEM;
+    if (o->total_points < 3)
+    {
+        ttf_free_outline(o);
+        return TTF_ERR_NO_OUTLINE;
+    }
+
+    t0 = now_us();
+    m = create_mesher(o);
+    t[STAGE_CREATE] = now_us() - t0;
+    if (m == NULL)
+    {
+        ttf_free_outline(o);
+        return TTF_ERR_NOMEM;
+    }
+
+    t0 = now_us();
+    res = mesher(m, 128);
+    t[STAGE_MESHER] = now_us() - t0;
+    t[STAGE_SWEEP] = m->stats.time_sweep * 1e6;
+    t[STAGE_OPTIMIZE] = m->stats.time_optimize * 1e6;
+    t[STAGE_CONSTRAINTS] = m->stats.time_constraints * 1e6;
+    t[STAGE_CLEANUP] = m->stats.time_remove_excess * 1e6;
+    if (res != MESHER_DONE)
+    {
+        free_mesher(m);
+        ttf_free_outline(o);
+        return res == MESHER_ABORT ? TTF_ERR_BUDGET : TTF_ERR_MESHER;
+    }
+
+    /* the output buffers are allocated in the same way as by the public functions */
+    nomem = false;
+    t0 = now_us();
+    count_mesher_output(m, &nt, &ne);
+    vert = (float *)malloc(m->nv * 2 * sizeof(float) + nt * 3 * sizeof(int));
+    if (vert != NULL)
+    {
+        faces = (int *)(vert + m->nv * 2);
+        memset(&w, 0, sizeof(w));
+        w.vert = (uint8_t *)vert;
+        w.vert_stride = 2 * sizeof(float);
+        w.vert_dim = 2;
+        w.faces = (uint8_t *)faces;
+        w.face_stride = 3 * sizeof(int);
+        emit_mesh2d(m, &w);
+        free(vert);
+    }
+    else
+        nomem = true;
+    t[STAGE_OUTPUT_2D] = now_us() - t0;
+
+    t0 = now_us();
+    count_mesher_output(m, &nt, &ne);
+    vert = (float *)malloc((m->nv * 2 + ne * 4) * 6 * sizeof(float) + (nt * 2 + ne * 2) * 3 * sizeof(int));
+    if (vert != NULL)
+    {
+        faces = (int *)(vert + (m->nv * 2 + ne * 4) * 6);
+        memset(&w, 0, sizeof(w));
+        w.vert = (uint8_t *)vert;
+        w.vert_stride = 3 * sizeof(float);
+        w.vert_dim = 3;
+        w.faces = (uint8_t *)faces;
+        w.face_stride = 3 * sizeof(int);
+        w.normals = (uint8_t *)(vert + (m->nv * 2 + ne * 4) * 3);
+        w.normal_stride = 3 * sizeof(float);
+        emit_mesh3d(m, &w, 0.1f, NULL);
+        free(vert);
+    }
+    else
+        nomem = true;
+    t[STAGE_OUTPUT_3D] = now_us() - t0;
+
+    free_mesher(m);
+
+    /* the fast engine on the same outline, the fallback to default mesher is not timed */
+    m = create_mesher(o);
+    if (m != NULL)
+    {
+        t0 = now_us();
+        res = monotone_mesher(m);
+        t[STAGE_MONOTONE] = now_us() - t0;
+        free_mesher(m);
+    }
+    else
+        nomem = true;
+    *monotone_failed = m == NULL || res != MESHER_DONE;
+    if (*monotone_failed) t[STAGE_MONOTONE] = -1;
+    ttf_free_outline(o);
+
+    t[STAGE_TOTAL] = t[STAGE_LINEARIZE] + t[STAGE_CREATE] + t[STAGE_MESHER] +
+                     t[STAGE_OUTPUT_2D] + t[STAGE_OUTPUT_3D];
+    return nomem ? TTF_ERR_NOMEM : TTF_DONE;
+}
+
+static void usage(int ret)
+{
+    printf("usage: ttfbench <font-directory> [quality ...]\n");
+    fflush(stdout);
+    exit(ret);
+}
+
+int main(int argc, const char **argv)
+{
+    static const int default_quality[] = {TTF_QUALITY_LOW, TTF_QUALITY_NORMAL, TTF_QUALITY_HIGH};
+    quality_stat_t *stat;
+    samples_t load;
+    ttf_t **list;
+    int nquality, nfonts, i, q;
+
+    if (argc < 2) usage(1);
+
+    nquality = argc > 2 ? argc - 2 : 3;
+    stat = (quality_stat_t *)calloc(nquality, sizeof(quality_stat_t));
+    if (stat == NULL) return 1;
+    for (q = 0; q < nquality; q++)
+    {
+        if (argc > 2)
+        {
+            char *endptr;
+            stat[q].quality = strtoul(argv[q + 2], &endptr, 10);
+            if (*endptr != 0) usage(1);
+        }
+        else
+            stat[q].quality = default_quality[q];
+    }
+
+    list = ttf_list_fonts(&argv[1], 1, NULL);
+    if (list == NULL)
+    {
+        fprintf(stderr, "Unable to list fonts in \"%s\"\n", argv[1]);
+        return 1;
+    }
+
+    memset(&load, 0, sizeof(load));
+    nfonts = 0;
+    for (i = 0; list[i] != NULL; i++)
+    {
+        ttf_t *font;
+        double t0 = now_us();
+        if (ttf_load_from_file(list[i]->filename, &font, false) != TTF_DONE)
+        {
+            fprintf(stderr, "Unable to load font \"%s\"\n", list[i]->filename);
+            continue;
+        }
+        samples_add(&load, now_us() - t0);
+        nfonts++;
+
+        for (q = 0; q < nquality; q++)
+            for (int g = 0; g < font->nglyphs; g++)
+            {
+                double t[STAGES_COUNT];
+                bool monotone_failed;
+                int res;
+                if (font->glyphs[g].outline == NULL) continue;
+                res = bench_glyph(&font->glyphs[g], stat[q].quality, t, &monotone_failed);
+                if (res == TTF_ERR_NO_OUTLINE) continue;
+                stat[q].glyphs++;
+                if (res != TTF_DONE)
+                {
+                    stat[q].failed++;
+                    continue;
+                }
+                if (monotone_failed) stat[q].monotone_failed++;
+                for (int s = 0; s < STAGES_COUNT; s++)
+                    if (t[s] >= 0) samples_add(&stat[q].stage[s], t[s]);
+            }
+
+        ttf_free(font);
+    }
+    ttf_free_list(list);
+
+    printf("{\n");
+    printf("    \"version\": \"%s\",\n", TTF2MESH_VERSION);
+    printf("    \"units\": \"us\",\n");
+    printf("    \"fonts\": %i,\n", nfonts);
+    printf("    \"load\": {\n");
+    print_samples("font", &load, "");
+    printf("    },\n");
+    printf("    \"quality\": [\n");
+    for (q = 0; q < nquality; q++)
+    {
+        samples_t *total = &stat[q].stage[STAGE_TOTAL];
+        double sum = 0;
+        for (i = 0; i < total->count; i++)
+            sum += total->val[i];
+        printf("    {\n");
+        printf("        \"quality\": %i,\n", stat[q].quality);
+        printf("        \"glyphs\": %i,\n", stat[q].glyphs);
+        printf("        \"failed\": %i,\n", stat[q].failed);
+        printf("        \"monotone_failed\": %i,\n", stat[q].monotone_failed);
+        /* the benchmark is single threaded, so it is the rate of one core */
+        printf("        \"glyphs_per_sec_per_core\": %.1f,\n", sum > 0 ? total->count * 1e6 / sum : 0.0);
+        for (int s = 0; s < STAGES_COUNT; s++)
+        {
+            print_samples(stage_name[s], &stat[q].stage[s], s + 1 < STAGES_COUNT ? "," : "");
+            free(stat[q].stage[s].val);
+        }
+        printf("    }%s\n", q + 1 < nquality ? "," : "");
+    }
+    printf("    ]\n");
+    printf("}\n");
+
+    free(load.val);
+    free(stat);
+    return 0;
+}
@@ -67,6 +67,34 @@
 #   define TTF_BREAKPOINT raise(SIGINT)
 #endif
 
+/* SSE2 is used by the rasterizer if it is available */
+#if !defined(TTF_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#   define TTF_SSE2
+#   include <emmintrin.h>
+#endif
+
+/* Threads are used by the SDF atlas generator */
+#if !defined(TTF_NO_THREADS) && !defined(TTF_WINDOWS)
+#   include <pthread.h>
+#   include <unistd.h>
+#endif
+#define TTF_MAX_THREADS 64
+
+/* Thread local storage of the tracing, the thread allocator and the mesher */
+/* budget, the user threads can call the library also with TTF_NO_THREADS */
+#if defined(_MSC_VER)
+#   define TTF_THREAD_LOCAL __declspec(thread)
+#elif defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L && !defined(__STDC_NO_THREADS__)
+#   define TTF_THREAD_LOCAL _Thread_local
+#else
+#   define TTF_THREAD_LOCAL __thread
+#endif
+
+/* Timer of the mesher statistics, tracing and mesher budget */
+#if !defined(TTF_WINDOWS)
+#   include <time.h>
+#endif
+
 /* Big/little endian definitions */
 #if defined(__BYTE_ORDER__) && defined(__ORDER_LITTLE_ENDIAN__)
 #   if (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
@@ -170,6 +198,285 @@
 #define LIST_FIRST(root) ((root)->next)
 #define LIST_INIT(root)  { (root)->next = (root); (root)->prev = (root); }
 
+/* ------------------ Timer of the statistics and tracing ------------------ */
+
+/**
+ * @brief Monotonic time in seconds
+ */
+static double ttf_clock(void)
+{
+#if defined(TTF_WINDOWS)
+    LARGE_INTEGER freq, cnt;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&cnt);
+    return (double)cnt.QuadPart / (double)freq.QuadPart;
+#elif defined(TTF_LINUX) || defined(TTF_ANDROID)
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+#else
+    return (double)clock() / CLOCKS_PER_SEC;
+#endif
+}
+
+/* ---------------------------- Memory allocation ---------------------------- */
+
+/* All library objects are allocated by the thread allocator if it is set */
+/* or by the global one (see ttf_set_allocator). The standard library */
+/* functions are used if the allocator functions are not set. */
+
+static ttf_allocator_t global_allocator = {NULL, NULL, NULL, NULL};
+static TTF_THREAD_LOCAL const ttf_allocator_t *thread_allocator = NULL;
+
+static __inline const ttf_allocator_t *current_allocator(void)
+{
+    return thread_allocator != NULL ? thread_allocator : &global_allocator;
+}
+
+static void *mem_alloc(size_t size)
+{
+    const ttf_allocator_t *a = current_allocator();
+    if (a->alloc == NULL) return malloc(size);
+    return a->alloc(a->ctx, size);
+}
+
+static void *mem_calloc(size_t count, size_t size)
+{
+    const ttf_allocator_t *a = current_allocator();
+    void *res;
+    if (a->alloc == NULL) return calloc(count, size);
+    if (size != 0 && count > (size_t)-1 / size) return NULL;
+    res = a->alloc(a->ctx, count * size);
+    if (res != NULL) memset(res, 0, count * size);
+    return res;
+}
+
+static void *mem_realloc(void *ptr, size_t size)
+{
+    const ttf_allocator_t *a = current_allocator();
+    if (a->realloc == NULL) return realloc(ptr, size);
+    return a->realloc(a->ctx, ptr, size);
+}
+
+static void mem_free(void *ptr)
+{
+    const ttf_allocator_t *a = current_allocator();
+    if (ptr == NULL) return;
+    if (a->free == NULL)
+        free(ptr); else
+        a->free(a->ctx, ptr);
+}
+
+void ttf_set_allocator(const ttf_allocator_t *allocator)
+{
+    static const ttf_allocator_t std_allocator = {NULL, NULL, NULL, NULL};
+    global_allocator = allocator != NULL ? *allocator : std_allocator;
+}
+
+const ttf_allocator_t *ttf_set_thread_allocator(const ttf_allocator_t *allocator)
+{
+    const ttf_allocator_t *prev = thread_allocator;
+    thread_allocator = allocator;
+    return prev;
+}
+
+/* ------------------------ Tracing of batch processing ---------------------- */
+
+/* Every thread writes the events to its own buffer without locks, the */
+/* buffer is registered in the global list by the first event of thread. */
+/* ttf_trace_stop writes all buffers in Chrome trace event format. */
+
+#ifdef TTF_TRACING
+
+#if defined(TTF_WINDOWS)
+#   define TRACE_NEXT_TID() InterlockedIncrement(&trace_tids)
+#   define TRACE_PUSH(old, buf) (InterlockedCompareExchangePointer((void *volatile *)&trace_list, buf, old) == (void *)old)
+#else
+#   define TRACE_NEXT_TID() __sync_add_and_fetch(&trace_tids, 1)
+#   define TRACE_PUSH(old, buf) __sync_bool_compare_and_swap(&trace_list, old, buf)
+#endif
+
+#define TRACE_CHUNK 4096
+
+typedef struct trace_event
+{
+    const char *name;             /* static event name */
+    char *str;                    /* copy of the string argument or NULL */
+    double ts;                    /* time stamp, seconds */
+    int arg;                      /* integer argument or -1 */
+    char ph;                      /* phase: 'B' (begin) or 'E' (end) */
+} trace_event_t;
+
+typedef struct trace_chunk
+{
+    struct trace_chunk *next;
+    int count;
+    trace_event_t ev[TRACE_CHUNK];
+} trace_chunk_t;
+
+typedef struct trace_buffer
+{
+    struct trace_buffer *next;    /* next buffer in the global list */
+    trace_chunk_t *first;         /* first chunk of events */
+    trace_chunk_t *last;          /* chunk to write */
+    long tid;                     /* thread number */
+} trace_buffer_t;
+
+static trace_buffer_t *volatile trace_list = NULL;
+static volatile long trace_tids = 0;
+static volatile long trace_generation = 0;
+static volatile int trace_enabled = 0;
+static TTF_THREAD_LOCAL trace_buffer_t *trace_local = NULL;
+static TTF_THREAD_LOCAL long trace_local_generation = 0;
+
+static trace_buffer_t *trace_thread_buffer(void)
+{
+    trace_buffer_t *buf, *old;
+    if (trace_local != NULL && trace_local_generation == trace_generation)
+        return trace_local;
+    buf = (trace_buffer_t *)calloc(1, sizeof(trace_buffer_t));
+    if (buf == NULL) return NULL;
+    buf->tid = TRACE_NEXT_TID();
+    do
+    {
+        old = trace_list;
+        buf->next = old;
+    } while (!TRACE_PUSH(old, buf));
+    trace_local = buf;
+    trace_local_generation = trace_generation;
+    return buf;
+}
+
+/**
+ * @brief Recording of the event to the thread buffer, the event is lost if no memory
+ */
+static void trace_event(char ph, const char *name, int arg, const char *str)
+{
+    trace_buffer_t *buf;
+    trace_event_t *ev;
+    if (!trace_enabled) return;
+    buf = trace_thread_buffer();
+    if (buf == NULL) return;
+    if (buf->last == NULL || buf->last->count == TRACE_CHUNK)
+    {
+        trace_chunk_t *chunk = (trace_chunk_t *)malloc(sizeof(trace_chunk_t));
+        if (chunk == NULL) return;
+        chunk->next = NULL;
+        chunk->count = 0;
+        if (buf->last == NULL)
+            buf->first = chunk; else
+            buf->last->next = chunk;
+        buf->last = chunk;
+    }
+    ev = &buf->last->ev[buf->last->count++];
+    ev->name = name;
+    ev->ph = ph;
+    ev->arg = arg;
+    ev->str = NULL;
+    if (str != NULL)
+    {
+        ev->str = (char *)malloc(strlen(str) + 1);
+        if (ev->str != NULL) strcpy(ev->str, str);
+    }
+    ev->ts = ttf_clock();
+}
+
+/**
+ * @brief Writing of the string to JSON with escaping
+ */
+static bool trace_write_string(FILE *f, const char *str)
+{
+    if (fputc('"', f) == EOF) return false;
+    for (; *str != 0; str++)
+    {
+        if (*str == '"' || *str == '\\')
+            if (fputc('\\', f) == EOF) return false;
+        if ((unsigned char)*str < 0x20) continue;
+        if (fputc(*str, f) == EOF) return false;
+    }
+    return fputc('"', f) != EOF;
+}
+
+#   define TRACE_BEGIN(name, arg, str) trace_event('B', name, arg, str)
+#   define TRACE_END(name) trace_event('E', name, -1, NULL)
+#else
+#   define TRACE_BEGIN(name, arg, str) ((void)0)
+#   define TRACE_END(name) ((void)0)
+#endif
+
+bool ttf_trace_start(void)
+{
+#ifdef TTF_TRACING
+    trace_generation++;
+    trace_enabled = 1;
+    return true;
+#else
+    return false;
+#endif
+}
+
+int ttf_trace_stop(const char *file_name)
+{
+    bool ok;
+    FILE *f;
+#ifdef TTF_TRACING
+    trace_buffer_t *list;
+    double origin;
+    bool first;
+
+    trace_enabled = 0;
+    list = trace_list;
+    trace_list = NULL;
+
+    /* time stamps are relative to the first event */
+    origin = -1;
+    for (trace_buffer_t *buf = list; buf != NULL; buf = buf->next)
+        if (buf->first != NULL && buf->first->count != 0)
+            if (origin < 0 || buf->first->ev[0].ts < origin)
+                origin = buf->first->ev[0].ts;
+#endif
+
+    f = fopen(file_name, "wb");
+    ok = f != NULL;
+    if (ok) ok = fprintf(f, "{\"traceEvents\":[") > 0;
+
+#ifdef TTF_TRACING
+    first = true;
+    while (list != NULL)
+    {
+        trace_buffer_t *buf = list;
+        list = list->next;
+        while (buf->first != NULL)
+        {
+            trace_chunk_t *chunk = buf->first;
+            buf->first = chunk->next;
+            for (int i = 0; i < chunk->count; i++)
+            {
+                trace_event_t *ev = &chunk->ev[i];
+                if (ok)
+                    ok = fprintf(f, "%s\n{\"name\":\"%s\",\"cat\":\"ttf2mesh\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":1,\"tid\":%li",
+                                 first ? "" : ",", ev->name, ev->ph, (ev->ts - origin) * 1e6, buf->tid) > 0;
+                if (ok && ev->str != NULL)
+                    ok = fprintf(f, ",\"args\":{\"file\":") > 0 && trace_write_string(f, ev->str) && fputc('}', f) != EOF;
+                else
+                if (ok && ev->arg >= 0)
+                    ok = fprintf(f, ",\"args\":{\"glyph\":%i}", ev->arg) > 0;
+                if (ok) ok = fputc('}', f) != EOF;
+                first = false;
+                free(ev->str);
+            }
+            free(chunk);
+        }
+        free(buf);
+    }
+#endif
+
+    if (ok) ok = fprintf(f, "\n],\"displayTimeUnit\":\"ms\"}\n") > 0;
+    if (f == NULL) return TTF_ERR_OPEN;
+    if (fclose(f) != 0) ok = false;
+    return ok ? TTF_DONE : TTF_ERR_WRITING;
+}
+
 /******************************************************************************/
 /******************************************************************************/
 /******************************************************************************/
@@ -396,6 +703,8 @@ typedef struct ttf_parser_private_struct
     uint8_t *ploca;
     uint16_t *ploca16;
     uint32_t *ploca32;
+    uint8_t *pkern;
+    uint8_t *pgpos;
     int shead;
     int sos2;
     int smaxp;
@@ -407,7 +716,16 @@ typedef struct ttf_parser_private_struct
     int shhea;
     int shmtx;
     int sglyf;
+    int skern;
+    int sgpos;
     uint32_t glyf_csum;
+    int *outline_offset; /* offsets of the glyph outlines in font arena */
+    uint8_t *outlines;   /* reserved memory of the glyph outlines */
+    bool quantized;      /* TTF_LOAD_QUANTIZED mode */
+    bool components;     /* TTF_LOAD_COMPONENTS mode */
+    float scale;         /* font units to em scale */
+    void *scratch[2];    /* parsed glyph and decoded component in quantized mode */
+    int scratch_size[2];
 } pps_t;
 
 /******************************************************************************/
@@ -651,21 +969,236 @@ static uint32_t ttf_checksum(const void *data, int size)
 #define check(cond, code) \
 if (!(cond)) { result = code; goto error; }
 
-ttf_outline_t *allocate_ttf_outline(int ncontours, int npoints)
+static int ttf_outline_size(int ncontours, int npoints)
 {
-    ttf_outline_t *res;
     int n = sizeof(ttf_outline_t);
     n += npoints * sizeof(ttf_point_t); /* points buffer size */
-    n += (ncontours - 1) * sizeof(res->cont); /* contours buffer size */
-    res = (ttf_outline_t *)calloc(n, 1);
-    if (res == NULL) return NULL;
+    n += (ncontours - 1) * sizeof(((ttf_outline_t *)0)->cont); /* contours buffer size */
+    return n;
+}
+
+static ttf_outline_t *init_ttf_outline(void *mem, int ncontours, int npoints)
+{
+    ttf_outline_t *res = (ttf_outline_t *)mem;
     res->ncontours = ncontours;
     res->total_points = npoints;
     res->cont[0].pt = (ttf_point_t *)&res->cont[ncontours];
     return res;
 }
 
-int parse_simple_glyph(ttf_glyph_t *glyph, int glyph_index, uint8_t *p, int avail)
+ttf_outline_t *allocate_ttf_outline(int ncontours, int npoints)
+{
+    void *res = mem_calloc(ttf_outline_size(ncontours, npoints), 1);
+    if (res == NULL) return NULL;
+    return init_ttf_outline(res, ncontours, npoints);
+}
+
+/* ------------------------- Font arena -------------------------- */
+
+/*
+ * All the data of font object is placed in a few large slabs. The first
+ * slab holds the ttf_t structure, glyphs array and the glyph outlines in
+ * glyph order, its size is calculated before parsing. Other data (names,
+ * characters, kerning) is placed to the rest of the first slab or to the
+ * next slabs, so ttf_free just frees the slabs list.
+ */
+
+#define ARENA_ALIGN 16
+#define ARENA_SLAB  (64 * 1024)
+#define ARENA_ROUND(n) (((size_t)(n) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+#define ARENA_HEADER ARENA_ROUND(sizeof(ttf_arena_t))
+
+typedef struct ttf_arena
+{
+    struct ttf_arena *next;       /* next slab */
+    size_t size;                  /* slab size including the header */
+    size_t used;                  /* used bytes including the header */
+} ttf_arena_t;
+
+/* the first slab header is placed right before ttf_t structure */
+#define FONT_ARENA(ttf) ((ttf_arena_t *)((uint8_t *)(ttf) - ARENA_HEADER))
+
+/**
+ * @brief Allocating of the font object with its first slab
+ * @param size Size of the slab data after ttf_t structure
+ */
+static ttf_t *arena_create(size_t size)
+{
+    ttf_arena_t *a;
+    size += ARENA_HEADER + ARENA_ROUND(sizeof(ttf_t));
+    a = (ttf_arena_t *)mem_calloc(size, 1);
+    if (a == NULL) return NULL;
+    a->size = size;
+    a->used = ARENA_HEADER + ARENA_ROUND(sizeof(ttf_t));
+    return (ttf_t *)((uint8_t *)a + ARENA_HEADER);
+}
+
+/**
+ * @brief Allocating of zeroed memory in font arena
+ * @return Pointer to memory or NULL if no memory in system
+ */
+static void *arena_alloc(ttf_t *ttf, size_t size)
+{
+    ttf_arena_t *a, *last;
+    size = ARENA_ROUND(size);
+    last = FONT_ARENA(ttf);
+    for (a = last; a != NULL; a = a->next)
+    {
+        if (a->size - a->used >= size)
+        {
+            void *res = (uint8_t *)a + a->used;
+            a->used += size;
+            return res;
+        }
+        last = a;
+    }
+    a = (ttf_arena_t *)mem_calloc(ARENA_HEADER + (size > ARENA_SLAB ? size : ARENA_SLAB), 1);
+    if (a == NULL) return NULL;
+    a->size = ARENA_HEADER + (size > ARENA_SLAB ? size : ARENA_SLAB);
+    a->used = ARENA_HEADER + size;
+    last->next = a;
+    return (uint8_t *)a + ARENA_HEADER;
+}
+
+static void arena_free(ttf_t *ttf)
+{
+    ttf_arena_t *a = FONT_ARENA(ttf)->next;
+    while (a != NULL)
+    {
+        ttf_arena_t *next = a->next;
+        mem_free(a);
+        a = next;
+    }
+    mem_free(FONT_ARENA(ttf));
+}
+
+/**
+ * @brief Allocating of the glyph outline memory in font arena
+ *
+ * The memory reserved by measure_glyf_table is used if its size is the
+ * same as requested one.
+ */
+static void *font_outline_mem(ttf_t *ttf, pps_t *pp, int glyph_index, int size)
+{
+    if (pp->outline_offset != NULL &&
+        pp->outline_offset[glyph_index + 1] - pp->outline_offset[glyph_index] == (int)ARENA_ROUND(size))
+        return pp->outlines + pp->outline_offset[glyph_index];
+    return arena_alloc(ttf, size);
+}
+
+/**
+ * @brief Temporary outline of glyph parsing in quantized mode
+ * @param i Index of scratch buffer: 0 for parsed glyph, 1 for decoded component
+ */
+static ttf_outline_t *scratch_outline(pps_t *pp, int i, int ncontours, int npoints)
+{
+    int size = ttf_outline_size(ncontours, npoints);
+    if (size > pp->scratch_size[i])
+    {
+        void *mem = mem_realloc(pp->scratch[i], size);
+        if (mem == NULL) return NULL;
+        pp->scratch[i] = mem;
+        pp->scratch_size[i] = size;
+    }
+    memset(pp->scratch[i], 0, size);
+    return init_ttf_outline(pp->scratch[i], ncontours, npoints);
+}
+
+/**
+ * @brief Allocating of the glyph outline
+ *
+ * In quantized mode the outline is parsed to the scratch buffer and then
+ * moved to font arena by quantize_outline.
+ */
+static ttf_outline_t *font_outline(ttf_t *ttf, pps_t *pp, int glyph_index, int ncontours, int npoints)
+{
+    void *mem;
+    if (pp->quantized)
+        return scratch_outline(pp, 0, ncontours, npoints);
+    mem = font_outline_mem(ttf, pp, glyph_index, ttf_outline_size(ncontours, npoints));
+    if (mem == NULL) return NULL;
+    return init_ttf_outline(mem, ncontours, npoints);
+}
+
+static int ttf_qoutline_size(int ncontours, int npoints)
+{
+    return sizeof(ttf_qoutline_t) +
+           ncontours * sizeof(*((ttf_qoutline_t *)0)->cont) +
+           npoints * sizeof(*((ttf_qoutline_t *)0)->pt) +
+           (npoints + 7) / 8;
+}
+
+static __inline int16_t quantize_coord(float v)
+{
+    v = floorf(v + 0.5f);
+    if (v < -32768.0f) return -32768;
+    if (v > 32767.0f) return 32767;
+    return (int16_t)v;
+}
+
+/**
+ * @brief Moving of the parsed glyph outline to font arena in font units
+ * @return false if no memory
+ */
+static bool quantize_outline(ttf_t *ttf, pps_t *pp, int glyph_index)
+{
+    ttf_glyph_t *glyph = ttf->glyphs + glyph_index;
+    const ttf_outline_t *o = glyph->outline;
+    ttf_qoutline_t *q;
+    int i, j, n;
+
+    q = (ttf_qoutline_t *)font_outline_mem(ttf, pp, glyph_index, ttf_qoutline_size(o->ncontours, o->total_points));
+    if (q == NULL) return false;
+    q->total_points = o->total_points;
+    q->ncontours = o->ncontours;
+    q->scale = pp->scale;
+    *(void **)&q->cont = q + 1;
+    *(void **)&q->pt = q->cont + o->ncontours;
+    q->onc = (uint8_t *)(q->pt + o->total_points);
+    for (i = 0, n = 0; i < o->ncontours; i++)
+    {
+        q->cont[i].length = o->cont[i].length;
+        q->cont[i].subglyph_id = o->cont[i].subglyph_id;
+        q->cont[i].subglyph_order = o->cont[i].subglyph_order;
+        for (j = 0; j < o->cont[i].length; j++, n++)
+        {
+            q->pt[n][0] = quantize_coord(o->cont[i].pt[j].x);
+            q->pt[n][1] = quantize_coord(o->cont[i].pt[j].y);
+            if (o->cont[i].pt[j].onc)
+                q->onc[n >> 3] |= 1 << (n & 7);
+        }
+    }
+    glyph->outline = NULL;
+    glyph->qoutline = q;
+    return true;
+}
+
+/**
+ * @brief Decoding of the quantized outline
+ * @param out Outline with the same number of contours and points
+ * @param scale Scale of the coordinates
+ */
+static void dequantize_outline(const ttf_qoutline_t *q, float scale, ttf_outline_t *out)
+{
+    int i, j, n;
+    for (i = 0, n = 0; i < q->ncontours; i++)
+    {
+        ttf_point_t *pt = out->cont[i].pt;
+        out->cont[i].length = q->cont[i].length;
+        out->cont[i].subglyph_id = q->cont[i].subglyph_id;
+        out->cont[i].subglyph_order = q->cont[i].subglyph_order;
+        for (j = 0; j < q->cont[i].length; j++, n++)
+        {
+            pt[j].x = q->pt[n][0] * scale;
+            pt[j].y = q->pt[n][1] * scale;
+            pt[j].onc = (q->onc[n >> 3] >> (n & 7)) & 1;
+        }
+        if (i != q->ncontours - 1)
+            out->cont[i + 1].pt = pt + q->cont[i].length;
+    }
+}
+
+int parse_simple_glyph(ttf_t *ttf, pps_t *pp, ttf_glyph_t *glyph, int glyph_index, uint8_t *p, int avail)
 {
     uint16_t *endPtsOfContours;
     uint8_t flag;
@@ -701,7 +1234,7 @@ int parse_simple_glyph(ttf_glyph_t *glyph, int glyph_index, uint8_t *p, int avai
     glyph->ybounds[1] = hdr.yMax;
 
     /* initialize outline */
-    glyph->outline = allocate_ttf_outline(glyph->ncontours, glyph->npoints);
+    glyph->outline = font_outline(ttf, pp, glyph_index, glyph->ncontours, glyph->npoints);
     if (glyph->outline == NULL) return TTF_ERR_NOMEM;
 
     j = 0;
@@ -867,7 +1400,7 @@ static __inline float f2dot14_to_float(int16_t f2dot14)
     return (float)f2dot14 / 16384;
 }
 
-int parse_composite_glyph(ttf_t *ttf, ttf_glyph_t *glyph, uint8_t *p, int avail)
+int parse_composite_glyph(ttf_t *ttf, pps_t *pp, ttf_glyph_t *glyph, uint8_t *p, int avail)
 {
     #define ARG_1_AND_2_ARE_WORDS     0x0001
     #define ARGS_ARE_XY_VALUES        0x0002
@@ -885,6 +1418,9 @@ int parse_composite_glyph(ttf_t *ttf, ttf_glyph_t *glyph, uint8_t *p, int avail)
     uint8_t *stored_p;
     int stored_avail;
     int nglyphs;
+    bool flatten;
+    ttf_component_t *ref;
+    ttf_outline_t *component;
     ttf_glyfh_t hdr;
     ttf_point_t *curr;
     unsigned flags; /* component flag */
@@ -942,19 +1478,31 @@ int parse_composite_glyph(ttf_t *ttf, ttf_glyph_t *glyph, uint8_t *p, int avail)
         glyph->npoints += ttf->glyphs[glyphIndex].npoints;
         nglyphs++;
     }
-    if (glyph->ncontours == 0 || glyph->npoints == 0)
+    p = stored_p;
+    avail = stored_avail;
+
+    /* the components are kept as references in any mode */
+    glyph->components = (ttf_component_t *)arena_alloc(ttf, nglyphs * sizeof(ttf_component_t));
+    if (glyph->components == NULL) return TTF_ERR_NOMEM;
+    glyph->ncomponents = nglyphs;
+
+    /* the component glyphs with the bigger index are not flattened */
+    /* yet, so they are available in TTF_LOAD_COMPONENTS mode only */
+    flatten = !pp->components && glyph->ncontours != 0 && glyph->npoints != 0;
+    if (!flatten)
     {
-        /* FIXME: support composite glyph recursion! */
         glyph->ncontours = 0;
         glyph->npoints = 0;
-        return 0;
     }
-    p = stored_p;
-    avail = stored_avail;
 
     /* initialize outline */
-    glyph->outline = allocate_ttf_outline(glyph->ncontours, glyph->npoints);
-    if (glyph->outline == NULL) return TTF_ERR_NOMEM;
+    curr = NULL;
+    if (flatten)
+    {
+        glyph->outline = font_outline(ttf, pp, glyph - ttf->glyphs, glyph->ncontours, glyph->npoints);
+        if (glyph->outline == NULL) return TTF_ERR_NOMEM;
+        curr = glyph->outline->cont[0].pt;
+    }
 
     /* initialize other glyph fields */
     glyph->composite = 1;
@@ -965,7 +1513,6 @@ int parse_composite_glyph(ttf_t *ttf, ttf_glyph_t *glyph, uint8_t *p, int avail)
 
     n = 0;
     nglyphs = 0;
-    curr = glyph->outline->cont[0].pt;
     flags = MORE_COMPONENTS;
     while (flags & MORE_COMPONENTS)
     {
@@ -1022,17 +1569,48 @@ int parse_composite_glyph(ttf_t *ttf, ttf_glyph_t *glyph, uint8_t *p, int avail)
         /* If neither flag is set, then the rasterizer will apply a default behavior */
         if ((flags & SCALED_COMPONENT_OFFSET) == 0 && (flags & UNSCALED_COMPONENT_OFFSET) == 0)
             flags |= UNSCALED_COMPONENT_OFFSET;
+
+        /* store the reference with the offset applied after the matrix */
+        ref = glyph->components + nglyphs;
+        ref->index = glyphIndex;
+        ref->glyph = ttf->glyphs + glyphIndex;
+        memcpy(ref->matrix, scale, sizeof(scale));
+        if (flags & SCALED_COMPONENT_OFFSET)
+        {
+            ref->offset[0] = (scale[0][0] * arg1 + scale[0][1] * arg2) * pp->scale;
+            ref->offset[1] = (scale[1][0] * arg1 + scale[1][1] * arg2) * pp->scale;
+        }
+        else
+        {
+            ref->offset[0] = arg1 * pp->scale;
+            ref->offset[1] = arg2 * pp->scale;
+        }
+        ref->overlap = (flags & OVERLAP_COMPOUND) != 0;
+        if (!flatten)
+        {
+            nglyphs++;
+            continue;
+        }
+
         /* copy and transform contours from other glyph */
+        component = ttf->glyphs[glyphIndex].outline;
+        if (component == NULL && ttf->glyphs[glyphIndex].qoutline != NULL)
+        {
+            const ttf_qoutline_t *q = ttf->glyphs[glyphIndex].qoutline;
+            component = scratch_outline(pp, 1, q->ncontours, q->total_points);
+            if (component == NULL) return TTF_ERR_NOMEM;
+            dequantize_outline(q, 1.0f, component);
+        }
         for (i = 0; i < ttf->glyphs[glyphIndex].ncontours; i++)
         {
             glyph->outline->cont[n].pt = curr;
-            glyph->outline->cont[n].length = ttf->glyphs[glyphIndex].outline->cont[i].length;
+            glyph->outline->cont[n].length = component->cont[i].length;
             glyph->outline->cont[n].subglyph_id = glyphIndex;
             glyph->outline->cont[n].subglyph_order = nglyphs;
             for (j = 0; j < glyph->outline->cont[n].length; j++)
             {
                 float x, y;
-                *curr = ttf->glyphs[glyphIndex].outline->cont[i].pt[j];
+                *curr = component->cont[i].pt[j];
                 x = curr->x + ((flags & SCALED_COMPONENT_OFFSET) ? arg1 : 0);
                 y = curr->y + ((flags & SCALED_COMPONENT_OFFSET) ? arg2 : 0);
                 curr->x = scale[0][0] * x + scale[0][1] * y + (flags & UNSCALED_COMPONENT_OFFSET ? arg1 : 0);
@@ -1046,6 +1624,145 @@ int parse_composite_glyph(ttf_t *ttf, ttf_glyph_t *glyph, uint8_t *p, int avail)
     return 0;
 }
 
+/**
+ * @brief Offset of the glyph data in 'glyf' table or -1 if glyph has no outline
+ * @param composite The glyph is checked as composite one (see parse_glyf_table)
+ */
+static int glyf_offset(pps_t *pp, int nglyphs, int i, bool composite)
+{
+    int offset;
+    if (pp->ploca16)
+    {
+        offset = pp->ploca16[i] * 2;
+        if (!composite && i < nglyphs - 1 && pp->ploca16[i] == pp->ploca16[i + 1])
+            return -1;
+    }
+    else
+    {
+        offset = pp->ploca32[i];
+        if (!composite && i < nglyphs - 1 && pp->ploca32[i] == pp->ploca32[i + 1])
+            return -1;
+    }
+    if (offset + (int)sizeof(ttf_glyfh_t) >= pp->sglyf)
+        return -1;
+    return offset;
+}
+
+/**
+ * @brief Measuring of the glyph outlines before parsing
+ * @param offset Output offsets of the outlines with nglyphs + 1 length
+ * @return false if no memory
+ *
+ * The outline sizes are counted in the same way as parse_simple_glyph and
+ * parse_composite_glyph do, so the outlines are placed in glyph order.
+ * The quantized outlines are measured in quantized mode.
+ * The glyphs with the broken data are measured as empty, the composite
+ * glyphs have no outlines in TTF_LOAD_COMPONENTS mode.
+ */
+static bool measure_glyf_table(pps_t *pp, int nglyphs, int *offset)
+{
+    int (*count)[2];
+    int i, n;
+
+    count = (int (*)[2])mem_calloc(nglyphs + 1, sizeof(*count));
+    if (count == NULL) return false;
+
+    /* simple glyphs */
+    for (i = 0; i < nglyphs; i++)
+    {
+        ttf_glyfh_t *hdr;
+        uint8_t *p;
+        int nc;
+        n = glyf_offset(pp, nglyphs, i, false);
+        if (n < 0) continue;
+        hdr = (ttf_glyfh_t *)(pp->pglyf + n);
+        nc = (int16_t)big16toh(hdr->numberOfContours);
+        if (nc <= 0) continue;
+        p = (uint8_t *)(hdr + 1);
+        if (pp->sglyf - n - (int)sizeof(ttf_glyfh_t) < nc * 2) continue;
+        count[i][0] = nc;
+        count[i][1] = big16toh(((uint16_t *)p)[nc - 1]) + 1;
+    }
+
+    /* composite glyphs in parsing order */
+    for (i = 0; i < nglyphs && !pp->components; i++)
+    {
+        unsigned flags = MORE_COMPONENTS;
+        int nc = 0, np = 0, avail;
+        uint8_t *p;
+        n = glyf_offset(pp, nglyphs, i, true);
+        if (n < 0) continue;
+        if ((int16_t)big16toh(((ttf_glyfh_t *)(pp->pglyf + n))->numberOfContours) >= 0) continue;
+        p = pp->pglyf + n + sizeof(ttf_glyfh_t);
+        avail = pp->sglyf - n - sizeof(ttf_glyfh_t);
+        while (flags & MORE_COMPONENTS)
+        {
+            unsigned index;
+            if (avail < 4) break;
+            flags = big16toh(*(uint16_t *)(p + 0));
+            index = big16toh(*(uint16_t *)(p + 2));
+            n = 4 + (flags & ARG_1_AND_2_ARE_WORDS ? 4 : 2);
+            if (flags & WE_HAVE_A_SCALE)
+                n += 2; else
+            if (flags & WE_HAVE_AN_X_AND_Y_SCALE)
+                n += 4; else
+            if (flags & WE_HAVE_A_TWO_BY_TWO)
+                n += 8;
+            avail -= n;
+            p += n;
+            if (avail < 0 || index >= (unsigned)nglyphs) break;
+            nc += count[index][0];
+            np += count[index][1];
+        }
+        if ((flags & MORE_COMPONENTS) || nc == 0 || np == 0) continue;
+        count[i][0] = nc;
+        count[i][1] = np;
+    }
+
+    offset[0] = 0;
+    for (i = 0; i < nglyphs; i++)
+    {
+        if (count[i][0] == 0)
+            n = 0;
+        else
+        if (pp->quantized)
+            n = ARENA_ROUND(ttf_qoutline_size(count[i][0], count[i][1]));
+        else
+            n = ARENA_ROUND(ttf_outline_size(count[i][0], count[i][1]));
+        offset[i + 1] = offset[i] + n;
+    }
+    mem_free(count);
+    return true;
+}
+
+/* depth limit of the composite glyph references */
+#define COMPONENTS_DEPTH 8
+
+/**
+ * @brief Counting of the contours and points of the flattened composite glyph
+ * @param depth Depth of the glyph reference, the deeper references are ignored
+ */
+static void count_components(const ttf_glyph_t *glyph, int depth, int *ncontours, int *npoints)
+{
+    int i, nc, np;
+    *ncontours = 0;
+    *npoints = 0;
+    for (i = 0; i < glyph->ncomponents; i++)
+    {
+        const ttf_glyph_t *g = glyph->components[i].glyph;
+        if (g->ncomponents == 0)
+        {
+            *ncontours += g->ncontours;
+            *npoints += g->npoints;
+            continue;
+        }
+        if (depth >= COMPONENTS_DEPTH) continue;
+        count_components(g, depth + 1, &nc, &np);
+        *ncontours += nc;
+        *npoints += np;
+    }
+}
+
 int parse_glyf_table(ttf_t *ttf, pps_t *pp)
 {
     int i;
@@ -1075,8 +1792,9 @@ int parse_glyf_table(ttf_t *ttf, pps_t *pp)
             continue; /* strict parser must return TTF_ERR_FMT */
         hdr = (ttf_glyfh_t *)(pp->pglyf + offset);
         if ((int16_t)big16toh(hdr->numberOfContours) < 0) continue;
-        result = parse_simple_glyph(ttf->glyphs + i, i, pp->pglyf + offset, pp->sglyf - offset);
+        result = parse_simple_glyph(ttf, pp, ttf->glyphs + i, i, pp->pglyf + offset, pp->sglyf - offset);
         if (result != 0) goto error;
+        if (pp->quantized && !quantize_outline(ttf, pp, i)) return TTF_ERR_NOMEM;
     }
 
     /* read composite glyphs */
@@ -1088,20 +1806,55 @@ int parse_glyf_table(ttf_t *ttf, pps_t *pp)
             continue; /* strict parser must return TTF_ERR_FMT */
         hdr = (ttf_glyfh_t *)(pp->pglyf + offset);
         if ((int16_t)big16toh(hdr->numberOfContours) >= 0) continue;
-        result = parse_composite_glyph(ttf, ttf->glyphs + i, pp->pglyf + offset, pp->sglyf - offset);
+        result = parse_composite_glyph(ttf, pp, ttf->glyphs + i, pp->pglyf + offset, pp->sglyf - offset);
         if (result != 0) goto error;
+        if (pp->quantized && ttf->glyphs[i].outline != NULL && !quantize_outline(ttf, pp, i))
+            return TTF_ERR_NOMEM;
     }
 
+    /* the not flattened glyphs have the sizes of their flattened outlines */
+    if (pp->components)
+        for (i = 0; i < ttf->nglyphs; i++)
+            if (ttf->glyphs[i].ncomponents != 0)
+                count_components(ttf->glyphs + i, 0, &ttf->glyphs[i].ncontours, &ttf->glyphs[i].npoints);
+
     return 0;
 
 error:
     return result;
 }
 
-static int parse_os2_table(ttf_t *ttf, pps_t *pps)
+/**
+ * @brief Reading the glyph bounds only (TTF_LOAD_METRICS mode)
+ */
+static void parse_glyf_bounds(ttf_t *ttf, pps_t *pp)
 {
-    ttf->os2.xAvgCharWidth = (int16_t)big16toh(pps->pos2->xAvgCharWidth);
-    ttf->os2.yStrikeoutSize = (int16_t)big16toh(pps->pos2->yStrikeoutSize);
+    int i;
+    int offset;
+    ttf_glyfh_t *hdr;
+
+    for (i = 0; i < ttf->nglyphs; i++)
+    {
+        offset = pp->ploca16 ? pp->ploca16[i] * 2 : (int)pp->ploca32[i];
+        if (i < ttf->nglyphs - 1)
+            if (offset == (pp->ploca16 ? pp->ploca16[i + 1] * 2 : (int)pp->ploca32[i + 1]))
+                continue; /* glyph has no outline */
+        if (offset < 0 || offset + (int)sizeof(ttf_glyfh_t) >= pp->sglyf)
+            continue;
+        hdr = (ttf_glyfh_t *)(pp->pglyf + offset);
+        ttf->glyphs[i].index = i;
+        ttf->glyphs[i].composite = (int16_t)big16toh(hdr->numberOfContours) < 0;
+        ttf->glyphs[i].xbounds[0] = (int16_t)big16toh(hdr->xMin);
+        ttf->glyphs[i].xbounds[1] = (int16_t)big16toh(hdr->xMax);
+        ttf->glyphs[i].ybounds[0] = (int16_t)big16toh(hdr->yMin);
+        ttf->glyphs[i].ybounds[1] = (int16_t)big16toh(hdr->yMax);
+    }
+}
+
+static int parse_os2_table(ttf_t *ttf, pps_t *pps)
+{
+    ttf->os2.xAvgCharWidth = (int16_t)big16toh(pps->pos2->xAvgCharWidth);
+    ttf->os2.yStrikeoutSize = (int16_t)big16toh(pps->pos2->yStrikeoutSize);
     ttf->os2.yStrikeoutPos = (int16_t)big16toh(pps->pos2->yStrikeoutPosition);
     ttf->os2.sTypoAscender = (int16_t)big16toh(pps->pos2->sTypoAscender);
     ttf->os2.sTypoDescender = (int16_t)big16toh(pps->pos2->sTypoDescender);
@@ -1178,6 +1931,701 @@ static int parse_hmtx_table(ttf_t *ttf, pps_t *pp)
     return TTF_DONE;
 }
 
+/* ------------------------ Kerning tables parsing ------------------------ */
+
+/* glyph pair of the kerning */
+typedef struct kern_pair
+{
+    uint32_t key;                 /* left glyph << 16 | right glyph */
+    int16_t value;                /* kerning value in font units */
+    int order;                    /* order of the pair in font tables */
+    int lookup;                   /* GPOS lookup or 'kern' subtable of the pair */
+} kern_pair_t;
+
+/* class-based kerning subtable (GPOS PairPos format 2) */
+typedef struct kern_class
+{
+    uint16_t first1;              /* first glyph of class1 array */
+    uint16_t count1;              /* length of class1 array */
+    uint16_t first2;              /* first glyph of class2 array */
+    uint16_t count2;              /* length of class2 array */
+    uint16_t nclass1;             /* number of classes for the left glyph */
+    uint16_t nclass2;             /* number of classes for the right glyph */
+    int lookup;                   /* GPOS lookup of the subtable */
+    uint16_t *class1;             /* class of left glyph, 0xFFFF if glyph is not covered */
+    uint16_t *class2;             /* class of right glyph */
+    int16_t *values;              /* matrix of values with nclass2 columns */
+} kern_class_t;
+
+struct ttf_kern
+{
+    float scale;                  /* font units to em conversion factor */
+    int hsize;                    /* size of pairs hash table (power of 2) */
+    uint32_t *keys;               /* pairs hash table keys, 0xFFFFFFFF for empty */
+    int16_t *values;              /* pairs hash table values, the sum over all lookups */
+    int nclasses;                 /* number of class-based subtables */
+    kern_class_t *classes;        /* class-based subtables in the lookup order */
+};
+
+/* temporary storage of the kerning data while parsing */
+typedef struct kern_builder
+{
+    int npairs;
+    int pcap;
+    kern_pair_t *pairs;
+    int nclasses;
+    int ccap;
+    kern_class_t *classes;
+    int lookup;                   /* current GPOS lookup or 'kern' subtable */
+    int lookup_class;             /* first class-based subtable of current lookup */
+} kern_builder_t;
+
+#define KERN_EMPTY 0xFFFFFFFFu
+
+static uint16_t rd16(const uint8_t *p)
+{
+    return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+static uint32_t rd32(const uint8_t *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static bool kern_add_pair(kern_builder_t *b, uint16_t left, uint16_t right, int16_t value)
+{
+    if (b->npairs == b->pcap)
+    {
+        int cap = b->pcap == 0 ? 256 : b->pcap * 2;
+        kern_pair_t *pairs = (kern_pair_t *)mem_realloc(b->pairs, sizeof(kern_pair_t) * cap);
+        if (pairs == NULL) return false;
+        b->pairs = pairs;
+        b->pcap = cap;
+    }
+    b->pairs[b->npairs].key = ((uint32_t)left << 16) | right;
+    b->pairs[b->npairs].value = value;
+    b->pairs[b->npairs].order = b->npairs;
+    b->pairs[b->npairs].lookup = b->lookup;
+    b->npairs++;
+    return true;
+}
+
+static void kern_builder_free(kern_builder_t *b)
+{
+    int i;
+    for (i = 0; i < b->nclasses; i++)
+    {
+        mem_free(b->classes[i].class1);
+        mem_free(b->classes[i].class2);
+        mem_free(b->classes[i].values);
+    }
+    mem_free(b->classes);
+    mem_free(b->pairs);
+}
+
+/**
+ * @brief Class of the left glyph in class-based subtable or -1 if glyph is not covered
+ */
+static __inline int kern_class1(const kern_class_t *c, unsigned glyph)
+{
+    glyph -= c->first1;
+    if (glyph >= c->count1) return -1;
+    return c->class1[glyph] == 0xFFFF ? -1 : c->class1[glyph];
+}
+
+static __inline int kern_class2(const kern_class_t *c, unsigned glyph)
+{
+    glyph -= c->first2;
+    if (glyph >= c->count2) return 0;
+    return c->class2[glyph];
+}
+
+/**
+ * @brief Sum of class-based kerning over lookups
+ * @param pairs Glyph pairs of (left, right) key, their lookups are skipped
+ *
+ * Every lookup gives the value of its first subtable covering the left
+ * glyph, the values of different lookups are accumulated.
+ */
+static int kern_class_value(const kern_class_t *classes, int nclasses, unsigned left, unsigned right,
+                            const kern_pair_t *pairs, int npairs)
+{
+    int i, j, c1, lookup = -1, value = 0;
+    for (i = 0; i < nclasses; i++)
+    {
+        const kern_class_t *c = classes + i;
+        if (c->lookup == lookup) continue;
+        c1 = kern_class1(c, left);
+        if (c1 < 0) continue;
+        lookup = c->lookup;
+        for (j = 0; j < npairs; j++)
+            if (pairs[j].lookup == lookup)
+                break;
+        if (j < npairs) continue;
+        value += c->values[c1 * c->nclass2 + kern_class2(c, right)];
+    }
+    return value;
+}
+
+/**
+ * @brief Reading the OpenType Coverage table
+ * @return Number of glyphs in coverage order, -1 if table is invalid or -2 if no memory
+ */
+static int read_coverage(const uint8_t *p, const uint8_t *end, uint16_t **glyphs)
+{
+    int format, count, total, i, j, n;
+    uint16_t *res;
+
+    *glyphs = NULL;
+    if (p + 4 > end) return -1;
+    format = rd16(p);
+    count = rd16(p + 2);
+    p += 4;
+    if (format == 1)
+    {
+        if (p + count * 2 > end) return -1;
+        res = (uint16_t *)mem_alloc(sizeof(uint16_t) * (count + 1));
+        if (res == NULL) return -2;
+        for (i = 0; i < count; i++)
+            res[i] = rd16(p + i * 2);
+        *glyphs = res;
+        return count;
+    }
+    if (format != 2 || p + count * 6 > end) return -1;
+    total = 0;
+    for (i = 0; i < count; i++)
+    {
+        int first = rd16(p + i * 6);
+        int last = rd16(p + i * 6 + 2);
+        int index = rd16(p + i * 6 + 4);
+        if (last < first) return -1;
+        if (index + last - first + 1 > total)
+            total = index + last - first + 1;
+    }
+    res = (uint16_t *)mem_calloc(total + 1, sizeof(uint16_t));
+    if (res == NULL) return -2;
+    for (i = 0; i < count; i++)
+    {
+        int first = rd16(p + i * 6);
+        int last = rd16(p + i * 6 + 2);
+        int index = rd16(p + i * 6 + 4);
+        for (j = first, n = index; j <= last; j++, n++)
+            res[n] = (uint16_t)j;
+    }
+    *glyphs = res;
+    return total;
+}
+
+/**
+ * @brief Reading the OpenType ClassDef table to dense array over glyph range
+ * @return 0 if done, -1 if table is invalid or -2 if no memory
+ */
+static int read_classdef(const uint8_t *p, const uint8_t *end, uint16_t *first, uint16_t *count, uint16_t **classes)
+{
+    int format, n, i, j, lo, hi;
+    uint16_t *res;
+
+    *first = 0;
+    *count = 0;
+    *classes = NULL;
+    if (p + 4 > end) return -1;
+    format = rd16(p);
+    if (format == 1)
+    {
+        if (p + 6 > end) return -1;
+        lo = rd16(p + 2);
+        n = rd16(p + 4);
+        p += 6;
+        if (p + n * 2 > end || lo + n > 0x10000) return -1;
+        res = (uint16_t *)mem_alloc(sizeof(uint16_t) * (n + 1));
+        if (res == NULL) return -2;
+        for (i = 0; i < n; i++)
+            res[i] = rd16(p + i * 2);
+        *first = (uint16_t)lo;
+        *count = (uint16_t)n;
+        *classes = res;
+        return 0;
+    }
+    if (format != 2) return -1;
+    n = rd16(p + 2);
+    p += 4;
+    if (p + n * 6 > end) return -1;
+    lo = 0xFFFF;
+    hi = -1;
+    for (i = 0; i < n; i++)
+    {
+        int a = rd16(p + i * 6);
+        int b = rd16(p + i * 6 + 2);
+        if (b < a) return -1;
+        if (a < lo) lo = a;
+        if (b > hi) hi = b;
+    }
+    if (hi < lo) return 0; /* empty class definition */
+    if (hi - lo + 1 > 0xFFFF) return -1;
+    res = (uint16_t *)mem_calloc(hi - lo + 2, sizeof(uint16_t));
+    if (res == NULL) return -2;
+    for (i = 0; i < n; i++)
+    {
+        int a = rd16(p + i * 6);
+        int b = rd16(p + i * 6 + 2);
+        uint16_t c = rd16(p + i * 6 + 4);
+        for (j = a; j <= b; j++)
+            res[j - lo] = c;
+    }
+    *first = (uint16_t)lo;
+    *count = (uint16_t)(hi - lo + 1);
+    *classes = res;
+    return 0;
+}
+
+/* size of ValueRecord in bytes */
+static int value_record_size(uint16_t format)
+{
+    int n = 0;
+    for (; format != 0; format >>= 1)
+        n += format & 1;
+    return n * 2;
+}
+
+/* XAdvance field of ValueRecord */
+static int16_t value_record_xadvance(const uint8_t *p, uint16_t format)
+{
+    if ((format & 4) == 0) return 0;
+    return (int16_t)rd16(p + value_record_size(format & 3));
+}
+
+/**
+ * @brief Parsing of the GPOS PairPos subtable (formats 1 and 2)
+ * @return false if no memory, invalid subtables are ignored
+ */
+static bool parse_pairpos(kern_builder_t *b, const uint8_t *p, const uint8_t *end)
+{
+    const uint8_t *sub = p;
+    uint16_t *cov;
+    int ncov, format, vf1, vf2, vs1, vs2, i, j, k;
+
+    if (p + 10 > end) return true;
+    format = rd16(p);
+    vf1 = rd16(p + 4);
+    vf2 = rd16(p + 6);
+    vs1 = value_record_size(vf1);
+    vs2 = value_record_size(vf2);
+    if ((vf1 & 4) == 0) return true; /* no XAdvance of the left glyph */
+    ncov = read_coverage(sub + rd16(p + 2), end, &cov);
+    if (ncov < 0) return ncov != -2;
+
+    if (format == 1)
+    {
+        int nsets = rd16(p + 8);
+        p += 10;
+        if (p + nsets * 2 > end) nsets = 0;
+        if (nsets > ncov) nsets = ncov;
+        for (i = 0; i < nsets; i++)
+        {
+            uint16_t left = cov[i];
+            const uint8_t *set = sub + rd16(p + i * 2);
+
+            /* the earlier class-based subtable of the lookup covers the left glyph */
+            for (k = b->lookup_class; k < b->nclasses; k++)
+                if (kern_class1(b->classes + k, left) >= 0)
+                    break;
+            if (k < b->nclasses) continue;
+
+            if (set + 2 > end) continue;
+            int npairs = rd16(set);
+            int rec = 2 + vs1 + vs2;
+            set += 2;
+            if (set + npairs * rec > end) continue;
+            for (j = 0; j < npairs; j++, set += rec)
+            {
+                /* the zero pair is kept, it overrides the class value of its lookup */
+                if (!kern_add_pair(b, left, rd16(set), value_record_xadvance(set + 2, vf1)))
+                {
+                    mem_free(cov);
+                    return false;
+                }
+            }
+        }
+        mem_free(cov);
+        return true;
+    }
+
+    if (format == 2)
+    {
+        kern_class_t c;
+        uint16_t *cd1;
+        uint16_t cd1_first, cd1_count;
+        int nclass1, nclass2, rec, res1, res2;
+        int lo, hi;
+
+        if (p + 16 > end || ncov == 0 || rd16(p + 12) == 0 || rd16(p + 14) == 0)
+        {
+            mem_free(cov);
+            return true;
+        }
+        nclass1 = rd16(p + 12);
+        nclass2 = rd16(p + 14);
+        rec = vs1 + vs2;
+        p += 16;
+        if ((size_t)nclass1 * nclass2 * rec > (size_t)(end - p))
+        {
+            mem_free(cov);
+            return true;
+        }
+
+        memset(&c, 0, sizeof(c));
+        c.lookup = b->lookup;
+        res1 = read_classdef(sub + rd16(sub + 8), end, &cd1_first, &cd1_count, &cd1);
+        res2 = res1 == 0 ? read_classdef(sub + rd16(sub + 10), end, &c.first2, &c.count2, &c.class2) : 0;
+        if (res1 != 0 || res2 != 0)
+        {
+            mem_free(cd1);
+            mem_free(c.class2);
+            mem_free(cov);
+            return res1 != -2 && res2 != -2;
+        }
+
+        /* dense class1 array over coverage glyphs */
+        lo = 0xFFFF;
+        hi = 0;
+        for (i = 0; i < ncov; i++)
+        {
+            if (cov[i] < lo) lo = cov[i];
+            if (cov[i] > hi) hi = cov[i];
+        }
+        if (hi - lo + 1 > 0xFFFF)
+        {
+            mem_free(cd1);
+            mem_free(c.class2);
+            mem_free(cov);
+            return true;
+        }
+        c.first1 = (uint16_t)lo;
+        c.count1 = (uint16_t)(hi - lo + 1);
+        c.nclass1 = (uint16_t)nclass1;
+        c.nclass2 = (uint16_t)nclass2;
+        c.class1 = (uint16_t *)mem_alloc(sizeof(uint16_t) * (c.count1 + 1));
+        c.values = (int16_t *)mem_alloc(sizeof(int16_t) * ((size_t)nclass1 * nclass2 + 1));
+        if (c.class1 == NULL || c.values == NULL)
+        {
+            mem_free(c.class1);
+            mem_free(c.class2);
+            mem_free(c.values);
+            mem_free(cd1);
+            mem_free(cov);
+            return false;
+        }
+        memset(c.class1, 0xFF, sizeof(uint16_t) * c.count1);
+        for (i = 0; i < ncov; i++)
+        {
+            unsigned g = cov[i] - cd1_first;
+            int cls = g < cd1_count ? cd1[g] : 0;
+            if (cls < nclass1)
+                c.class1[cov[i] - lo] = (uint16_t)cls;
+        }
+        for (i = 0; i < c.count2; i++)
+            if (c.class2[i] >= nclass2)
+                c.class2[i] = 0;
+        for (i = 0; i < nclass1 * nclass2; i++)
+            c.values[i] = value_record_xadvance(p + i * rec, vf1);
+        mem_free(cd1);
+        mem_free(cov);
+
+        if (b->nclasses == b->ccap)
+        {
+            int cap = b->ccap == 0 ? 8 : b->ccap * 2;
+            kern_class_t *classes = (kern_class_t *)mem_realloc(b->classes, sizeof(kern_class_t) * cap);
+            if (classes == NULL)
+            {
+                mem_free(c.class1);
+                mem_free(c.class2);
+                mem_free(c.values);
+                return false;
+            }
+            b->classes = classes;
+            b->ccap = cap;
+        }
+        b->classes[b->nclasses++] = c;
+        return true;
+    }
+
+    mem_free(cov);
+    return true;
+}
+
+/**
+ * @brief Parsing of the lookups which are referenced by 'kern' feature of GPOS table
+ * @return false if no memory
+ */
+static bool parse_gpos_kern(kern_builder_t *b, const uint8_t *gpos, int size, bool *found)
+{
+    const uint8_t *end = gpos + size;
+    const uint8_t *features, *lookups;
+    uint8_t *used;
+    int nfeatures, nlookups, i, j;
+
+    *found = false;
+    if (size < 10 || rd16(gpos) != 1) return true;
+    features = gpos + rd16(gpos + 6);
+    lookups = gpos + rd16(gpos + 8);
+    if (features + 2 > end || lookups + 2 > end) return true;
+    nfeatures = rd16(features);
+    nlookups = rd16(lookups);
+    if (features + 2 + nfeatures * 6 > end || lookups + 2 + nlookups * 2 > end) return true;
+
+    /* lookups of all the 'kern' features (of any script and language) */
+    used = (uint8_t *)mem_calloc(nlookups + 1, 1);
+    if (used == NULL) return false;
+    for (i = 0; i < nfeatures; i++)
+    {
+        const uint8_t *rec = features + 2 + i * 6;
+        if (memcmp(rec, "kern", 4) != 0) continue;
+        const uint8_t *f = features + rd16(rec + 4);
+        if (f + 4 > end) continue;
+        int n = rd16(f + 2);
+        if (f + 4 + n * 2 > end) continue;
+        for (j = 0; j < n; j++)
+        {
+            int index = rd16(f + 4 + j * 2);
+            if (index < nlookups)
+                used[index] = 1;
+        }
+        *found = true;
+    }
+
+    /* lookups are applied in the LookupList order */
+    for (i = 0; i < nlookups; i++)
+    {
+        if (!used[i]) continue;
+        b->lookup = i;
+        b->lookup_class = b->nclasses;
+        const uint8_t *lookup = lookups + rd16(lookups + 2 + i * 2);
+        if (lookup + 6 > end) continue;
+        int type = rd16(lookup);
+        int nsub = rd16(lookup + 4);
+        if (lookup + 6 + nsub * 2 > end) continue;
+        for (j = 0; j < nsub; j++)
+        {
+            const uint8_t *sub = lookup + rd16(lookup + 6 + j * 2);
+            if (type == 9)
+            {
+                /* extension lookup */
+                if (sub + 8 > end || rd16(sub) != 1 || rd16(sub + 2) != 2) continue;
+                uint32_t offset = rd32(sub + 4);
+                if (offset > (uint32_t)(end - sub)) continue;
+                sub += offset;
+            }
+            else if (type != 2)
+                continue;
+            if (!parse_pairpos(b, sub, end))
+            {
+                mem_free(used);
+                return false;
+            }
+        }
+    }
+
+    mem_free(used);
+    return true;
+}
+
+/**
+ * @brief Parsing of the horizontal format 0 subtables of 'kern' table
+ * @return false if no memory
+ */
+static bool parse_kern_table(kern_builder_t *b, const uint8_t *kern, int size)
+{
+    const uint8_t *end = kern + size;
+    const uint8_t *p;
+    int ntab, i, j;
+    bool apple;
+
+    if (size < 4) return true;
+    apple = rd16(kern) == 1;
+    if (apple)
+    {
+        /* Apple 'kern' table version 1.0 */
+        if (size < 8 || rd32(kern) != 0x00010000) return true;
+        ntab = rd32(kern + 4);
+        p = kern + 8;
+    }
+    else
+    {
+        /* OpenType 'kern' table version 0 */
+        if (rd16(kern) != 0) return true;
+        ntab = rd16(kern + 2);
+        p = kern + 4;
+    }
+
+    for (i = 0; i < ntab; i++)
+    {
+        uint32_t length;
+        const uint8_t *data;
+        bool horizontal;
+        int format;
+
+        if (apple)
+        {
+            if (p + 8 > end) break;
+            length = rd32(p);
+            uint16_t coverage = rd16(p + 4);
+            format = coverage & 0xFF;
+            horizontal = (coverage & 0xE000) == 0; /* not vertical, cross-stream or variation */
+            data = p + 8;
+        }
+        else
+        {
+            if (p + 6 > end) break;
+            length = rd16(p + 2);
+            uint16_t coverage = rd16(p + 4);
+            format = coverage >> 8;
+            horizontal = (coverage & 7) == 1; /* horizontal, not minimum and not cross-stream */
+            data = p + 6;
+        }
+
+        /* every subtable is accumulated as a separate lookup */
+        b->lookup = i;
+        if (format == 0 && horizontal && data + 8 <= end)
+        {
+            int npairs = rd16(data);
+            data += 8;
+            if (data + npairs * 6 > end)
+                npairs = (end - data) / 6;
+            for (j = 0; j < npairs; j++, data += 6)
+                if (!kern_add_pair(b, rd16(data), rd16(data + 2), (int16_t)rd16(data + 4)))
+                    return false;
+        }
+
+        if (length < 6 || length > (uint32_t)(end - p)) break;
+        p += length;
+    }
+    return true;
+}
+
+static int compare_kern_pairs(const void *a, const void *b)
+{
+    const kern_pair_t *pa = (const kern_pair_t *)a;
+    const kern_pair_t *pb = (const kern_pair_t *)b;
+    if (pa->key != pb->key) return pa->key < pb->key ? -1 : 1;
+    return pa->order - pb->order;
+}
+
+static __inline uint32_t kern_hash(uint32_t key)
+{
+    key ^= key >> 16;
+    key *= 0x45D9F3Bu;
+    key ^= key >> 16;
+    return key;
+}
+
+/**
+ * @brief Reading the kerning data from GPOS or 'kern' tables
+ *
+ * The GPOS 'kern' feature has a priority, the 'kern' table is used only
+ * if GPOS table has no 'kern' feature. Invalid kerning tables are ignored.
+ */
+static int parse_kerning(ttf_t *ttf, pps_t *pp)
+{
+    kern_builder_t b;
+    struct ttf_kern *kern;
+    uint16_t *data;
+    bool gpos = false;
+    int npairs, hsize, i, j;
+    size_t size;
+
+    memset(&b, 0, sizeof(b));
+    if (pp->sgpos != 0)
+        if (!parse_gpos_kern(&b, pp->pgpos, pp->sgpos, &gpos))
+            goto nomem;
+    if (!gpos && pp->skern != 0)
+        if (!parse_kern_table(&b, pp->pkern, pp->skern))
+            goto nomem;
+    if (b.npairs == 0 && b.nclasses == 0)
+    {
+        kern_builder_free(&b);
+        return TTF_DONE;
+    }
+
+    /* merge the duplicate pairs: the first pair of every lookup is used, */
+    /* the values of lookups (with their class-based subtables) are accumulated */
+    if (b.npairs != 0)
+        qsort(b.pairs, b.npairs, sizeof(kern_pair_t), compare_kern_pairs);
+    npairs = 0;
+    for (i = 0; i < b.npairs; i = j)
+    {
+        uint32_t key = b.pairs[i].key;
+        int value = 0;
+        for (j = i; j < b.npairs && b.pairs[j].key == key; j++)
+            if (j == i || b.pairs[j].lookup != b.pairs[j - 1].lookup)
+                value += b.pairs[j].value;
+        value += kern_class_value(b.classes, b.nclasses, key >> 16, key & 0xFFFF, b.pairs + i, j - i);
+        if (value > 32767) value = 32767;
+        if (value < -32768) value = -32768;
+        /* the pair is not needed if the class-based subtables give the same value */
+        if (value == kern_class_value(b.classes, b.nclasses, key >> 16, key & 0xFFFF, NULL, 0))
+            continue;
+        b.pairs[npairs] = b.pairs[i];
+        b.pairs[npairs++].value = (int16_t)value;
+    }
+
+    /* allocate the kerning data by single block */
+    hsize = 16;
+    while (hsize < npairs * 2) hsize *= 2;
+    size = sizeof(struct ttf_kern) +
+           sizeof(kern_class_t) * b.nclasses +
+           (sizeof(uint32_t) + sizeof(int16_t)) * hsize;
+    for (i = 0; i < b.nclasses; i++)
+        size += sizeof(uint16_t) * (b.classes[i].count1 + b.classes[i].count2 +
+                                    b.classes[i].nclass1 * b.classes[i].nclass2);
+    kern = (struct ttf_kern *)arena_alloc(ttf, size);
+    if (kern == NULL) goto nomem;
+    kern->scale = pp->phead->unitsPerEm == 0 ? 0.0f :
+        1.0f / big16toh(pp->phead->unitsPerEm);
+    kern->nclasses = b.nclasses;
+    kern->classes = (kern_class_t *)(kern + 1);
+    kern->hsize = hsize;
+    kern->keys = (uint32_t *)(kern->classes + b.nclasses);
+    kern->values = (int16_t *)(kern->keys + hsize);
+    data = (uint16_t *)(kern->values + hsize);
+
+    /* pairs hash table */
+    memset(kern->keys, 0xFF, sizeof(uint32_t) * hsize);
+    for (i = 0; i < npairs; i++)
+    {
+        j = kern_hash(b.pairs[i].key) & (hsize - 1);
+        while (kern->keys[j] != KERN_EMPTY)
+            j = (j + 1) & (hsize - 1);
+        kern->keys[j] = b.pairs[i].key;
+        kern->values[j] = b.pairs[i].value;
+    }
+
+    /* class-based subtables */
+    for (i = 0; i < b.nclasses; i++)
+    {
+        kern_class_t *src = b.classes + i;
+        kern_class_t *dst = kern->classes + i;
+        int nvalues = src->nclass1 * src->nclass2;
+        *dst = *src;
+        dst->class1 = data;
+        memcpy(data, src->class1, sizeof(uint16_t) * src->count1);
+        data += src->count1;
+        dst->class2 = data;
+        memcpy(data, src->class2, sizeof(uint16_t) * src->count2);
+        data += src->count2;
+        dst->values = (int16_t *)data;
+        memcpy(data, src->values, sizeof(int16_t) * nvalues);
+        data += nvalues;
+    }
+
+    kern_builder_free(&b);
+    ttf->kern = kern;
+    return TTF_DONE;
+
+nomem:
+    kern_builder_free(&b);
+    return TTF_ERR_NOMEM;
+}
+
 static int ttf_extract_tables(const uint8_t *data, int size, pps_t *s)
 {
     int ntab;
@@ -1220,6 +2668,8 @@ static int ttf_extract_tables(const uint8_t *data, int size, pps_t *s)
         match(uint16_t *, hmtx, "hmtx");
         match(uint8_t *, loca, "loca");
         match(uint8_t *, glyf, "glyf");
+        match(uint8_t *, kern, "kern");
+        match(uint8_t *, gpos, "GPOS");
         if (check_tag("glyf"))
             s->glyf_csum = rec->checkSum;
         rec++;
@@ -1259,12 +2709,114 @@ static int ttf_extract_tables(const uint8_t *data, int size, pps_t *s)
 
 static int find_ubrange(int utf16)
 {
-    for (int i = 0; i < 163; i++)
-        if (utf16 >= ubranges[i].first && utf16 <= ubranges[i].last)
-            return i;
+    /* ubranges[] are sorted and do not overlap, */
+    /* so the half division search is applicable */
+    int lsi = 0;
+    int rsi = 162;
+    while (lsi <= rsi)
+    {
+        int mid = (lsi + rsi) / 2;
+        if (utf16 < ubranges[mid].first)
+            rsi = mid - 1; else
+        if (utf16 > ubranges[mid].last)
+            lsi = mid + 1; else
+            return mid;
+    }
     return -1;
 }
 
+/* builder of the ttf_t::coverage sparse set */
+typedef struct cset_builder
+{
+    int npages;                   /* number of pages in set */
+    int cap;                      /* allocated length of pages and bits arrays */
+    int last;                     /* index of last modified page */
+    uint32_t *pages;              /* sorted page indeces (utf32 >> 8) */
+    uint32_t (*bits)[8];          /* 256-bit map of each page */
+} cset_builder_t;
+
+static bool cset_add(cset_builder_t *b, uint32_t utf32)
+{
+    uint32_t page = utf32 >> 8;
+    int lsi, rsi;
+
+    if (b->npages != 0 && b->pages[b->last] == page)
+    {
+        b->bits[b->last][(utf32 >> 5) & 7] |= (uint32_t)1 << (utf32 & 31);
+        return true;
+    }
+
+    /* cmap tables are usually sorted, so check the tail first */
+    lsi = b->npages;
+    if (b->npages != 0 && b->pages[b->npages - 1] >= page)
+    {
+        lsi = 0;
+        rsi = b->npages - 1;
+        while (lsi <= rsi)
+        {
+            int mid = (lsi + rsi) / 2;
+            if (b->pages[mid] == page) break;
+            if (b->pages[mid] < page)
+                lsi = mid + 1; else
+                rsi = mid - 1;
+        }
+    }
+
+    if (lsi == b->npages || b->pages[lsi] != page)
+    {
+        if (b->npages == b->cap)
+        {
+            int cap = b->cap == 0 ? 16 : b->cap * 2;
+            uint32_t *pages = (uint32_t *)mem_realloc(b->pages, sizeof(uint32_t) * cap);
+            if (pages == NULL) return false;
+            b->pages = pages;
+            uint32_t (*bits)[8] = (uint32_t (*)[8])mem_realloc(b->bits, sizeof(uint32_t) * 8 * cap);
+            if (bits == NULL) return false;
+            b->bits = bits;
+            b->cap = cap;
+        }
+        memmove(b->pages + lsi + 1, b->pages + lsi, sizeof(uint32_t) * (b->npages - lsi));
+        memmove(b->bits + lsi + 1, b->bits + lsi, sizeof(uint32_t) * 8 * (b->npages - lsi));
+        memset(b->bits[lsi], 0, sizeof(uint32_t) * 8);
+        b->pages[lsi] = page;
+        b->npages++;
+    }
+
+    b->last = lsi;
+    b->bits[lsi][(utf32 >> 5) & 7] |= (uint32_t)1 << (utf32 & 31);
+    return true;
+}
+
+static void cset_free(cset_builder_t *b)
+{
+    mem_free(b->pages);
+    mem_free(b->bits);
+}
+
+/**
+ * @brief Moving the built set to ttf_t::coverage in font arena
+ */
+static bool cset_finish(ttf_t *ttf, cset_builder_t *b)
+{
+    bool res = true;
+    if (b->npages != 0)
+    {
+        void *data = arena_alloc(ttf, sizeof(uint32_t) * 9 * b->npages);
+        if (data == NULL)
+            res = false;
+        else
+        {
+            ttf->coverage.npages = b->npages;
+            ttf->coverage.bits = (uint32_t (*)[8])data;
+            ttf->coverage.pages = (uint32_t *)(ttf->coverage.bits + b->npages);
+            memcpy(ttf->coverage.bits, b->bits, sizeof(uint32_t) * 8 * b->npages);
+            memcpy(ttf->coverage.pages, b->pages, sizeof(uint32_t) * b->npages);
+        }
+    }
+    cset_free(b);
+    return res;
+}
+
 static int parse_fmt4(ttf_t *ttf, uint8_t *data, int dataSize, bool headers_only)
 {
     ttf_fmt4_t *tab;
@@ -1274,6 +2826,7 @@ static int parse_fmt4(ttf_t *ttf, uint8_t *data, int dataSize, bool headers_only
     uint16_t *idRangeOffset; /* Offsets into glyphIdArray or 0 */
     uint16_t *glyphIdArray; /* Glyph index array (arbitrary length) */
     int segCount, idArrayLen;
+    cset_builder_t cset;
     int i, j, k;
 
     if (dataSize < (int)sizeof(ttf_fmt4_t)) return TTF_ERR_FMT;
@@ -1292,6 +2845,7 @@ static int parse_fmt4(ttf_t *ttf, uint8_t *data, int dataSize, bool headers_only
     if (idArrayLen < 0) return TTF_ERR_FMT;
 
     k = 0;
+    memset(&cset, 0, sizeof(cset));
     for (i = 0; i < segCount; i++)
     {
         conv16(endCode[i]);
@@ -1299,7 +2853,10 @@ static int parse_fmt4(ttf_t *ttf, uint8_t *data, int dataSize, bool headers_only
         conv16(idDelta[i]);
         conv16(idRangeOffset[i]);
         if (i == segCount - 1 && startCode[i] != 0xFFFF)
+        {
+            cset_free(&cset);
             return TTF_ERR_FMT;
+        }
         if (startCode[i] == 0xFFFF) break;
         for (j = startCode[i]; j <= endCode[i]; j++)
         {
@@ -1307,13 +2864,30 @@ static int parse_fmt4(ttf_t *ttf, uint8_t *data, int dataSize, bool headers_only
             if (range >= 0)
                 ttf->ubranges[range / 32] |= (uint32_t)1 << (range & 31);
             k++;
+            /* characters mapped to the missing glyph are not covered */
+            if (idRangeOffset[i] == 0)
+            {
+                if ((uint16_t)(j + idDelta[i]) == 0) continue;
+            }
+            else
+            {
+                uint16_t *addr = &idRangeOffset[i] + idRangeOffset[i] / 2 + (j - startCode[i]);
+                if ((uint8_t *)addr + 2 > data + dataSize || *addr == 0) continue;
+            }
+            if (!cset_add(&cset, j))
+            {
+                cset_free(&cset);
+                return TTF_ERR_NOMEM;
+            }
         }
     }
+    if (!cset_finish(ttf, &cset)) return TTF_ERR_NOMEM;
 
     if (headers_only) return TTF_DONE;
 
     ttf->nchars = k;
-    ttf->chars = (uint32_t *)malloc(sizeof(uint32_t) * 2 * ttf->nchars);
+    ttf->chars = (uint32_t *)arena_alloc(ttf, sizeof(uint32_t) * 2 * ttf->nchars);
+    if (ttf->chars == NULL) return TTF_ERR_NOMEM;
     ttf->char2glyph = ttf->chars + ttf->nchars;
     k = 0;
     for (i = 0; i < segCount; i++)
@@ -1354,6 +2928,7 @@ static int parse_fmt12(ttf_t *ttf, uint8_t *data, int dataSize, bool headers_onl
     uint32_t smgSize;
     uint32_t i, j, k;
     ttf_fmt12_smg_t *smgs;
+    cset_builder_t cset;
 
     if (dataSize < (int)sizeof(ttf_fmt12_t)) return TTF_ERR_FMT;
     tab = (ttf_fmt12_t *)data;
@@ -1368,6 +2943,7 @@ static int parse_fmt12(ttf_t *ttf, uint8_t *data, int dataSize, bool headers_onl
 
     smgs = (ttf_fmt12_smg_t *)(data + sizeof(ttf_fmt12_t));
     k = 0;
+    memset(&cset, 0, sizeof(cset));
     for (i = 0; i < tab->numGroups; i++)
     {
         conv32(smgs[i].startCharCode);
@@ -1379,15 +2955,24 @@ static int parse_fmt12(ttf_t *ttf, uint8_t *data, int dataSize, bool headers_onl
             if (range >= 0)
                 ttf->ubranges[range / 32] |= (uint32_t)1 << (range & 31);
             k++;
+            /* characters mapped to the missing glyph are not covered */
+            if (smgs[i].startGlyphID + (j - smgs[i].startCharCode) == 0) continue;
+            if (j > 0x10FFFF) continue;
+            if (!cset_add(&cset, j))
+            {
+                cset_free(&cset);
+                return TTF_ERR_NOMEM;
+            }
         }
     }
+    if (!cset_finish(ttf, &cset)) return TTF_ERR_NOMEM;
 
     if (headers_only) return TTF_DONE;
 
     ttf->nchars = k;
-    ttf->chars = (uint32_t *)malloc(sizeof(uint32_t) * 2 * ttf->nchars);
+    ttf->chars = (uint32_t *)arena_alloc(ttf, sizeof(uint32_t) * 2 * ttf->nchars);
+    if (ttf->chars == NULL) return TTF_ERR_NOMEM;
     ttf->char2glyph = ttf->chars + ttf->nchars;
-    memset(ttf->chars, 0, sizeof(uint32_t) * 2 * ttf->nchars);
     k = 0;
     for (i = 0; i < tab->numGroups; i++)
     {
@@ -1453,7 +3038,7 @@ static int locate_fmt12_table(pps_t *s)
 
 static const char *empty_string = "";
 
-static const char *namerec2ascii(const char *p, int len, int platformID, int encodingID, int languageID)
+static const char *namerec2ascii(ttf_t *ttf, const char *p, int len, int platformID, int encodingID, int languageID)
 {
     /*
         platformID      1      - Macintosh
@@ -1465,7 +3050,8 @@ static const char *namerec2ascii(const char *p, int len, int platformID, int enc
     */
     if (platformID == 1 && encodingID == 0)
     {
-        char *res = (char *)malloc(len + 1);
+        char *res = (char *)arena_alloc(ttf, len + 1);
+        if (res == NULL) return empty_string;
         memcpy(res, p, len);
         res[len] = 0;
         return res;
@@ -1474,7 +3060,8 @@ static const char *namerec2ascii(const char *p, int len, int platformID, int enc
     {
         int i;
         len = len / 2;
-        char *res = (char *)malloc(len + 1);
+        char *res = (char *)arena_alloc(ttf, len + 1);
+        if (res == NULL) return empty_string;
         for (i = 0; i < len; i++)
             res[i] = p[i * 2 + 1];
         res[len] = 0;
@@ -1525,7 +3112,7 @@ static bool parse_name(ttf_t *ttf, uint8_t *tab, int tabsize)
         s = (char *)tab + hdr->stringOffset + hdr->nameRecord[i].offset;
         #define match(id, field) \
         if (hdr->nameRecord[i].nameID == id && ttf->names.field == empty_string) \
-            ttf->names.field = namerec2ascii(s, hdr->nameRecord[i].length, \
+            ttf->names.field = namerec2ascii(ttf, s, hdr->nameRecord[i].length, \
                                              hdr->nameRecord[i].platformID, \
                                              hdr->nameRecord[i].encodingID, \
                                              hdr->nameRecord[i].languageID)
@@ -1549,19 +3136,19 @@ static bool parse_name(ttf_t *ttf, uint8_t *tab, int tabsize)
     return true;
 }
 
-static ttf_t *allocate_ttf_structure(int nglyphs, bool headers_only)
+/**
+ * @brief Allocating of font object with the arena of precalculated size
+ * @param reserve Size of the other data placed to the first slab
+ */
+static ttf_t *allocate_ttf_structure(int nglyphs, bool headers_only, size_t reserve)
 {
     ttf_t *res;
     if (headers_only)
-    {
-        res = (ttf_t *)calloc(sizeof(ttf_t), 1);
-        if (res == NULL) return NULL;
-        return res;
-    }
-    res = (ttf_t *)calloc(sizeof(ttf_t)+nglyphs * sizeof(ttf_glyph_t), 1);
+        return arena_create(reserve);
+    res = arena_create(ARENA_ROUND(nglyphs * sizeof(ttf_glyph_t)) + reserve);
     if (res == NULL) return NULL;
     res->nglyphs = nglyphs;
-    res->glyphs = (ttf_glyph_t *)(res + 1);
+    res->glyphs = (ttf_glyph_t *)arena_alloc(res, nglyphs * sizeof(ttf_glyph_t));
     return res;
 }
 
@@ -1585,6 +3172,7 @@ static void ttf_prepare_to_output(ttf_t *ttf, pps_t *pps)
         g->advance *= scale;
         g->lbearing *= scale;
         g->rbearing = g->advance - (g->lbearing + g->xbounds[1] - g->xbounds[0]);
+        if (g->outline == NULL) continue; /* no outline or quantized one */
         for (j = 0; j < g->ncontours; j++)
         {
             p = g->outline->cont[j].pt;
@@ -1642,20 +3230,30 @@ static void ttf_prepare_to_output(ttf_t *ttf, pps_t *pps)
     ttf->os2.usWinDescent *= scale;
 }
 
-int ttf_load_from_mem(const uint8_t *data, int size, ttf_t **output, bool headers_only)
+/**
+ * @brief Loading of font from memory
+ * @param filename File name stored in the font object or NULL
+ */
+static int load_font(const uint8_t *data, int size, ttf_t **output, int flags, const char *filename)
 {
     int result;
     ttf_t *ttf;
     pps_t s;
-    int i;
+    int i, nglyphs;
+    size_t reserve;
+
+    bool headers_only = (flags & TTF_LOAD_HEADERS) != 0;
+    bool metrics_only = !headers_only && (flags & TTF_LOAD_METRICS) != 0;
 
     ttf = NULL;
+    memset(&s, 0, sizeof(pps_t));
+    s.quantized = !headers_only && !metrics_only && (flags & TTF_LOAD_QUANTIZED) != 0;
+    s.components = !headers_only && !metrics_only && (flags & TTF_LOAD_COMPONENTS) != 0;
 
     /* check entire font checksum */
     check(ttf_checksum(data, size) == 0xB1B0AFBA, TTF_ERR_CSUM);
 
     /* extract top level tables */
-    memset(&s, 0, sizeof(pps_t));
     result = ttf_extract_tables(data, size, &s);
     if (result != 0) goto error;
 
@@ -1666,10 +3264,51 @@ int ttf_load_from_mem(const uint8_t *data, int size, ttf_t **output, bool header
     /* check maxp table */
     check(s.smaxp >= 6, TTF_ERR_FMT);
     check(big16toh(((ttf_maxp_t *)s.pmaxp)->verMaj) <= 1, TTF_ERR_UTAB);
+    nglyphs = big16toh(s.pmaxp->numGlyphs);
+    s.scale = s.phead->unitsPerEm == 0 ? 0.0f : 1.0f / big16toh(s.phead->unitsPerEm);
+
+    /* the names and the file name are placed to the first slab */
+    reserve = s.sname + 16 * ARENA_ALIGN;
+    if (filename != NULL)
+        reserve += ARENA_ROUND(strlen(filename) + 1);
+
+    if (!headers_only)
+    {
+        /* check and convert loca table */
+        check(big16toh(s.phead->indexToLocFormat) <= 1, TTF_ERR_FMT);
+        if (s.phead->indexToLocFormat == 0)
+        {
+            check(s.sloca >= nglyphs * 2, TTF_ERR_FMT);
+            s.ploca16 = (uint16_t *)s.ploca;
+            for (i = 0; i < nglyphs; i++)
+                conv16(s.ploca16[i]);
+        }
+        else
+        {
+            check(s.sloca >= nglyphs * 4, TTF_ERR_FMT);
+            s.ploca32 = (uint32_t *)s.ploca;
+            for (i = 0; i < nglyphs; i++)
+                conv32(s.ploca32[i]);
+        }
+
+        /* measure the outlines to place them in glyph order */
+        if (!metrics_only)
+        {
+            s.outline_offset = (int *)mem_alloc((nglyphs + 1) * sizeof(int));
+            check(s.outline_offset != NULL, TTF_ERR_NOMEM);
+            check(measure_glyf_table(&s, nglyphs, s.outline_offset), TTF_ERR_NOMEM);
+            reserve += s.outline_offset[nglyphs];
+        }
+    }
 
     /* allocate ttf structure */
-    ttf = allocate_ttf_structure(big16toh(s.pmaxp->numGlyphs), headers_only);
+    ttf = allocate_ttf_structure(nglyphs, headers_only, reserve);
     check(ttf != NULL, TTF_ERR_NOMEM);
+    if (s.outline_offset != NULL)
+    {
+        s.outlines = (uint8_t *)arena_alloc(ttf, s.outline_offset[nglyphs]);
+        check(s.outlines != NULL, TTF_ERR_NOMEM);
+    }
 
     /* check name table */
     check(s.sname >= (int)sizeof(ttf_name_t), TTF_ERR_FMT);
@@ -1693,58 +3332,64 @@ int ttf_load_from_mem(const uint8_t *data, int size, ttf_t **output, bool header
 
     if (!headers_only)
     {
-        /* check and convert loca table */
-        check(big16toh(s.phead->indexToLocFormat) <= 1, TTF_ERR_FMT);
-        if (s.phead->indexToLocFormat == 0)
-        {
-            check(s.sloca >= ttf->nglyphs * 2, TTF_ERR_FMT);
-            s.ploca16 = (uint16_t *)s.ploca;
-            for (i = 0; i < ttf->nglyphs; i++)
-                conv16(s.ploca16[i]);
-        }
+        /* reading the glyph data */
+        if (metrics_only)
+            parse_glyf_bounds(ttf, &s);
         else
         {
-            check(s.sloca >= ttf->nglyphs * 4, TTF_ERR_FMT);
-            s.ploca32 = (uint32_t *)s.ploca;
-            for (i = 0; i < ttf->nglyphs; i++)
-                conv32(s.ploca32[i]);
+            result = parse_glyf_table(ttf, &s);
+            if (result != TTF_DONE) goto error;
         }
 
-        /* reading the glyph data */
-        result = parse_glyf_table(ttf, &s);
+        result = parse_hmtx_table(ttf, &s);
         if (result != TTF_DONE) goto error;
 
-        result = parse_hmtx_table(ttf, &s);
+        result = parse_kerning(ttf, &s);
         if (result != TTF_DONE) goto error;
     }
 
     /* prepare to output */
     ttf->filename = empty_string;
+    if (filename != NULL)
+    {
+        char *name = (char *)arena_alloc(ttf, strlen(filename) + 1);
+        if (name != NULL)
+            ttf->filename = strcpy(name, filename);
+    }
     ttf->glyf_csum = s.glyf_csum;
     ttf_prepare_to_output(ttf, &s);
 
+    mem_free(s.outline_offset);
+    mem_free(s.scratch[0]);
+    mem_free(s.scratch[1]);
     *output = ttf;
     return TTF_DONE;
 
 error:
+    mem_free(s.outline_offset);
+    mem_free(s.scratch[0]);
+    mem_free(s.scratch[1]);
     ttf_free(ttf);
     *output = NULL;
     return result;
 }
 
-static bool try_strdup(const char *s, char **dest)
+int ttf_load_from_mem(const uint8_t *data, int size, ttf_t **output, bool headers_only)
 {
-    char *res;
-    int len = strlen(s);
-    res = (char *)malloc(len + 1);
-    if (res == NULL) return false;
-    memcpy(res, s, len);
-    res[len] = 0;
-    *dest = res;
-    return true;
+    return ttf_load_from_mem_ex(data, size, output, headers_only ? TTF_LOAD_HEADERS : TTF_LOAD_FULL);
+}
+
+int ttf_load_from_mem_ex(const uint8_t *data, int size, ttf_t **output, int flags)
+{
+    return load_font(data, size, output, flags, NULL);
 }
 
 int ttf_load_from_file(const char *filename, ttf_t **output, bool headers_only)
+{
+    return ttf_load_from_file_ex(filename, output, headers_only ? TTF_LOAD_HEADERS : TTF_LOAD_FULL);
+}
+
+int ttf_load_from_file_ex(const char *filename, ttf_t **output, int flags)
 {
     FILE *f;
     int result;
@@ -1754,6 +3399,7 @@ int ttf_load_from_file(const char *filename, ttf_t **output, bool headers_only)
 
     data = NULL;
     *output = NULL;
+    TRACE_BEGIN("ttf_load_from_file", -1, filename);
 
     /* open file and get it size */
     f = fopen(filename, "rb");
@@ -1766,25 +3412,24 @@ int ttf_load_from_file(const char *filename, ttf_t **output, bool headers_only)
     check(fseek(f, 0, SEEK_SET) == 0, TTF_ERR_FMT);
 
     /* allocate memory to file content */
-    data = (uint8_t *)malloc(size);
+    data = (uint8_t *)mem_alloc(size);
     check(data != NULL, TTF_ERR_NOMEM);
 
     /* read file content */
     check(fread(data, 1, size, f) == (size_t)size, TTF_ERR_FMT);
 
     fclose(f);
-    result = ttf_load_from_mem(data, size, output, headers_only);
-    free(data);
-
-    if (*output != NULL)
-        try_strdup(filename, (char **)&(*output)->filename);
+    result = load_font(data, size, output, flags, filename);
+    mem_free(data);
 
+    TRACE_END("ttf_load_from_file");
     return result;
 
 error:
-    free(data);
+    mem_free(data);
     if (f != NULL)
         fclose(f);
+    TRACE_END("ttf_load_from_file");
     return result;
 }
 
@@ -1913,7 +3558,7 @@ static ttf_t **load_fonts_from_dir(ttf_t **list, int *count, int *cap, const cha
                     {
                         ttf_t **tmp;
                         *cap *= 2;
-                        tmp = (ttf_t **)realloc(list, sizeof(ttf_t *) * *cap);
+                        tmp = (ttf_t **)mem_realloc(list, sizeof(ttf_t *) * *cap);
                         if (tmp == NULL) break;
                         list = tmp;
                     }
@@ -1966,7 +3611,7 @@ static ttf_t **load_fonts_from_dir(ttf_t **list, int *count, int *cap, const cha
             {
                 ttf_t **tmp;
                 *cap *= 2;
-                tmp = (ttf_t **)realloc(list, sizeof(ttf_t *) * *cap);
+                tmp = (ttf_t **)mem_realloc(list, sizeof(ttf_t *) * *cap);
                 if (tmp == NULL) break;
                 list = tmp;
             }
@@ -2008,9 +3653,10 @@ ttf_t **ttf_list_fonts(const char **directories, int dir_count, const char *mask
     cap = 64;
     fullpath[0] = 0;
 
-    res = (ttf_t **)malloc(sizeof(ttf_t *) * cap);
+    res = (ttf_t **)mem_alloc(sizeof(ttf_t *) * cap);
     if (res == NULL) return NULL;
 
+    TRACE_BEGIN("ttf_list_fonts", -1, NULL);
     for (i = 0; i < dir_count; i++)
         res = load_fonts_from_dir(res, &count, &cap, directories[i], fullpath, 5, mask);
 
@@ -2031,6 +3677,7 @@ ttf_t **ttf_list_fonts(const char **directories, int dir_count, const char *mask
         res[n++] = res[i];
     }
     res[n] = NULL;
+    TRACE_END("ttf_list_fonts");
 
     return res;
 #endif
@@ -2084,33 +3731,293 @@ int ttf_find_glyph(const ttf_t *ttf, uint32_t utf32)
     return -1;
 }
 
+bool ttf_has_char(const ttf_t *ttf, uint32_t utf32_char)
+{
+    uint32_t page = utf32_char >> 8;
+    int lsi = 0;
+    int rsi = ttf->coverage.npages - 1;
+    while (lsi <= rsi)
+    {
+        int mid = (lsi + rsi) / 2;
+        if (ttf->coverage.pages[mid] == page)
+            return (ttf->coverage.bits[mid][(utf32_char >> 5) & 7] >> (utf32_char & 31)) & 1;
+        if (ttf->coverage.pages[mid] < page)
+            lsi = mid + 1; else
+            rsi = mid - 1;
+    }
+    return false;
+}
+
+float ttf_kerning(const ttf_t *ttf, int left_glyph, int right_glyph)
+{
+    const struct ttf_kern *kern = ttf->kern;
+    uint32_t key;
+    int i;
+
+    if (kern == NULL) return 0.0f;
+    if ((unsigned)left_glyph > 0xFFFF || (unsigned)right_glyph > 0xFFFF) return 0.0f;
+
+    /* glyph pairs */
+    key = ((uint32_t)left_glyph << 16) | (uint32_t)right_glyph;
+    for (i = kern_hash(key) & (kern->hsize - 1); kern->keys[i] != KERN_EMPTY; i = (i + 1) & (kern->hsize - 1))
+        if (kern->keys[i] == key)
+            return kern->values[i] * kern->scale;
+
+    /* class pairs */
+    return kern_class_value(kern->classes, kern->nclasses, left_glyph, right_glyph, NULL, 0) * kern->scale;
+}
+
+void ttf_kerning_run(const ttf_t *ttf, const int *glyphs, int count, float *kerning)
+{
+    int i;
+    if (count <= 0) return;
+    if (ttf->kern == NULL)
+        memset(kerning, 0, sizeof(float) * count);
+    else
+    {
+        for (i = 0; i < count - 1; i++)
+            kerning[i] = ttf_kerning(ttf, glyphs[i], glyphs[i + 1]);
+        kerning[count - 1] = 0.0f;
+    }
+}
+
+/* Case folding used by the family names comparison */
+#define FOLD_CHAR(c) ((c) >= 'a' ? (c) - 'a' + 'A' : (c))
+
+/* Number of bitset words that ttf_index_match_id keeps on the stack */
+#define TTF_INDEX_STACK_WORDS 64
+
+typedef struct ttf_query_item
+{
+    char req;                     /* lower case modifier or 0 if unknown */
+    bool exactly;                 /* modifier has the '!' suffix */
+    int weight;                   /* argument of 'w' modifier */
+    const char *family;           /* argument of 'f' modifier */
+    int nranges;                  /* 't' modifier: number of ranges used by text */
+    int first;                    /* 't' modifier: first entry in ttf_query::range */
+    unsigned total;               /* 't' modifier: number of chars in known ranges */
+} ttf_qitem_t;
+
+struct ttf_query
+{
+    int nitems;                   /* number of modifiers */
+    ttf_qitem_t *item;            /* modifiers in the requirements order */
+    struct
+    {
+        uint8_t index;            /* index in ubranges[] */
+        unsigned count;           /* number of text chars in range */
+    } *range;                     /* ranges of all 't' modifiers */
+};
+
+typedef struct ttf_index_key
+{
+    const char *str;              /* not folded key string (part of family name) */
+    int len;                      /* key length */
+    uint32_t hash;                /* key hash */
+    uint32_t *exact;              /* fonts with family == key */
+    uint32_t *prefix;             /* fonts with family == key + " ..." */
+} ttf_ikey_t;
+
+struct ttf_index
+{
+    ttf_t **list;                 /* indexed font list */
+    int nfonts;                   /* number of fonts in list */
+    int nwords;                   /* length of all font bitsets */
+    uint32_t *all;                /* all fonts of the list */
+    uint32_t *flags[5];           /* fonts by fsSelection: bold, italic, outlined, oblique, regular */
+    uint32_t *ranges;             /* 163 bitsets of fonts presenting the ubranges[] */
+    int nweights;                 /* number of distinct weight classes */
+    int *weights;                 /* distinct weight classes */
+    uint32_t *wfonts;             /* nweights bitsets of fonts by weight class */
+    int nkeys;                    /* number of interned family keys */
+    ttf_ikey_t *keys;             /* interned family keys */
+    int hsize;                    /* hash table size (power of 2) */
+    int *htab;                    /* hash table of key indeces, -1 for empty */
+};
+
+static uint32_t fold_hash(const char *s, int len)
+{
+    /* FNV-1a */
+    uint32_t h = 2166136261u;
+    for (int i = 0; i < len; i++)
+    {
+        h ^= (uint8_t)FOLD_CHAR(s[i]);
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static bool fold_equal(const char *a, const char *b, int len)
+{
+    for (int i = 0; i < len; i++)
+        if (FOLD_CHAR(a[i]) != FOLD_CHAR(b[i]))
+            return false;
+    return true;
+}
+
 /**
- * @brief return matching level in range 0...3
+ * @brief Counting the chars of utf16 text by ubranges
+ * @return Number of chars in known ranges
  */
-static int font_matching_metric(const ttf_t *font, char req, va_list args)
+static unsigned count_text_ranges(const uint16_t *t, unsigned counts[163])
+{
+    unsigned total = 0;
+    int last_range = 0;
+    memset(counts, 0, sizeof(unsigned) * 163);
+    for (; *t != 0; t++)
+    {
+        if (*t < ubranges[last_range].first || *t > ubranges[last_range].last)
+        {
+            int range = find_ubrange(*t);
+            if (range == -1) continue;
+            last_range = range;
+        }
+        counts[last_range]++;
+        total++;
+    }
+    return total;
+}
+
+static int text_metric(unsigned matched_count, unsigned wchars_count)
+{
+    if (wchars_count == matched_count) return 3;
+    if (matched_count > wchars_count * 2 / 3) return 2;
+    if (matched_count >= wchars_count / 2) return 1;
+    return 0;
+}
+
+static int weight_metric(int font_weight, int weight)
+{
+    int delta = abs(font_weight - weight) / 100;
+    return delta > 3 ? 0 : 3 - delta;
+}
+
+ttf_query_t *ttf_query_vcompile(const char *requirements, va_list Args)
 {
-    switch (req)
+    va_list args;
+    unsigned counts[163];
+    int nitems, nranges, nchars;
+    const char *s;
+
+    /* first pass: calculation of the query size */
+    nitems = 0;
+    nranges = 0;
+    nchars = 0;
+    va_copy(args, Args);
+    for (s = requirements; *s != 0; s++)
     {
-    case 'b': case 'B': return font->os2.fsSelection.bold ? 3 : 0;
-    case 'i': case 'I': return font->os2.fsSelection.italic ? 3 : 0;
-    case 'h': case 'H': return font->os2.fsSelection.outlined ? 3 : 0;
-    case 'o': case 'O': return font->os2.fsSelection.oblique ? 3 : (font->os2.fsSelection.italic ? 2 : 0);
-    case 'r': case 'R': return font->os2.fsSelection.regular ? 3 : 0;
+        nitems++;
+        switch (*s)
+        {
+        case 'w': case 'W':
+            (void)va_arg(args, int);
+            break;
+        case 'f': case 'F':
+            nchars += strlen(va_arg(args, const char *)) + 1;
+            break;
+        case 't': case 'T':
+            count_text_ranges(va_arg(args, const uint16_t *), counts);
+            for (int i = 0; i < 163; i++)
+                nranges += counts[i] != 0;
+            break;
+        }
+        if (s[1] == '!') s++;
     }
-    if (req == 'w' || req == 'W')
+    va_end(args);
+
+    /* allocate the query object */
+    ttf_query_t *q = (ttf_query_t *)mem_calloc(
+        sizeof(ttf_query_t) +
+        sizeof(ttf_qitem_t) * nitems +
+        sizeof(*q->range) * nranges +
+        nchars, 1);
+    if (q == NULL) return NULL;
+    q->item = (ttf_qitem_t *)(q + 1);
+    q->range = (void *)(q->item + nitems);
+    char *str = (char *)(q->range + nranges);
+
+    /* second pass: filling the query */
+    nranges = 0;
+    va_copy(args, Args);
+    for (s = requirements; *s != 0; s++)
     {
-        int weight = va_arg(args, int);
-        int delta = abs(font->os2.usWeightClass - weight) / 100;
-        return delta > 3 ? 0 : 3 - delta;
+        ttf_qitem_t *it = q->item + q->nitems++;
+        switch (*s)
+        {
+        case 'b': case 'B': it->req = 'b'; break;
+        case 'i': case 'I': it->req = 'i'; break;
+        case 'h': case 'H': it->req = 'h'; break;
+        case 'o': case 'O': it->req = 'o'; break;
+        case 'r': case 'R': it->req = 'r'; break;
+        case 'w': case 'W':
+            it->req = 'w';
+            it->weight = va_arg(args, int);
+            break;
+        case 'f': case 'F':
+        {
+            const char *family = va_arg(args, const char *);
+            int len = strlen(family);
+            memcpy(str, family, len + 1);
+            it->req = 'f';
+            it->family = str;
+            str += len + 1;
+            break;
+        }
+        case 't': case 'T':
+            it->req = 't';
+            it->total = count_text_ranges(va_arg(args, const uint16_t *), counts);
+            it->first = nranges;
+            for (int i = 0; i < 163; i++)
+            {
+                if (counts[i] == 0) continue;
+                q->range[nranges].index = (uint8_t)i;
+                q->range[nranges].count = counts[i];
+                nranges++;
+            }
+            it->nranges = nranges - it->first;
+            break;
+        }
+        if (s[1] == '!')
+        {
+            it->exactly = true;
+            s++;
+        }
     }
-    if (req == 'f' || req == 'F')
+    va_end(args);
+
+    return q;
+}
+
+ttf_query_t *ttf_query_compile(const char *requirements, ...)
+{
+    va_list args;
+    va_start(args, requirements);
+    ttf_query_t *q = ttf_query_vcompile(requirements, args);
+    va_end(args);
+    return q;
+}
+
+/**
+ * @brief return matching level in range 0...3
+ */
+static int font_matching_metric(const ttf_t *font, const ttf_query_t *q, const ttf_qitem_t *it)
+{
+    switch (it->req)
+    {
+    case 'b': return font->os2.fsSelection.bold ? 3 : 0;
+    case 'i': return font->os2.fsSelection.italic ? 3 : 0;
+    case 'h': return font->os2.fsSelection.outlined ? 3 : 0;
+    case 'o': return font->os2.fsSelection.oblique ? 3 : (font->os2.fsSelection.italic ? 2 : 0);
+    case 'r': return font->os2.fsSelection.regular ? 3 : 0;
+    case 'w': return weight_metric(font->os2.usWeightClass, it->weight);
+    case 'f':
     {
-        const char *a = va_arg(args, const char *);
+        const char *a = it->family;
         const char *b = font->names.family;
         while (1)
         {
-            char A = *a >= 'a' ? *a - 'a' + 'A' : *a;
-            char B = *b >= 'a' ? *b - 'a' + 'A' : *b;
+            char A = FOLD_CHAR(*a);
+            char B = FOLD_CHAR(*b);
             if (A == B)
             {
                 if (A == 0) return 3; /* exact matching */
@@ -2122,67 +4029,39 @@ static int font_matching_metric(const ttf_t *font, char req, va_list args)
             return 0;
         }
     }
-    if (req == 't' || req == 'T')
+    case 't':
     {
-        const uint16_t *t = va_arg(args, const uint16_t *);
-        int last_range = 0;
-        unsigned wchars_count = 0;
         unsigned matched_count = 0;
-        while (*t != 0)
+        for (int i = it->first; i < it->first + it->nranges; i++)
         {
-            if (*t < ubranges[last_range].first || *t > ubranges[last_range].last)
-            {
-                int range = find_ubrange(*t);
-                if (range == -1)
-                {
-                    t++;
-                    continue;
-                }
-                last_range = range;
-            }
-            if (font->ubranges[last_range / 32] & (1 << (last_range & 31)))
-                matched_count++;
-            wchars_count++;
-            t++;
-        }
-        if (wchars_count == matched_count) return 3;
-        if (matched_count > wchars_count * 2 / 3) return 2;
-        if (matched_count >= wchars_count / 2) return 1;
-        return 0;
+            int range = q->range[i].index;
+            if (font->ubranges[range / 32] & ((uint32_t)1 << (range & 31)))
+                matched_count += q->range[i].count;
+        }
+        return text_metric(matched_count, it->total);
+    }
     }
     return 0;
 }
 
-int ttf_list_vmatch(ttf_t **list, const char *requirements, va_list Args)
+int ttf_list_query_id(ttf_t **list, const ttf_query_t *query)
 {
-    va_list args;
-
     int res = -1;
     uint64_t res_score = 0;
 
     for (int i = 0; list[i] != NULL; i++)
     {
         uint64_t score = 0;
-        const char *s = requirements;
-        va_copy(args, Args);
-        while (*s != 0)
+        for (int j = 0; j < query->nitems; j++)
         {
-            char req = *s++;
-            bool exactly = false;
-            if (*s == '!')
-            {
-                exactly = true;
-                s++;
-            }
-            int m = font_matching_metric(list[i], req, args);
-            if (exactly && m != 3)
+            int m = font_matching_metric(list[i], query, query->item + j);
+            if (query->item[j].exactly && m != 3)
             {
                 score = 0;
                 break;
             }
             score = (score << 2) | m;
         }
-        va_end(args);
         if (score > res_score)
         {
             res_score = score;
@@ -2193,6 +4072,15 @@ int ttf_list_vmatch(ttf_t **list, const char *requirements, va_list Args)
     return res;
 }
 
+int ttf_list_vmatch(ttf_t **list, const char *requirements, va_list args)
+{
+    ttf_query_t *q = ttf_query_vcompile(requirements, args);
+    if (q == NULL) return -1;
+    int res = ttf_list_query_id(list, q);
+    ttf_free_query(q);
+    return res;
+}
+
 int ttf_list_match_id(ttf_t **list, const char *requirements, ...)
 {
     va_list args;
@@ -2211,99 +4099,536 @@ ttf_t *ttf_list_match(ttf_t **list, ttf_t *deflt, const char *requirements, ...)
     return id == -1 ? deflt : list[id];
 }
 
-/**
- * @brief Расчёт координаты кривой Безье
- * @param p0
- * @param p1
- * @param p2
- * @param t
- * @return
- */
-static __inline float qbezier(float p0, float p1, float p2, float t)
+static ttf_ikey_t *index_find_key(const ttf_index_t *index, const char *str, int len, uint32_t hash)
 {
-    float tt = 1.0f - t;
-    return tt * tt * p0 + 2.0f * t * tt * p1 + t * t * p2;
+    int mask = index->hsize - 1;
+    for (int i = hash & mask; index->htab[i] != -1; i = (i + 1) & mask)
+    {
+        ttf_ikey_t *key = index->keys + index->htab[i];
+        if (key->hash == hash && key->len == len && fold_equal(key->str, str, len))
+            return key;
+    }
+    return NULL;
 }
 
-/**
- * @brief Первая производная функции Безье
- * @param p0 Опорная точка 0
- * @param p1 Опорная точка 1
- * @param p2 Опорная точка 2
- * @param t Параметр кривой
- * @return Значение производной
- */
-static __inline float qbezier_diff1(float p0, float p1, float p2, float t)
+static ttf_ikey_t *index_intern_key(ttf_index_t *index, const char *str, int len)
 {
-    return 2.0f * (t * (p0 - 2.0f * p1 + p2) - p0 + p1);
+    uint32_t hash = fold_hash(str, len);
+    ttf_ikey_t *key = index_find_key(index, str, len, hash);
+    if (key != NULL) return key;
+    int mask = index->hsize - 1;
+    int i = hash & mask;
+    while (index->htab[i] != -1)
+        i = (i + 1) & mask;
+    index->htab[i] = index->nkeys;
+    key = index->keys + index->nkeys++;
+    key->str = str;
+    key->len = len;
+    key->hash = hash;
+    return key;
 }
 
-static int linearize_qbezier(ttf_point_t curve[3], ttf_point_t *dst, uint8_t quality)
-{
-    int i, res;
-    float v1[2], v2[2], angle, step;
-
-    /* Найдём косательные к кривой в точке t=0 и t=1 */
-    v1[0] = qbezier_diff1(curve[0].x, curve[1].x, curve[2].x, 0.0f);
-    v1[1] = qbezier_diff1(curve[0].y, curve[1].y, curve[2].y, 0.0f);
-    v2[0] = qbezier_diff1(curve[0].x, curve[1].x, curve[2].x, 1.0f);
-    v2[1] = qbezier_diff1(curve[0].y, curve[1].y, curve[2].y, 1.0f);
-
-    /* Найдём угол между косательными векторами */
-    angle = fabsf(VECCROSS(v1, v2));
-    if (angle < EPSILON) return 0;
-    angle /= VECLEN(v1);
-    angle /= VECLEN(v2);
-    if (angle >= 1.0f) angle = 1.0f;
-    angle = asinf(angle);
+#define BIT_SET(bitset, i) (bitset)[(i) / 32] |= (uint32_t)1 << ((i) & 31)
 
-    /* Найдём число точек, которые следует расставить в контуре */
-    res = lroundf(angle / (float)(pi * 2) * quality);
-    if (res == 0) return 0;
-    if (dst == 0) return res;
+ttf_index_t *ttf_index_list(ttf_t **list)
+{
+    int nfonts, nwords, maxkeys, hsize, i;
 
-    /* Расставляем точки равноудалённо */
-    step = 1.0f / (res + 1);
-    for (i = 0; i < res; i++)
+    /* counting of fonts and the maximal number of family keys */
+    nfonts = 0;
+    maxkeys = 0;
+    for (; list[nfonts] != NULL; nfonts++)
+        for (const char *s = list[nfonts]->names.family; ; s++)
+        {
+            if (*s == ' ' || *s == 0) maxkeys++;
+            if (*s == 0) break;
+        }
+    nwords = (nfonts + 31) / 32;
+    hsize = 16;
+    while (hsize < maxkeys * 2) hsize *= 2;
+
+    /* allocate all the index data by single block */
+    int nbitsets =
+        1 +           /* all */
+        5 +           /* flags */
+        163 +         /* ranges */
+        nfonts +      /* wfonts, no more than nfonts */
+        maxkeys * 2;  /* exact and prefix */
+    ttf_index_t *index = (ttf_index_t *)mem_calloc(
+        sizeof(ttf_index_t) +
+        sizeof(ttf_ikey_t) * maxkeys +
+        sizeof(int) * hsize +
+        sizeof(int) * nfonts +
+        sizeof(uint32_t) * nwords * nbitsets, 1);
+    if (index == NULL) return NULL;
+    index->list = list;
+    index->nfonts = nfonts;
+    index->nwords = nwords;
+    index->hsize = hsize;
+    index->keys = (ttf_ikey_t *)(index + 1);
+    index->htab = (int *)(index->keys + maxkeys);
+    index->weights = index->htab + hsize;
+    index->all = (uint32_t *)(index->weights + nfonts);
+    for (i = 0; i < 5; i++)
+        index->flags[i] = index->all + nwords * (1 + i);
+    index->ranges = index->all + nwords * 6;
+    index->wfonts = index->ranges + nwords * 163;
+    uint32_t *kbits = index->wfonts + nwords * nfonts;
+    for (i = 0; i < hsize; i++)
+        index->htab[i] = -1;
+
+    for (i = 0; i < nfonts; i++)
     {
-        float t = step * (i + 1);
-        dst[i].x = qbezier(curve[0].x, curve[1].x, curve[2].x, t);
-        dst[i].y = qbezier(curve[0].y, curve[1].y, curve[2].y, t);
+        const ttf_t *font = list[i];
+        int j;
+
+        BIT_SET(index->all, i);
+        if (font->os2.fsSelection.bold) BIT_SET(index->flags[0], i);
+        if (font->os2.fsSelection.italic) BIT_SET(index->flags[1], i);
+        if (font->os2.fsSelection.outlined) BIT_SET(index->flags[2], i);
+        if (font->os2.fsSelection.oblique) BIT_SET(index->flags[3], i);
+        if (font->os2.fsSelection.regular) BIT_SET(index->flags[4], i);
+
+        for (j = 0; j < 163; j++)
+            if (font->ubranges[j / 32] & ((uint32_t)1 << (j & 31)))
+                BIT_SET(index->ranges + nwords * j, i);
+
+        for (j = 0; j < index->nweights; j++)
+            if (index->weights[j] == font->os2.usWeightClass) break;
+        if (j == index->nweights)
+            index->weights[index->nweights++] = font->os2.usWeightClass;
+        BIT_SET(index->wfonts + nwords * j, i);
+
+        /* family name and all its prefixes before the spaces */
+        const char *family = font->names.family;
+        for (j = 0; ; j++)
+        {
+            if (family[j] != ' ' && family[j] != 0) continue;
+            int nkeys = index->nkeys;
+            ttf_ikey_t *key = index_intern_key(index, family, j);
+            if (index->nkeys != nkeys)
+            {
+                key->exact = kbits;
+                key->prefix = kbits + nwords;
+                kbits += nwords * 2;
+            }
+            if (family[j] == 0)
+            {
+                BIT_SET(key->exact, i);
+                break;
+            }
+            BIT_SET(key->prefix, i);
+        }
     }
 
-    return res;
-}
-
-static __inline float herons_area(float a, float b, float c)
-{
-    float p = (a + b + c) / 2.0f;
-    return sqrtf(p * (p - a) * (p - b) * (p - c));
-}
-
-static __inline float herons_area_v(const float v1[2], const float v2[2], const float v3[2])
-{
-    float e1[2], e2[2], e3[2];
-    VECSUB(e1, v1, v2);
-    VECSUB(e2, v2, v3);
-    VECSUB(e3, v3, v1);
-    return herons_area(VECLEN(e1), VECLEN(e2), VECLEN(e3));
+    return index;
 }
 
-static __inline float herons_area_p(const ttf_point_t *a, const ttf_point_t *b, const ttf_point_t *c)
+static bool bitset_and(uint32_t *res, const uint32_t *a, const uint32_t *b, int nwords)
 {
-    return herons_area_v(&a->x, &b->x, &c->x);
+    uint32_t any = 0;
+    for (int i = 0; i < nwords; i++)
+    {
+        res[i] = a[i] & b[i];
+        any |= res[i];
+    }
+    return any != 0;
 }
 
-/* TODO: simplify! */
-static int linearize_contour(ttf_point_t *src, ttf_point_t *dst, int src_count, uint8_t quality)
+/**
+ * @brief Fills the bitsets of fonts with matching level 3, 2 and 1 (lev[0], lev[1], lev[2])
+ *
+ * Every lev[i] is filled only within the cand bitset. The function stops at
+ * first non-empty level and returns its value, so the less levels are unfilled.
+ * 0 is returned if all the candidates have 0 matching level.
+ */
+static int index_item_levels(const ttf_index_t *index, const ttf_query_t *q, const ttf_qitem_t *it,
+                             const uint32_t *cand, uint32_t *lev[3])
 {
-    int i, state, res;
-    ttf_point_t queue[3];
+    int nwords = index->nwords;
+    int i, j;
 
-    state = 0;
-    res = 0;
-    for (i = 0; i < src_count; i++)
-        switch (state)
+    switch (it->req)
+    {
+    case 'b': return bitset_and(lev[0], cand, index->flags[0], nwords) ? 3 : 0;
+    case 'i': return bitset_and(lev[0], cand, index->flags[1], nwords) ? 3 : 0;
+    case 'h': return bitset_and(lev[0], cand, index->flags[2], nwords) ? 3 : 0;
+    case 'r': return bitset_and(lev[0], cand, index->flags[4], nwords) ? 3 : 0;
+    case 'o':
+        if (bitset_and(lev[0], cand, index->flags[3], nwords)) return 3;
+        return bitset_and(lev[1], cand, index->flags[1], nwords) ? 2 : 0;
+    case 'w':
+        memset(lev[0], 0, sizeof(uint32_t) * nwords * 3);
+        for (i = 0; i < index->nweights; i++)
+        {
+            int m = weight_metric(index->weights[i], it->weight);
+            if (m == 0) continue;
+            for (j = 0; j < nwords; j++)
+                lev[3 - m][j] |= cand[j] & index->wfonts[nwords * i + j];
+        }
+        for (i = 0; i < 3; i++)
+            for (j = 0; j < nwords; j++)
+                if (lev[i][j] != 0)
+                    return 3 - i;
+        return 0;
+    case 'f':
+    {
+        const ttf_ikey_t *key;
+        int len = strlen(it->family);
+        key = index_find_key(index, it->family, len, fold_hash(it->family, len));
+        if (key != NULL)
+        {
+            if (bitset_and(lev[0], cand, key->exact, nwords)) return 3;
+            if (bitset_and(lev[1], cand, key->prefix, nwords)) return 2;
+        }
+        /* "Times New Roman" query: looking for "Times" and "Times New" families */
+        memset(lev[2], 0, sizeof(uint32_t) * nwords);
+        bool any = false;
+        for (i = 0; i < len; i++)
+        {
+            if (it->family[i] != ' ') continue;
+            key = index_find_key(index, it->family, i, fold_hash(it->family, i));
+            if (key == NULL) continue;
+            for (j = 0; j < nwords; j++)
+            {
+                lev[2][j] |= cand[j] & key->exact[j];
+                any |= lev[2][j] != 0;
+            }
+        }
+        return any ? 1 : 0;
+    }
+    case 't':
+    {
+        /* fonts which present all the text ranges */
+        memcpy(lev[0], cand, sizeof(uint32_t) * nwords);
+        bool any = true;
+        for (i = it->first; i < it->first + it->nranges && any; i++)
+            any = bitset_and(lev[0], lev[0], index->ranges + nwords * q->range[i].index, nwords);
+        if (any) return 3;
+
+        /* partially matched fonts */
+        memset(lev[1], 0, sizeof(uint32_t) * nwords * 2);
+        int res = 0;
+        for (i = 0; i < index->nfonts; i++)
+        {
+            if ((cand[i / 32] & ((uint32_t)1 << (i & 31))) == 0) continue;
+            int m = font_matching_metric(index->list[i], q, it);
+            if (m == 0) continue;
+            BIT_SET(lev[3 - m], i);
+            if (m > res) res = m;
+        }
+        return res;
+    }
+    }
+    return 0;
+}
+
+int ttf_index_match_id(const ttf_index_t *index, const ttf_query_t *query)
+{
+    uint32_t stack[4 * TTF_INDEX_STACK_WORDS];
+    uint32_t *cand, *lev[3], *tmp;
+    int nwords = index->nwords;
+    int res = -1;
+    int i;
+
+    if (index->nfonts == 0) return -1;
+
+    tmp = stack;
+    if (nwords > TTF_INDEX_STACK_WORDS)
+    {
+        tmp = (uint32_t *)mem_alloc(sizeof(uint32_t) * nwords * 4);
+        if (tmp == NULL) return -1;
+    }
+    cand = tmp;
+    lev[0] = tmp + nwords;
+    lev[1] = tmp + nwords * 2;
+    lev[2] = tmp + nwords * 3;
+
+    /*
+     * The score of ttf_list_match_id is zero for fonts which fail any of
+     * the exact modifiers, otherwise it is a lexicographic compound of the
+     * modifiers levels. So the candidates are filtered by exact modifiers
+     * first and then narrowed by every modifier to the set of fonts having
+     * its best achievable level.
+     */
+    memcpy(cand, index->all, sizeof(uint32_t) * nwords);
+    for (i = 0; i < query->nitems; i++)
+    {
+        const ttf_qitem_t *it = query->item + i;
+        if (!it->exactly) continue;
+        if (index_item_levels(index, query, it, cand, lev) != 3) goto done;
+        memcpy(cand, lev[0], sizeof(uint32_t) * nwords);
+    }
+    bool positive = false;
+    for (i = 0; i < query->nitems; i++)
+    {
+        const ttf_qitem_t *it = query->item + i;
+        int m = index_item_levels(index, query, it, cand, lev);
+        if (m == 0) continue;
+        memcpy(cand, lev[3 - m], sizeof(uint32_t) * nwords);
+        positive = true;
+    }
+    if (!positive) goto done;
+
+    /* first font of the candidates */
+    for (i = 0; i < nwords; i++)
+        if (cand[i] != 0)
+        {
+            uint32_t w = cand[i];
+            res = i * 32;
+            while ((w & 1) == 0)
+            {
+                w >>= 1;
+                res++;
+            }
+            break;
+        }
+
+done:
+    if (tmp != stack) mem_free(tmp);
+    return res;
+}
+
+ttf_t *ttf_index_match(const ttf_index_t *index, ttf_t *deflt, const ttf_query_t *query)
+{
+    int id = ttf_index_match_id(index, query);
+    return id == -1 ? deflt : index->list[id];
+}
+
+/**
+ * @brief Decoding the utf-8 character
+ * @return Number of bytes used, the invalid sequences are decoded as U+FFFD of 1 byte
+ */
+static int utf8_decode(const uint8_t *s, int len, uint32_t *utf32)
+{
+    uint32_t c = s[0];
+    int n, i;
+    *utf32 = 0xFFFD;
+    if (c < 0x80) { *utf32 = c; return 1; }
+    if (c < 0xC2) return 1;
+    if (c < 0xE0) { n = 2; c &= 0x1F; } else
+    if (c < 0xF0) { n = 3; c &= 0x0F; } else
+    if (c < 0xF5) { n = 4; c &= 0x07; } else
+        return 1;
+    if (n > len) return 1;
+    for (i = 1; i < n; i++)
+    {
+        if ((s[i] & 0xC0) != 0x80) return 1;
+        c = (c << 6) | (s[i] & 0x3F);
+    }
+    /* overlong forms, surrogates and out of range values */
+    if ((n == 3 && c < 0x800) || (n == 4 && c < 0x10000) ||
+        (c >= 0xD800 && c <= 0xDFFF) || c > 0x10FFFF)
+        return 1;
+    *utf32 = c;
+    return n;
+}
+
+/**
+ * @brief Checking that the character does not force the font selection
+ *
+ * Spaces, punctuation, combining marks, joiners and variation selectors
+ * are kept with the font of the previous character if it covers them.
+ */
+static bool is_neutral_char(uint32_t c)
+{
+    if (c < 0x80)
+        return !((c >= '0' && c <= '9') || (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z'));
+    return
+        (c >= 0x00A0 && c <= 0x00BF) || /* Latin-1 punctuation */
+        (c >= 0x0300 && c <= 0x036F) || /* Combining Diacritical Marks */
+        (c >= 0x1AB0 && c <= 0x1AFF) || /* Combining Diacritical Marks Extended */
+        (c >= 0x1DC0 && c <= 0x1DFF) || /* Combining Diacritical Marks Supplement */
+        (c >= 0x2000 && c <= 0x206F) || /* General Punctuation, ZWJ, ZWNJ */
+        (c >= 0x20D0 && c <= 0x20FF) || /* Combining Diacritical Marks for Symbols */
+        (c >= 0x3000 && c <= 0x3003) || /* CJK space and punctuation */
+        (c >= 0xFE00 && c <= 0xFE0F) || /* Variation Selectors */
+        (c >= 0xFE20 && c <= 0xFE2F) || /* Combining Half Marks */
+        (c >= 0xE0100 && c <= 0xE01EF); /* Variation Selectors Supplement */
+}
+
+int ttf_resolve_fallback(ttf_t **list, const char *utf8, int len, ttf_run_t *runs, int max_runs)
+{
+    const uint8_t *s = (const uint8_t *)utf8;
+    int nruns = 0;
+    int font = -1;
+    int pos, n;
+
+    if (len < 0) len = strlen(utf8);
+
+    for (pos = 0; pos < len; pos += n)
+    {
+        uint32_t c;
+        n = utf8_decode(s + pos, len - pos, &c);
+
+        /* the first font in the chain order, which covers the character */
+        int f = -1;
+        if (nruns != 0 && font != -1 && is_neutral_char(c) && ttf_has_char(list[font], c))
+            f = font;
+        else
+            for (int i = 0; list[i] != NULL; i++)
+                if (ttf_has_char(list[i], c))
+                {
+                    f = i;
+                    break;
+                }
+
+        if (nruns != 0 && f == font)
+        {
+            if (nruns <= max_runs)
+                runs[nruns - 1].length += n;
+            continue;
+        }
+
+        if (nruns < max_runs)
+        {
+            runs[nruns].offset = pos;
+            runs[nruns].length = n;
+            runs[nruns].font = f;
+        }
+        nruns++;
+        font = f;
+    }
+
+    return nruns;
+}
+
+int ttf_measure_text(const ttf_t *ttf, const char *utf8, int len, float *width, int *missing)
+{
+    const uint8_t *s = (const uint8_t *)utf8;
+    float line = 0.0f;
+    float max = 0.0f;
+    int nmissing = 0;
+    int prev = -1;
+    int pos, n;
+
+    if (ttf->glyphs == NULL || ttf->nglyphs == 0)
+        return TTF_ERR_NO_METRICS;
+    if (len < 0) len = strlen(utf8);
+
+    for (pos = 0; pos < len; pos += n)
+    {
+        uint32_t c;
+        n = utf8_decode(s + pos, len - pos, &c);
+        if (c == '\n')
+        {
+            if (line > max) max = line;
+            line = 0.0f;
+            prev = -1;
+            continue;
+        }
+        /* missing characters are drawn by the glyph #0 */
+        int g = ttf_find_glyph(ttf, c);
+        if (g <= 0)
+        {
+            nmissing++;
+            g = 0;
+        }
+        if (prev >= 0)
+            line += ttf_kerning(ttf, prev, g);
+        line += ttf->glyphs[g].advance;
+        prev = g;
+    }
+    if (line > max) max = line;
+
+    if (width != NULL) *width = max;
+    if (missing != NULL) *missing = nmissing;
+    return TTF_DONE;
+}
+
+/**
+ * @brief Расчёт координаты кривой Безье
+ * @param p0
+ * @param p1
+ * @param p2
+ * @param t
+ * @return
+ */
+static __inline float qbezier(float p0, float p1, float p2, float t)
+{
+    float tt = 1.0f - t;
+    return tt * tt * p0 + 2.0f * t * tt * p1 + t * t * p2;
+}
+
+/**
+ * @brief Первая производная функции Безье
+ * @param p0 Опорная точка 0
+ * @param p1 Опорная точка 1
+ * @param p2 Опорная точка 2
+ * @param t Параметр кривой
+ * @return Значение производной
+ */
+static __inline float qbezier_diff1(float p0, float p1, float p2, float t)
+{
+    return 2.0f * (t * (p0 - 2.0f * p1 + p2) - p0 + p1);
+}
+
+static int linearize_qbezier(ttf_point_t curve[3], ttf_point_t *dst, uint8_t quality)
+{
+    int i, res;
+    float v1[2], v2[2], angle, step;
+
+    /* Найдём косательные к кривой в точке t=0 и t=1 */
+    v1[0] = qbezier_diff1(curve[0].x, curve[1].x, curve[2].x, 0.0f);
+    v1[1] = qbezier_diff1(curve[0].y, curve[1].y, curve[2].y, 0.0f);
+    v2[0] = qbezier_diff1(curve[0].x, curve[1].x, curve[2].x, 1.0f);
+    v2[1] = qbezier_diff1(curve[0].y, curve[1].y, curve[2].y, 1.0f);
+
+    /* Найдём угол между косательными векторами */
+    angle = fabsf(VECCROSS(v1, v2));
+    if (angle < EPSILON) return 0;
+    angle /= VECLEN(v1);
+    angle /= VECLEN(v2);
+    if (angle >= 1.0f) angle = 1.0f;
+    angle = asinf(angle);
+
+    /* Найдём число точек, которые следует расставить в контуре */
+    res = lroundf(angle / (float)(pi * 2) * quality);
+    if (res == 0) return 0;
+    if (dst == 0) return res;
+
+    /* Расставляем точки равноудалённо */
+    step = 1.0f / (res + 1);
+    for (i = 0; i < res; i++)
+    {
+        float t = step * (i + 1);
+        dst[i].x = qbezier(curve[0].x, curve[1].x, curve[2].x, t);
+        dst[i].y = qbezier(curve[0].y, curve[1].y, curve[2].y, t);
+    }
+
+    return res;
+}
+
+static __inline float herons_area(float a, float b, float c)
+{
+    float p = (a + b + c) / 2.0f;
+    return sqrtf(p * (p - a) * (p - b) * (p - c));
+}
+
+static __inline float herons_area_v(const float v1[2], const float v2[2], const float v3[2])
+{
+    float e1[2], e2[2], e3[2];
+    VECSUB(e1, v1, v2);
+    VECSUB(e2, v2, v3);
+    VECSUB(e3, v3, v1);
+    return herons_area(VECLEN(e1), VECLEN(e2), VECLEN(e3));
+}
+
+static __inline float herons_area_p(const ttf_point_t *a, const ttf_point_t *b, const ttf_point_t *c)
+{
+    return herons_area_v(&a->x, &b->x, &c->x);
+}
+
+/* TODO: simplify! */
+static int linearize_contour(const ttf_point_t *src, ttf_point_t *dst, int src_count, uint8_t quality)
+{
+    int i, state, res;
+    ttf_point_t queue[3];
+
+    state = 0;
+    res = 0;
+    for (i = 0; i < src_count; i++)
+        switch (state)
         {
         case 0:
             queue[0] = src[0];
@@ -2404,20 +4729,161 @@ static void fill_shading_flags(ttf_point_t *pt, int count)
     }
 }
 
+/* the composite glyph is not flattened in TTF_LOAD_COMPONENTS mode */
+#define GLYPH_HAS_OUTLINE(g) \
+    ((g)->outline != NULL || (g)->qoutline != NULL || ((g)->ncomponents != 0 && (g)->npoints != 0))
+
+/**
+ * @brief Placing of the transformed component outlines to the flattened outline
+ * @param m Transformation of the glyph: matrix m[0..3] and offset m[4..5] in em
+ * @param id Subglyph index of the top level component
+ * @param order Reading order of the top level component
+ * @param n Index of the next contour of output outline
+ * @return Index of the next contour of output outline
+ */
+static int flatten_components(const ttf_glyph_t *glyph, const float m[6],
+                              int depth, int id, int order, ttf_outline_t *out, int n)
+{
+    int i, j, k, p;
+    for (i = 0; i < glyph->ncomponents; i++)
+    {
+        const ttf_component_t *c = glyph->components + i;
+        const ttf_glyph_t *g = c->glyph;
+        float cm[6];
+
+        /* composition of the component transformation with the glyph one */
+        cm[0] = m[0] * c->matrix[0][0] + m[1] * c->matrix[1][0];
+        cm[1] = m[0] * c->matrix[0][1] + m[1] * c->matrix[1][1];
+        cm[2] = m[2] * c->matrix[0][0] + m[3] * c->matrix[1][0];
+        cm[3] = m[2] * c->matrix[0][1] + m[3] * c->matrix[1][1];
+        cm[4] = m[0] * c->offset[0] + m[1] * c->offset[1] + m[4];
+        cm[5] = m[2] * c->offset[0] + m[3] * c->offset[1] + m[5];
+        if (depth == 0)
+        {
+            id = c->index;
+            order = i;
+        }
+
+        if (g->ncomponents != 0)
+        {
+            if (depth < COMPONENTS_DEPTH)
+                n = flatten_components(g, cm, depth + 1, id, order, out, n);
+            continue;
+        }
+        if (g->outline == NULL && g->qoutline == NULL) continue;
+
+        for (j = 0, p = 0; j < g->ncontours; j++)
+        {
+            ttf_point_t *pt = out->cont[n].pt;
+            out->cont[n].subglyph_id = id;
+            out->cont[n].subglyph_order = order;
+            if (g->outline != NULL)
+            {
+                const ttf_point_t *src = g->outline->cont[j].pt;
+                out->cont[n].length = g->outline->cont[j].length;
+                for (k = 0; k < out->cont[n].length; k++)
+                {
+                    pt[k].x = cm[0] * src[k].x + cm[1] * src[k].y + cm[4];
+                    pt[k].y = cm[2] * src[k].x + cm[3] * src[k].y + cm[5];
+                    pt[k].onc = src[k].onc;
+                }
+            }
+            else
+            {
+                const ttf_qoutline_t *q = g->qoutline;
+                out->cont[n].length = q->cont[j].length;
+                for (k = 0; k < out->cont[n].length; k++, p++)
+                {
+                    float x = q->pt[p][0] * q->scale;
+                    float y = q->pt[p][1] * q->scale;
+                    pt[k].x = cm[0] * x + cm[1] * y + cm[4];
+                    pt[k].y = cm[2] * x + cm[3] * y + cm[5];
+                    pt[k].onc = (q->onc[p >> 3] >> (p & 7)) & 1;
+                }
+            }
+            if (n + 1 < out->ncontours)
+                out->cont[n + 1].pt = pt + out->cont[n].length;
+            n++;
+        }
+    }
+    return n;
+}
+
+/**
+ * @brief Original outline of glyph in em units
+ * @param temp Output decoded quantized or flattened outline to free by the caller or NULL
+ * @return Outline or NULL if glyph has no outline or no memory in system
+ */
+static const ttf_outline_t *glyph_outline(const ttf_glyph_t *glyph, ttf_outline_t **temp)
+{
+    static const float identity[6] = {1.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f};
+    const ttf_qoutline_t *q = glyph->qoutline;
+    *temp = NULL;
+    if (glyph->outline != NULL) return glyph->outline;
+    if (q == NULL)
+    {
+        if (!GLYPH_HAS_OUTLINE(glyph)) return NULL;
+        *temp = allocate_ttf_outline(glyph->ncontours, glyph->npoints);
+        if (*temp == NULL) return NULL;
+        flatten_components(glyph, identity, 0, 0, 0, *temp, 0);
+        return *temp;
+    }
+    *temp = allocate_ttf_outline(q->ncontours, q->total_points);
+    if (*temp == NULL) return NULL;
+    dequantize_outline(q, q->scale, *temp);
+    return *temp;
+}
+
+ttf_outline_t *ttf_glyph_outline(const ttf_glyph_t *glyph)
+{
+    const ttf_outline_t *o;
+    ttf_outline_t *temp, *res;
+    int i;
+
+    o = glyph_outline(glyph, &temp);
+    if (o == NULL || temp != NULL) return temp;
+    res = allocate_ttf_outline(o->ncontours, o->total_points);
+    if (res == NULL) return NULL;
+    memcpy(res->cont[0].pt, o->cont[0].pt, o->total_points * sizeof(ttf_point_t));
+    for (i = 0; i < o->ncontours; i++)
+    {
+        res->cont[i].length = o->cont[i].length;
+        res->cont[i].subglyph_id = o->cont[i].subglyph_id;
+        res->cont[i].subglyph_order = o->cont[i].subglyph_order;
+        if (i != o->ncontours - 1)
+            res->cont[i + 1].pt = res->cont[i].pt + o->cont[i].length;
+    }
+    return res;
+}
+
 ttf_outline_t *ttf_linear_outline(const ttf_glyph_t *glyph, uint8_t quality)
 {
     int i, npoints;
-    ttf_outline_t *o, *s;
+    const ttf_outline_t *o;
+    ttf_outline_t *s, *temp;
 
-    o = glyph->outline;
-    if (o == NULL) return NULL;
+    if (!GLYPH_HAS_OUTLINE(glyph)) return NULL;
+    TRACE_BEGIN("ttf_linear_outline", glyph->index, NULL);
+
+    /* the quantized outline is scaled to em by decoding */
+    o = glyph_outline(glyph, &temp);
+    if (o == NULL)
+    {
+        TRACE_END("ttf_linear_outline");
+        return NULL;
+    }
 
     npoints = 0;
     for (i = 0; i < o->ncontours; i++)
         npoints += linearize_contour(o->cont[i].pt, NULL, o->cont[i].length, quality);
 
     s = allocate_ttf_outline(o->ncontours, npoints);
-    if (s == NULL) return NULL;
+    if (s == NULL)
+    {
+        ttf_free_outline(temp);
+        TRACE_END("ttf_linear_outline");
+        return NULL;
+    }
 
     s->total_points = 0;
     for (i = 0; i < o->ncontours; i++)
@@ -2433,10 +4899,12 @@ ttf_outline_t *ttf_linear_outline(const ttf_glyph_t *glyph, uint8_t quality)
         s->total_points += npoints;
     }
 
+    ttf_free_outline(temp);
+    TRACE_END("ttf_linear_outline");
     return s;
 }
 
-static int split_qbezier_contour(ttf_point_t *src, ttf_point_t *dst, int len)
+static int split_qbezier_contour(const ttf_point_t *src, ttf_point_t *dst, int len)
 {
     int i, j, n;
     n = 0;
@@ -2474,9 +4942,10 @@ static int split_qbezier_contour(ttf_point_t *src, ttf_point_t *dst, int len)
 ttf_outline_t *ttf_splitted_outline(const ttf_glyph_t *glyph)
 {
     int i, npoints;
-    ttf_outline_t *o, *s;
+    const ttf_outline_t *o;
+    ttf_outline_t *s, *temp;
 
-    o = glyph->outline;
+    o = glyph_outline(glyph, &temp);
     if (o == NULL) return NULL;
 
     npoints = 0;
@@ -2484,7 +4953,11 @@ ttf_outline_t *ttf_splitted_outline(const ttf_glyph_t *glyph)
         npoints += o->cont[i].length;
 
     s = allocate_ttf_outline(o->ncontours, npoints * 2);
-    if (s == NULL) return NULL;
+    if (s == NULL)
+    {
+        ttf_free_outline(temp);
+        return NULL;
+    }
 
     s->total_points = 0;
     for (i = 0; i < s->ncontours; i++)
@@ -2498,6 +4971,7 @@ ttf_outline_t *ttf_splitted_outline(const ttf_glyph_t *glyph)
             s->cont[i + 1].pt = s->cont[i].pt + npoints;
     }
 
+    ttf_free_outline(temp);
     return s;
 }
 
@@ -2642,20 +5116,215 @@ bool ttf_outline_contour_info(const ttf_outline_t *outline, int subglyph_order,
     return (count & 1) == 0;
 }
 
-char *ttf_glyph2svgpath(ttf_glyph_t *glyph, float xscale, float yscale)
+/* Prepared outline: the edges are distributed to horizontal bands, */
+/* the edges of band are stored as arrays of structure fields for */
+/* the vectorized crossing test. */
+
+#define PREPARED_EDGES_PER_BAND 1
+#define PREPARED_MAX_BANDS 1024
+
+struct ttf_prepared_outline
 {
-    int len;
-    char *res;
-    ttf_outline_t *o = ttf_splitted_outline(glyph);
-    if (o == NULL) return NULL;
-    len = ttf_glyph2svgpath_impl(o, NULL, 0, xscale, yscale);
-    if (len <= 0)
-    {
-        ttf_free_outline(o);
-        return NULL;
-    }
-    res = (char *)malloc(len + 1);
-    ttf_glyph2svgpath_impl(o, res, len + 1, xscale, yscale);
+    float ymin;                   /* bottom of the first band */
+    float kband;                  /* number of bands per EM */
+    int nbands;                   /* number of bands */
+    int *first;                   /* first edge of band, nbands + 1 items */
+    float *bx;                    /* bottom point of edge */
+    float *by;
+    float *uy;                    /* top point y of edge */
+    float *dy;                    /* uy - by */
+    float *ddx;                   /* ux - bx */
+};
+
+typedef struct prepared_edge
+{
+    float bx, by, uy, dy, ddx;
+} prepared_edge_t;
+
+static __inline int prepared_band(const ttf_prepared_outline_t *p, float y)
+{
+    int band = (int)((y - p->ymin) * p->kband);
+    if (band < 0) return 0;
+    return band < p->nbands ? band : p->nbands - 1;
+}
+
+ttf_prepared_outline_t *ttf_outline_prepare(const ttf_outline_t *outline, int subglyph_order)
+{
+    ttf_prepared_outline_t hdr, *res;
+    prepared_edge_t *edges;
+    int nedges, ntotal, i, j, b;
+    float ymin = 0, ymax = 0;
+
+    /* Edges of contours, horizontal edges are skipped as by ttf_outline_evenodd_base */
+    edges = (prepared_edge_t *)mem_alloc((outline->total_points + 1) * sizeof(prepared_edge_t));
+    if (edges == NULL) return NULL;
+    nedges = 0;
+    for (i = 0; i < outline->ncontours; i++)
+    {
+        const ttf_point_t *pt = outline->cont[i].pt;
+        int len = outline->cont[i].length;
+        if (subglyph_order >= 0 && outline->cont[i].subglyph_order != subglyph_order) continue;
+        for (j = 0; j < len; j++)
+        {
+            const ttf_point_t *u = &pt[j];
+            const ttf_point_t *d = &pt[j == 0 ? len - 1 : j - 1];
+            prepared_edge_t *e = &edges[nedges];
+            if (u->y <= d->y) SWAP(const ttf_point_t *, u, d);
+            if (fabsf(u->y - d->y) <= EPSILON) continue;
+            e->bx = d->x;
+            e->by = d->y;
+            e->uy = u->y;
+            e->dy = u->y - d->y;
+            e->ddx = u->x - d->x;
+            if (nedges == 0 || e->by < ymin) ymin = e->by;
+            if (nedges == 0 || e->uy > ymax) ymax = e->uy;
+            nedges++;
+        }
+    }
+
+    /* Bands and number of the edge references in them */
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.ymin = ymin;
+    hdr.nbands = nedges / PREPARED_EDGES_PER_BAND;
+    if (hdr.nbands < 1) hdr.nbands = 1;
+    if (hdr.nbands > PREPARED_MAX_BANDS) hdr.nbands = PREPARED_MAX_BANDS;
+    hdr.kband = ymax > ymin ? hdr.nbands / (ymax - ymin) : 0.0f;
+    ntotal = 0;
+    for (i = 0; i < nedges; i++)
+        ntotal += prepared_band(&hdr, edges[i].uy) - prepared_band(&hdr, edges[i].by) + 1;
+
+    /* Create the object, the arrays are placed after it */
+    res = (ttf_prepared_outline_t *)mem_alloc(
+        sizeof(ttf_prepared_outline_t) +
+        (hdr.nbands + 1) * sizeof(int) +
+        ntotal * sizeof(float) * 5);
+    if (res == NULL)
+    {
+        mem_free(edges);
+        return NULL;
+    }
+    *res = hdr;
+    res->first = (int *)(res + 1);
+    res->bx = (float *)(res->first + hdr.nbands + 1);
+    res->by = res->bx + ntotal;
+    res->uy = res->by + ntotal;
+    res->dy = res->uy + ntotal;
+    res->ddx = res->dy + ntotal;
+
+    /* Distribute the edges to bands and split to fields */
+    memset(res->first, 0, (hdr.nbands + 1) * sizeof(int));
+    for (i = 0; i < nedges; i++)
+        for (b = prepared_band(res, edges[i].by); b <= prepared_band(res, edges[i].uy); b++)
+            res->first[b + 1]++;
+    for (b = 0; b < hdr.nbands; b++)
+        res->first[b + 1] += res->first[b];
+    for (i = 0; i < nedges; i++)
+        for (b = prepared_band(res, edges[i].by); b <= prepared_band(res, edges[i].uy); b++)
+        {
+            j = res->first[b]++;
+            res->bx[j] = edges[i].bx;
+            res->by[j] = edges[i].by;
+            res->uy[j] = edges[i].uy;
+            res->dy[j] = edges[i].dy;
+            res->ddx[j] = edges[i].ddx;
+        }
+    for (b = hdr.nbands; b > 0; b--)
+        res->first[b] = res->first[b - 1];
+    res->first[0] = 0;
+
+    mem_free(edges);
+    return res;
+}
+
+/**
+ * @brief Crossings of the ray to the left of point with the band edges [first, last)
+ * @return The number of crossings, closest is the distance to the closest one
+ */
+static int prepared_crossings(const ttf_prepared_outline_t *p, int first, int last,
+                              const float *point, float *closest)
+{
+    float px = point[0], py = point[1];
+    float best = -1.0f;
+    int count = 0;
+    int i = first;
+#if defined(TTF_SSE2)
+    const __m128 vpx = _mm_set1_ps(px);
+    const __m128 vpy = _mm_set1_ps(py);
+    const __m128 zero = _mm_setzero_ps();
+    __m128i vcount = _mm_setzero_si128();
+    __m128 vbest = _mm_set1_ps(3.0e38f);
+    for (; i + 4 <= last; i += 4)
+    {
+        __m128 by = _mm_loadu_ps(p->by + i);
+        __m128 uy = _mm_loadu_ps(p->uy + i);
+        __m128 bx = _mm_loadu_ps(p->bx + i);
+        __m128 dx;
+        __m128 hit = _mm_and_ps(_mm_cmple_ps(vpy, uy), _mm_cmpgt_ps(vpy, by));
+        /* the same expression as in ttf_outline_evenodd_base */
+        dx = _mm_div_ps(_mm_sub_ps(vpy, by), _mm_loadu_ps(p->dy + i));
+        dx = _mm_sub_ps(_mm_sub_ps(vpx, _mm_mul_ps(dx, _mm_loadu_ps(p->ddx + i))), bx);
+        hit = _mm_and_ps(hit, _mm_cmpge_ps(dx, zero));
+        vcount = _mm_sub_epi32(vcount, _mm_castps_si128(hit));
+        vbest = _mm_min_ps(vbest, _mm_or_ps(_mm_and_ps(hit, dx), _mm_andnot_ps(hit, vbest)));
+    }
+    {
+        int c[4];
+        float m[4];
+        _mm_storeu_si128((__m128i *)c, vcount);
+        _mm_storeu_ps(m, vbest);
+        count = c[0] + c[1] + c[2] + c[3];
+        for (int k = 0; k < 4; k++)
+            if (m[k] < 3.0e38f && (best < 0.0f || m[k] < best))
+                best = m[k];
+    }
+#endif
+    for (; i < last; i++)
+    {
+        float dx;
+        if (!(py <= p->uy[i] && py > p->by[i])) continue;
+        dx = px - (py - p->by[i]) / p->dy[i] * p->ddx[i] - p->bx[i];
+        if (dx < 0.0f) continue;
+        if (best < 0.0f || dx < best) best = dx;
+        count++;
+    }
+    *closest = best;
+    return count;
+}
+
+int ttf_outline_contains_batch(const ttf_prepared_outline_t *prepared, const float *points, int n,
+                               bool *inside, float *dist)
+{
+    for (int i = 0; i < n; i++)
+    {
+        const float *pt = points + i * 2;
+        int band = prepared_band(prepared, pt[1]);
+        int first = prepared->first[band];
+        int last = prepared->first[band + 1];
+        float closest = -1.0f;
+        int count = 0;
+        if (last > first)
+            count = prepared_crossings(prepared, first, last, pt, &closest);
+        inside[i] = (count & 1) == 1;
+        if (dist != NULL)
+            dist[i] = closest;
+    }
+    return TTF_DONE;
+}
+
+char *ttf_glyph2svgpath(ttf_glyph_t *glyph, float xscale, float yscale)
+{
+    int len;
+    char *res;
+    ttf_outline_t *o = ttf_splitted_outline(glyph);
+    if (o == NULL) return NULL;
+    len = ttf_glyph2svgpath_impl(o, NULL, 0, xscale, yscale);
+    if (len <= 0)
+    {
+        ttf_free_outline(o);
+        return NULL;
+    }
+    res = (char *)mem_alloc(len + 1);
+    ttf_glyph2svgpath_impl(o, res, len + 1, xscale, yscale);
     res[len] = 0;
     ttf_free_outline(o);
     return res;
@@ -2679,6 +5348,7 @@ char *ttf_glyph2svgpath(ttf_glyph_t *glyph, float xscale, float yscale)
 #define MESHER_WARN 1 /* Не все рёбра на контуре легли в треугольники */
 #define MESHER_FAIL 2 /* Критическая ошибка (данных или алгоритма) */
 #define MESHER_TRAP 3 /* Мешер завершил работу по требованию отладки */
+#define MESHER_ABORT 4 /* Mesher budget is exhausted or meshing is cancelled */
 
 #define EDGE_HAS_VERT(e, v)        ((e)->v1 == (v) || (e)->v2 == (v))
 #define EDGE_SECOND_VERT(e, v)     ((e)->v1 == v ? (e)->v2 : (e)->v1)
@@ -2778,8 +5448,40 @@ typedef struct
         int stop_at_step; /* Шаг, на котором следует прервать работу алгоритма */
         bool breakpoint; /* Если заполнено true, то будет сформирован SIGINT */
     } debug;
+    struct /* Budget of the glyph, see ttf_set_thread_mesher_budget */
+    {
+        const ttf_mesher_budget_t *limits; /* limits or NULL */
+        double deadline; /* ttf_clock() time to abort or 0 */
+        int flips; /* edge flips performed */
+        bool exhausted; /* budget is exhausted, the mesher is aborting */
+    } budget;
+#ifdef TTF_MESHER_STATS
+    ttf_mesher_stats_t stats; /* Statistics of the mesher stages */
+#endif
 } mesher_t;
 
+/* Mesher statistics, they are compiled only with TTF_MESHER_STATS defined */
+#ifdef TTF_MESHER_STATS
+#   define MESHER_STAT(m, expr) ((m)->stats.expr)
+#   define MESHER_TIME(m, field, call) \
+    { \
+        double t0 = ttf_clock(); \
+        call; \
+        (m)->stats.field += ttf_clock() - t0; \
+    }
+#else
+#   define MESHER_STAT(m, expr) ((void)(m))
+#   define MESHER_TIME(m, field, call) call;
+#endif
+
+/* Mesher stage with the statistics and the trace events */
+#define MESHER_STAGE(m, field, name, call) \
+    { \
+        TRACE_BEGIN(name, -1, NULL); \
+        MESHER_TIME(m, field, call) \
+        TRACE_END(name); \
+    }
+
 /* Определяет максимальное число треугольников в */
 /* триангуляции по числу точек в ней (maxv) */
 #define MAXV_TO_MAXT(maxv)  ((maxv - 3) * 2 + 1)
@@ -2840,6 +5542,7 @@ mesher_t *create_mesher(const ttf_outline_t *o)
     mesher_t *m;
 
     /* Выделяем память и инициализируем поля */
+    TRACE_BEGIN("create_mesher", -1, NULL);
 
     maxv = o->total_points;
     maxt = MAXV_TO_MAXT(maxv + 2); /* Две вершины - инициализационные */
@@ -2852,8 +5555,12 @@ mesher_t *create_mesher(const ttf_outline_t *o)
         sizeof(v2e_t) * maxv2e + /* l */
         sizeof(mts_t) * maxt +   /* t */
         sizeof(mvs_t *) * maxv;  /* s */
-    m = (mesher_t *)calloc(size, 1);
-    if (m == NULL) return NULL;
+    m = (mesher_t *)mem_calloc(size, 1);
+    if (m == NULL)
+    {
+        TRACE_END("create_mesher");
+        return NULL;
+    }
     m->v = (mvs_t *)(m + 1);
     m->e = (mes_t *)(m->v + maxv);
     m->t = (mts_t *)(m->e + maxe);
@@ -2948,7 +5655,9 @@ mesher_t *create_mesher(const ttf_outline_t *o)
     m->debug.curr_step = 0;
     m->debug.message[0] = 0;
     m->debug.breakpoint = false;
+    m->budget.limits = NULL;
 
+    TRACE_END("create_mesher");
     return m;
 }
 
@@ -2970,6 +5679,7 @@ static mes_t *create_edge(mesher_t *m, mvs_t *v1, mvs_t *v2)
     mes_t *res = LIST_FIRST(&m->efree);
     LIST_DETACH(res);
     LIST_ATTACH(&m->eused, res);
+    MESHER_STAT(m, edges++);
     res->v1 = v1;
     res->v2 = v2;
     res->alt_cc[0] = null_cc;
@@ -2988,6 +5698,7 @@ static mts_t *create_triangle(mesher_t *m, mes_t *e1, mes_t *e2, mes_t *e3)
     mts_t *t = LIST_FIRST(&m->tfree);
     LIST_DETACH(t);
     LIST_ATTACH(&m->tused, t);
+    MESHER_STAT(m, triangles++);
     t->helper = -1;
     t->cc = null_cc;
     e1->tr[1] = e1->tr[0]; e1->tr[0] = t;
@@ -3050,7 +5761,34 @@ static void free_triangle(mesher_t *m, mts_t *t, bool and_bare_edges)
 
 void free_mesher(mesher_t *m)
 {
-    free(m);
+    mem_free(m);
+}
+
+/* Budget of the glyph meshing in the calling thread */
+static TTF_THREAD_LOCAL const ttf_mesher_budget_t *thread_budget = NULL;
+
+/**
+ * @brief Checking the mesher budget at the debug points
+ * @return true if the mesher must be aborted with MESHER_ABORT result
+ *
+ * The limits and the cancellation flag are checked at every point,
+ * the clock is polled at every 16th step.
+ */
+static bool mesher_over_budget(mesher_t *m)
+{
+    const ttf_mesher_budget_t *b = m->budget.limits;
+    if (m->budget.exhausted) return true;
+    if (b->max_steps > 0 && m->debug.curr_step > b->max_steps)
+        m->budget.exhausted = true;
+    if (b->max_flips > 0 && m->budget.flips > b->max_flips)
+        m->budget.exhausted = true;
+    if (b->cancel != NULL && *b->cancel != 0)
+        m->budget.exhausted = true;
+    if (m->budget.deadline > 0 && (m->debug.curr_step & 15) == 0 && ttf_clock() > m->budget.deadline)
+        m->budget.exhausted = true;
+    if (m->budget.exhausted)
+        sprintf(m->debug.message, "budget exhausted at step %i", m->debug.curr_step);
+    return m->budget.exhausted;
 }
 
 #define DEBUG_POINT(msg) \
@@ -3063,6 +5801,8 @@ void free_mesher(mesher_t *m)
             return MESHER_TRAP; \
     } \
     m->debug.curr_step++; \
+    if (m->budget.limits != NULL && mesher_over_budget(m)) \
+        return MESHER_ABORT; \
 }
 
 #define DEBUG_POINTF2(fmt, arg1, arg2) \
@@ -3075,6 +5815,8 @@ void free_mesher(mesher_t *m)
             return MESHER_TRAP; \
     } \
     m->debug.curr_step++; \
+    if (m->budget.limits != NULL && mesher_over_budget(m)) \
+        return MESHER_ABORT; \
 }
 
 #define DEBUG_POINTF(fmt, arg) DEBUG_POINTF2(fmt "%c", arg, 0)
@@ -3107,11 +5849,14 @@ int debug_check_for_corrupt_lists(mesher_t *m)
     return MESHER_DONE;
 }
 
-static __inline mes_t *find_edge(mvs_t *v1, mvs_t *v2)
+static __inline mes_t *find_edge(mesher_t *m, mvs_t *v1, mvs_t *v2)
 {
     for (v2e_t *v2l = v1->edges.next; v2l != &v1->edges; v2l = v2l->next)
+    {
+        MESHER_STAT(m, find_edge_probes++);
         if (EDGE_HAS_VERT(v2l->edge, v1) && EDGE_HAS_VERT(v2l->edge, v2))
             return v2l->edge;
+    }
     return NULL;
 }
 
@@ -3279,6 +6024,7 @@ int flip_edge(mesher_t *m, mes_t *e)
     mvs_t *B = EDGES_COMMON_VERT(c, d);
 
     DEBUG_POINTF("flip edge %i", e->index);
+    m->budget.flips++;
 
     mts_t t0copy = *t0;
     mts_t t1copy = *t1;
@@ -3365,6 +6111,7 @@ int optimize(mesher_t *m, mes_t *e, int deep)
 
     int res = flip_edge(m, e);
     if (res != MESHER_DONE) return res;
+    MESHER_STAT(m, flips++);
 
     deep--;
     if (deep == 0) return MESHER_DONE;
@@ -3516,6 +6263,7 @@ static int sweep_points(mesher_t *m, int object)
         mvs_t *v = m->s[i];
 
         if (v->object != object) continue;
+        MESHER_STAT(m, vertices++);
 
         DEBUG_POINTF("sweeping point %i", v->index);
 
@@ -3526,6 +6274,7 @@ static int sweep_points(mesher_t *m, int object)
             while (1)
             {
                 curr = curr->prev;
+                MESHER_STAT(m, hull_steps++);
                 float dx1 = curr->v1->x - v->x;
                 float dx2 = curr->v2->x - v->x;
                 if (dx1 * dx2 <= 0 && (dx1 != 0 || dx2 != 0)) break;
@@ -3538,6 +6287,7 @@ static int sweep_points(mesher_t *m, int object)
             while (1)
             {
                 curr = curr->next;
+                MESHER_STAT(m, hull_steps++);
                 float dx1 = curr->v1->x - v->x;
                 float dx2 = curr->v2->x - v->x;
                 if (dx1 * dx2 <= 0 && (dx1 != 0 || dx2 != 0)) break;
@@ -3772,10 +6522,10 @@ int triangulate_hole(mesher_t *m, mes_t *cntr, mes_t *base)
         FAILED("triangulate_holl #2");
 
     /* Формируем треугольник на базовом ребре и найденной точке */
-    mes_t *L = find_edge(base->v1, closest_vert);
+    mes_t *L = find_edge(m, base->v1, closest_vert);
     if (L == NULL)
         L = create_edge(m, base->v1, closest_vert);
-    mes_t *R = find_edge(closest_vert, base->v2);
+    mes_t *R = find_edge(m, closest_vert, base->v2);
     if (R == NULL)
         R = create_edge(m, closest_vert, base->v2);
     if (L == NULL || R == NULL) FAILED("triangulate_holl #3");
@@ -3822,6 +6572,7 @@ int triangulate_hole(mesher_t *m, mes_t *cntr, mes_t *base)
 int insert_fixed_edge(mesher_t *m, mvs_t *v1, mvs_t *v2)
 {
     mes_t track;
+    MESHER_STAT(m, constraints++);
     LIST_INIT(&track);
     int res = find_triangles_track(m, v1, v2, &track);
     if (res != MESHER_DONE) return res;
@@ -3829,8 +6580,8 @@ int insert_fixed_edge(mesher_t *m, mvs_t *v1, mvs_t *v2)
     /* Формируем два контура из рёбер, описывающих образовавшуюся после удаления */
     /* треугольников пустоту (с одной и с другой стороны от вставляемого ребра v1->v2) */
 
-    mes_t *cntr1 = find_edge(v1, track.next->v1);
-    mes_t *cntr2 = find_edge(v1, track.next->v2);
+    mes_t *cntr1 = find_edge(m, v1, track.next->v1);
+    mes_t *cntr2 = find_edge(m, v1, track.next->v2);
     LIST_DETACH(cntr1); LIST_INIT(cntr1);
     LIST_DETACH(cntr2); LIST_INIT(cntr2);
     for (mes_t *e = track.next; e != &track; e = e->next)
@@ -3913,7 +6664,7 @@ int handle_constraints(mesher_t *m, int object)
     for (int i = 0; i < m->nv; i++)
     {
         if (m->v[i].object != object) continue;
-        if (find_edge(&m->v[i], m->v[i].prev_in_contour) != NULL) continue;
+        if (find_edge(m, &m->v[i], m->v[i].prev_in_contour) != NULL) continue;
         int res = insert_fixed_edge(m, &m->v[i], m->v[i].prev_in_contour);
         if (res != MESHER_DONE) return res;
     }
@@ -4017,6 +6768,7 @@ int fix_contours_bugs(mesher_t *m)
         VECADD(delta[1], v2dir[0], v2dir[1]);
         VECADD(&v1->x, &v1->x, delta[0]);
         VECADD(&v2->x, &v2->x, delta[1]);
+        MESHER_STAT(m, repairs++);
         need_resorting = true;
     }
     /* Сортируем массив вершин по координате y */
@@ -4052,6 +6804,7 @@ int fix_contours_bugs(mesher_t *m)
         C->prev_in_contour = A;
         B->prev_in_contour = C;
         D->prev_in_contour = B;
+        MESHER_STAT(m, repairs++);
     }
 
     return MESHER_DONE;
@@ -4085,7 +6838,7 @@ static void make_triangles_ccw(mesher_t *mesh)
     }
 }
 
-int mesher(mesher_t *m, int deep)
+static int mesher_stages(mesher_t *m, int deep)
 {
     int res = fix_contours_bugs(m);
     if (res != MESHER_DONE) return res;
@@ -4097,384 +6850,4208 @@ int mesher(mesher_t *m, int deep)
     {
         /* Триангуляция без ограничений. */
         /* Создаёт выпуклую триангуляцию на всём множестве точек */
-        res = sweep_points(m, object);
+        MESHER_STAGE(m, time_sweep, "sweep_points", res = sweep_points(m, object))
         if (res != MESHER_DONE) return res;
 
         /* Оптимизация сетки */
-        res = optimize_all(m, deep, object);
+        MESHER_STAGE(m, time_optimize, "optimize_all", res = optimize_all(m, deep, object))
         if (res != MESHER_DONE) return res;
 
         /* Вставка структурных отрезков */
-        res = handle_constraints(m, object);
+        MESHER_STAGE(m, time_constraints, "handle_constraints", res = handle_constraints(m, object))
         if (res != MESHER_DONE) return res;
 
         /* Удаление лишних треугольников */
-        res = remove_excess_triangles(m);
+        MESHER_STAGE(m, time_remove_excess, "remove_excess_triangles", res = remove_excess_triangles(m))
         if (res != MESHER_DONE) return res;
 
         /* Оптимизация сетки */
-        res = optimize_all(m, deep, object);
+        MESHER_STAGE(m, time_optimize, "optimize_all", res = optimize_all(m, deep, object))
         if (res != MESHER_DONE) return res;
     }
     make_triangles_ccw(m);
     return MESHER_DONE;
 }
 
-int ttf_glyph2mesh(ttf_glyph_t *glyph, ttf_mesh_t **output, uint8_t quality, int features)
+int mesher(mesher_t *m, int deep)
 {
-    ttf_outline_t *o;
-    mesher_t *mesh;
-    ttf_mesh_t *out;
     int res;
+    TRACE_BEGIN("mesher", -1, NULL);
+    m->budget.limits = thread_budget;
+    m->budget.deadline = 0;
+    m->budget.flips = 0;
+    m->budget.exhausted = false;
+    if (thread_budget != NULL && thread_budget->max_time_ns > 0)
+        m->budget.deadline = ttf_clock() + thread_budget->max_time_ns * 1e-9;
+    res = mesher_stages(m, deep);
+    TRACE_END("mesher");
+    return res;
+}
 
-    *output = NULL;
-    if (glyph->outline == NULL)
-        return TTF_ERR_NO_OUTLINE;
+const ttf_mesher_budget_t *ttf_set_thread_mesher_budget(const ttf_mesher_budget_t *budget)
+{
+    const ttf_mesher_budget_t *prev = thread_budget;
+    thread_budget = budget;
+    return prev;
+}
 
-    if (quality < 8) quality = 8;
-    if (quality > 128) quality = 128;
+/* ---------------------- Monotone triangulation --------------------- */
 
-    /* Создаём outline и mesher */
-    o = ttf_linear_outline(glyph, quality);
-    if (o == NULL) return TTF_ERR_NOMEM;
-    if (o->total_points < 3)
-    {
-        ttf_free_outline(o);
-        return TTF_ERR_NO_OUTLINE;
-    }
-    mesh = create_mesher(o);
-    if (mesh == NULL)
-    {
-        ttf_free_outline(o);
-        return TTF_ERR_NOMEM;
-    }
+/*
+ * The fast engine of TTF_FEATURE_MONOTONE mode. The contours are oriented
+ * by the hole flags of create_mesher so that the glyph body lies on the
+ * left side of them. The sweep from top to bottom splits the body into
+ * y-monotone pieces by diagonals, then every piece is triangulated in
+ * linear time. The triangles are placed to the mesher structures, so the
+ * mesh is written by the same functions as the mesher() result.
+ * The contours are expected to have no intersections, the result is
+ * checked by the area and the number of triangles.
+ */
 
-    /* Запускаем mesher */
-    res = mesher(mesh, 128);
-    if (res == MESHER_FAIL) goto failed;
-    if (res == MESHER_WARN && (features & TTF_FEATURE_IGN_ERR) == 0) goto failed;
+#define MONO_START   0
+#define MONO_END     1
+#define MONO_SPLIT   2
+#define MONO_MERGE   3
+#define MONO_REGULAR 4
 
-    /* Считаем число треугольников */
-    int nt = 0;
-    for (mts_t *t = mesh->tused.next; t != &mesh->tused; t = t->next)
-        nt++;
+/* sweep order: a is processed before b */
+#define MONO_ABOVE(a, b) ((a)->y > (b)->y || ((a)->y == (b)->y && (a)->x > (b)->x))
 
-    /* Создаём выходной объект */
-    out = (ttf_mesh_t *)calloc(
-        /* this */  sizeof(ttf_mesh_t) +
-        /* vert */  mesh->nv * 2 * sizeof(float) +
-        /* faces */ nt * 3 * sizeof(int), 1);
-    if (out == NULL)
-    {
-        ttf_free_outline(o);
-        free_mesher(mesh);
-        return TTF_ERR_NOMEM;
-    }
-    out->nvert = mesh->nv;
-    out->nfaces = 0;
-    out->outline = o;
-    *(void **)&out->vert = out + 1;
-    *(void **)&out->faces = &out->vert[out->nvert];
+typedef struct
+{
+    mesher_t *m;
+    int *vnext;                   /* next vertex of oriented contour */
+    int *vprev;                   /* previous vertex of oriented contour */
+    int *type;                    /* MONO_XXX type of vertex */
+    int *helper;                  /* helper vertex of the edge (v, vnext[v]) */
+    int *status;                  /* edges crossing the sweep line by their first vertex */
+    int nstatus;
+    int *next;                    /* next node of piece boundary */
+    int *prev;                    /* previous node of piece boundary */
+    int *vert;                    /* vertex of node */
+    int *copy;                    /* next node of the same vertex or -1 */
+    int nnodes;
+    int maxnodes;
+} monotone_t;
+
+static __inline double mono_cross(const mvs_t *o, const mvs_t *a, const mvs_t *b)
+{
+    return ((double)a->x - o->x) * ((double)b->y - o->y) - ((double)a->y - o->y) * ((double)b->x - o->x);
+}
 
-    /* Заполняем выходной объект */
-    for (int i = 0; i < mesh->nv; i++)
-    {
-        out->vert[i].x = mesh->v[i].x;
-        out->vert[i].y = mesh->v[i].y;
-    }
-    for (mts_t *t = mesh->tused.next; t != &mesh->tused; t = t->next)
+/**
+ * @brief Node of vertex v, which angle between the piece edges contains the direction to w
+ */
+static int mono_node(monotone_t *mt, int v, int w)
+{
+    const mvs_t *V = mt->m->v + v;
+    const mvs_t *W = mt->m->v + w;
+    int n;
+    if (mt->copy[v] < 0) return v;
+    for (n = v; n >= 0; n = mt->copy[n])
     {
-        mvs_t *v1, *v2, *v3;
-        float d1[2], d2[2];
-        if (IS_CONTOUR_EDGE(t->edge[1]))
-            SWAP(mes_t *, t->edge[0], t->edge[1])
+        const mvs_t *P = mt->m->v + mt->vert[mt->prev[n]];
+        const mvs_t *N = mt->m->v + mt->vert[mt->next[n]];
+        /* the body is counterclockwise from (V, N) to (V, P) */
+        if (mono_cross(V, N, P) > 0)
+        {
+            if (mono_cross(V, N, W) > 0 && mono_cross(V, W, P) > 0) return n;
+        }
         else
-        if (IS_CONTOUR_EDGE(t->edge[2]))
-            SWAP(mes_t *, t->edge[0], t->edge[2])
-        v1 = EDGES_COMMON_VERT(t->edge[0], t->edge[1]);
-        v2 = EDGES_COMMON_VERT(t->edge[0], t->edge[2]);
-        v3 = EDGES_COMMON_VERT(t->edge[1], t->edge[2]);
-        VECSUB(d1, &v1->x, &v2->x);
-        VECSUB(d2, &v1->x, &v3->x);
-        if (VECCROSS(d1, d2) < 0)
-            SWAP(mvs_t *, v1, v2);
-        out->faces[out->nfaces].v1 = v1 - mesh->v;
-        out->faces[out->nfaces].v2 = v2 - mesh->v;
-        out->faces[out->nfaces].v3 = v3 - mesh->v;
-        out->nfaces++;
+        {
+            if (!(mono_cross(V, P, W) > 0 && mono_cross(V, W, N) > 0)) return n;
+        }
     }
-
-    *output = out;
-    free_mesher(mesh);
-    return TTF_DONE;
-
-failed:
-    ttf_free_outline(o);
-    free_mesher(mesh);
-    return TTF_ERR_MESHER;
+    return -1;
 }
 
-static inline void calc_normal_to_ccw_edge(const mvs_t *v1, const mvs_t *v2, float *res)
+/**
+ * @brief Splitting the piece by diagonal (v, w)
+ */
+static bool mono_diagonal(monotone_t *mt, int v, int w)
 {
-    float dx = v2->x - v1->x;
-    float dy = v2->y - v1->y;
-    float factor = sqrt(dx * dx + dy * dy);
-    factor = factor < 1e-8 ? 0 : 1.0f / factor;
-    dx *= factor;
-    dy *= factor;
-    res[0] = dy;
-    res[1] = -dx;
-    res[2] = 0;
+    int a = mono_node(mt, v, w);
+    int b = mono_node(mt, w, v);
+    int a2, b2, an, bp;
+    if (a < 0 || b < 0 || mt->nnodes + 2 > mt->maxnodes) return false;
+
+    /* the nodes a2 and b2 are the copies of a and b in the second piece */
+    a2 = mt->nnodes++;
+    b2 = mt->nnodes++;
+    mt->vert[a2] = v;
+    mt->vert[b2] = w;
+    mt->copy[a2] = mt->copy[a];
+    mt->copy[a] = a2;
+    mt->copy[b2] = mt->copy[b];
+    mt->copy[b] = b2;
+
+    an = mt->next[a];
+    bp = mt->prev[b];
+    mt->next[a] = b;
+    mt->prev[b] = a;
+    mt->next[bp] = b2;
+    mt->prev[b2] = bp;
+    mt->next[b2] = a2;
+    mt->prev[a2] = b2;
+    mt->next[a2] = an;
+    mt->prev[an] = a2;
+    return true;
 }
 
-static void make_side_quad(const mvs_t *v1, const mvs_t *v2, const mes_t *e1,
-                           float *v, int *i, float *n, int vbase, float depth)
+/**
+ * @brief Status edge directly left of vertex v or -1
+ */
+static int mono_left_edge(monotone_t *mt, int v)
 {
-    /*
+    const mvs_t *V = mt->m->v + v;
+    float best = 0;
+    int i, res = -1;
+    for (i = 0; i < mt->nstatus; i++)
+    {
+        const mvs_t *a = mt->m->v + mt->status[i];
+        const mvs_t *b = mt->m->v + mt->vnext[mt->status[i]];
+        float x = a->y == b->y ? (a->x < b->x ? a->x : b->x) :
+            a->x + (V->y - a->y) * (b->x - a->x) / (b->y - a->y);
+        if (x > V->x) continue;
+        if (res < 0 || x > best)
+        {
+            best = x;
+            res = mt->status[i];
+        }
+    }
+    return res;
+}
 
-          /\
-         /  \
-     v1 /    \ v2
-       /__e1__\
-     #0| side |#3
-       |______|
-     #1        #2
+static void mono_remove_edge(monotone_t *mt, int e)
+{
+    int i;
+    for (i = 0; i < mt->nstatus; i++)
+        if (mt->status[i] == e)
+        {
+            mt->status[i] = mt->status[--mt->nstatus];
+            return;
+        }
+}
 
-    */
-(void)e1;
-    /* four vertices */
-    *v++ = v1->x; *v++ = v1->y; *v++ = +depth;
-    *v++ = v1->x; *v++ = v1->y; *v++ = -depth;
-    *v++ = v2->x; *v++ = v2->y; *v++ = -depth;
-    *v++ = v2->x; *v++ = v2->y; *v++ = +depth;
-
-    /* first triangle indices */
-    *i++ = vbase + 0;
-    *i++ = vbase + 1;
-    *i++ = vbase + 3;
-
-    /* second triangle indices */
-    *i++ = vbase + 1;
-    *i++ = vbase + 2;
-    *i++ = vbase + 3;
+/**
+ * @brief Diagonal to the helper of edge e if the helper is merge vertex
+ */
+static bool mono_fix_up(monotone_t *mt, int v, int e)
+{
+    if (mt->type[mt->helper[e]] != MONO_MERGE) return true;
+    return mono_diagonal(mt, v, mt->helper[e]);
+}
 
-    /* calc normal to side quad */
-    float N[3];
-    float n01[3];
-    float n23[3];
-    calc_normal_to_ccw_edge(v1, v2, N);
+/**
+ * @brief Splitting the glyph body into y-monotone pieces
+ */
+static bool mono_split(monotone_t *mt)
+{
+    mesher_t *m = mt->m;
+    int i, e;
 
-    /* vertex #0 and #1 normal */
-    if (v1->shd_flag)
+    for (i = m->nv - 1; i >= 0; i--)
     {
-        const mvs_t *nb = v2 == v1->next_in_contour ? v1->prev_in_contour : v1->next_in_contour;
-        float nb_n[3];
-        calc_normal_to_ccw_edge(nb, v1, nb_n);
-        n01[0] = (N[0] + nb_n[0]) / 2;
-        n01[1] = (N[1] + nb_n[1]) / 2;
-        n01[2] = (N[2] + nb_n[2]) / 2;
+        int v = m->s[i] - m->v;
+        switch (mt->type[v])
+        {
+        case MONO_START:
+            mt->status[mt->nstatus++] = v;
+            mt->helper[v] = v;
+            break;
+        case MONO_END:
+            if (!mono_fix_up(mt, v, mt->vprev[v])) return false;
+            mono_remove_edge(mt, mt->vprev[v]);
+            break;
+        case MONO_SPLIT:
+            e = mono_left_edge(mt, v);
+            if (e < 0 || !mono_diagonal(mt, v, mt->helper[e])) return false;
+            mt->helper[e] = v;
+            mt->status[mt->nstatus++] = v;
+            mt->helper[v] = v;
+            break;
+        case MONO_MERGE:
+            if (!mono_fix_up(mt, v, mt->vprev[v])) return false;
+            mono_remove_edge(mt, mt->vprev[v]);
+            e = mono_left_edge(mt, v);
+            if (e < 0 || !mono_fix_up(mt, v, e)) return false;
+            mt->helper[e] = v;
+            break;
+        default:
+            if (MONO_ABOVE(m->v + mt->vprev[v], m->v + v))
+            {
+                /* the body lies to the right of vertex */
+                if (!mono_fix_up(mt, v, mt->vprev[v])) return false;
+                mono_remove_edge(mt, mt->vprev[v]);
+                mt->status[mt->nstatus++] = v;
+                mt->helper[v] = v;
+            }
+            else
+            {
+                e = mono_left_edge(mt, v);
+                if (e < 0 || !mono_fix_up(mt, v, e)) return false;
+                mt->helper[e] = v;
+            }
+            break;
+        }
     }
-    else
+    return true;
+}
+
+static bool mono_triangle(mesher_t *m, int i1, int i2, int i3)
+{
+    mvs_t *v[3];
+    mes_t *e[3];
+    int i;
+    v[0] = m->v + i1;
+    v[1] = m->v + i2;
+    v[2] = m->v + i3;
+    for (i = 0; i < 3; i++)
     {
-        n01[0] = N[0];
-        n01[1] = N[1];
-        n01[2] = N[2];
+        e[i] = find_edge(m, v[i], v[(i + 1) % 3]);
+        if (e[i] == NULL) e[i] = create_edge(m, v[i], v[(i + 1) % 3]);
+        if (e[i] == NULL) return false;
     }
+    return create_triangle(m, e[0], e[1], e[2]) != NULL;
+}
 
-    /* vertex #2 and #3 normal */
-    if (v2->shd_flag)
+/**
+ * @brief Triangulation of the y-monotone piece with the first node
+ * @param u Buffer of the piece vertices in sweep order
+ * @param side Buffer of the chain flags of vertices (0 - left, 1 - right)
+ * @param stack Buffer of the stack
+ * @return Number of triangles or -1 if error
+ */
+static int mono_piece(monotone_t *mt, int first, bool *visited, int *u, int *side, int *stack)
+{
+    mesher_t *m = mt->m;
+    int top, bottom, l, r, n, j, k, ns;
+
+    /* the top and bottom nodes */
+    top = bottom = first;
+    n = 0;
+    j = first;
+    do
     {
-        const mvs_t *nb = v1 == v2->next_in_contour ? v2->prev_in_contour : v2->next_in_contour;
-        float nb_n[3];
-        calc_normal_to_ccw_edge(v2, nb, nb_n);
-        n23[0] = (N[0] + nb_n[0]) / 2;
-        n23[1] = (N[1] + nb_n[1]) / 2;
-        n23[2] = (N[2] + nb_n[2]) / 2;
+        visited[j] = true;
+        if (MONO_ABOVE(m->v + mt->vert[j], m->v + mt->vert[top])) top = j;
+        if (MONO_ABOVE(m->v + mt->vert[bottom], m->v + mt->vert[j])) bottom = j;
+        j = mt->next[j];
+        if (++n > mt->nnodes) return -1;
     }
-    else
+    while (j != first);
+    if (n < 3) return -1;
+
+    /* merging of the left (next) and right (prev) chains */
+    u[0] = mt->vert[top];
+    side[0] = 0;
+    k = 1;
+    l = mt->next[top];
+    r = mt->prev[top];
+    while (l != bottom || r != bottom)
     {
-        n23[0] = N[0];
+        bool left = r == bottom ||
+            (l != bottom && MONO_ABOVE(m->v + mt->vert[l], m->v + mt->vert[r]));
+        u[k] = mt->vert[left ? l : r];
+        side[k++] = left ? 0 : 1;
+        if (left)
+            l = mt->next[l]; else
+            r = mt->prev[r];
+    }
+    u[k] = mt->vert[bottom];
+    side[k] = 0;
+
+    stack[0] = 0;
+    stack[1] = 1;
+    ns = 2;
+    for (j = 2; j < n - 1; j++)
+    {
+        if (side[j] != side[stack[ns - 1]])
+        {
+            /* the vertex sees all the stack vertices */
+            for (k = 0; k < ns - 1; k++)
+                if (!mono_triangle(m, u[j], u[stack[k]], u[stack[k + 1]])) return -1;
+            stack[0] = j - 1;
+            stack[1] = j;
+            ns = 2;
+        }
+        else
+        {
+            int last = stack[--ns];
+            while (ns > 0)
+            {
+                const mvs_t *A = m->v + u[stack[ns - 1]];
+                const mvs_t *B = m->v + u[last];
+                const mvs_t *C = m->v + u[j];
+                double c = side[j] == 0 ? mono_cross(A, B, C) : -mono_cross(A, B, C);
+                if (c <= 0) break;
+                if (!mono_triangle(m, u[stack[ns - 1]], u[last], u[j])) return -1;
+                last = stack[--ns];
+            }
+            stack[ns++] = last;
+            stack[ns++] = j;
+        }
+    }
+    for (k = 0; k < ns - 1; k++)
+        if (!mono_triangle(m, u[n - 1], u[stack[k]], u[stack[k + 1]])) return -1;
+    return n - 2;
+}
+
+/**
+ * @brief Triangulation by the monotone decomposition
+ * @return MESHER_DONE or MESHER_FAIL if the contours can not be triangulated
+ */
+static int monotone_mesher(mesher_t *m)
+{
+    monotone_t mt;
+    int *mem, *u, *side, *stack;
+    bool *visited;
+    double area, tarea;
+    int i, nt, nholes, nouter, res;
+
+    res = fix_contours_bugs(m);
+    if (res != MESHER_DONE) return res;
+    if (m->nv < 3) return MESHER_FAIL;
+
+    /* the diagonals add two nodes for every vertex at most */
+    mem = (int *)mem_alloc(m->nv * 26 * sizeof(int) + m->nv * 3 * sizeof(bool));
+    if (mem == NULL) return MESHER_FAIL;
+    mt.m = m;
+    mt.vnext = mem;
+    mt.vprev = mt.vnext + m->nv;
+    mt.type = mt.vprev + m->nv;
+    mt.helper = mt.type + m->nv;
+    mt.status = mt.helper + m->nv;
+    mt.nstatus = 0;
+    mt.next = mt.status + m->nv;
+    mt.prev = mt.next + m->nv * 3;
+    mt.vert = mt.prev + m->nv * 3;
+    mt.copy = mt.vert + m->nv * 3;
+    u = mt.copy + m->nv * 3;
+    side = u + m->nv * 3;
+    stack = side + m->nv * 3;
+    visited = (bool *)(stack + m->nv * 3);
+    memset(visited, 0, m->nv * 3 * sizeof(bool));
+
+    /* orientation of contours: the body on the left side */
+    area = 0;
+    nholes = nouter = 0;
+    for (i = 0; i < m->nv; i++)
+    {
+        mvs_t *v = m->v + i;
+        double a = 0;
+        if (i != 0 && m->v[i - 1].contour == v->contour) continue;
+        for (mvs_t *p = v->next_in_contour; ; p = p->next_in_contour)
+        {
+            a += (double)p->prev_in_contour->x * p->y - (double)p->x * p->prev_in_contour->y;
+            if (p == v) break;
+        }
+        bool reverse = (a > 0) == v->is_hole;
+        mvs_t *p = v;
+        do
+        {
+            int k = p - m->v;
+            mt.vnext[k] = (reverse ? p->prev_in_contour : p->next_in_contour) - m->v;
+            mt.vprev[k] = (reverse ? p->next_in_contour : p->prev_in_contour) - m->v;
+            p = p->next_in_contour;
+        }
+        while (p != v);
+        area += fabs(a) * (v->is_hole ? -0.5 : 0.5);
+        if (v->is_hole) nholes++; else nouter++;
+    }
+
+    /* vertex types and the initial pieces */
+    for (i = 0; i < m->nv; i++)
+    {
+        const mvs_t *v = m->v + i;
+        const mvs_t *p = m->v + mt.vprev[i];
+        const mvs_t *n = m->v + mt.vnext[i];
+        bool convex = mono_cross(p, v, n) > 0;
+        if (MONO_ABOVE(v, p) && MONO_ABOVE(v, n))
+            mt.type[i] = convex ? MONO_START : MONO_SPLIT; else
+        if (MONO_ABOVE(p, v) && MONO_ABOVE(n, v))
+            mt.type[i] = convex ? MONO_END : MONO_MERGE; else
+            mt.type[i] = MONO_REGULAR;
+        mt.next[i] = mt.vnext[i];
+        mt.prev[i] = mt.vprev[i];
+        mt.vert[i] = i;
+        mt.copy[i] = -1;
+    }
+    mt.nnodes = m->nv;
+    mt.maxnodes = m->nv * 3;
+
+    res = MESHER_FAIL;
+    if (mono_split(&mt))
+    {
+        /* triangulation of pieces */
+        nt = 0;
+        for (i = 0; i < mt.nnodes && nt >= 0; i++)
+            if (!visited[i])
+            {
+                int n = mono_piece(&mt, i, visited, u, side, stack);
+                nt = n < 0 ? -1 : nt + n;
+            }
+
+        /* the overlapped or wrongly nested contours give the wrong area */
+        tarea = 0;
+        for (mts_t *t = m->tused.next; t != &m->tused; t = t->next)
+            tarea += fabs(mono_cross(TRI_FIRST_VERT(t), TRI_SECOND_VERT(t), TRI_THIRD_VERT(t))) * 0.5;
+        if (nt == m->nv + 2 * nholes - 2 * nouter && fabs(tarea - area) <= area * 1e-4)
+            res = MESHER_DONE;
+    }
+    mem_free(mem);
+
+    if (res == MESHER_DONE)
+        make_triangles_ccw(m);
+    return res;
+}
+
+/* output writer of the glyph meshes */
+typedef struct mesh_writer
+{
+    uint8_t *vert;                /* vertices */
+    int vert_stride;              /* distance between vertices, bytes */
+    int vert_dim;                 /* number of coordinates: 2 or 3 */
+    uint8_t *faces;               /* triangles */
+    int face_stride;              /* distance between triangles, bytes */
+    uint8_t *normals;             /* vertex normals (can be NULL) */
+    int normal_stride;            /* distance between normals, bytes */
+    int base_vertex;              /* value to add to every index */
+    int index_size;               /* 2 or 4 (0 means 4) */
+    int vert_format;              /* TTF_VERT_XXX */
+    float vert_scale;             /* scale of TTF_VERT_S16 format */
+    int normal_format;            /* TTF_NORMAL_XXX */
+} mesh_writer_t;
+
+static int16_t float_to_s16(float f)
+{
+    f = f < 0 ? f - 0.5f : f + 0.5f;
+    if (f >= 32767.0f) return 32767;
+    if (f <= -32768.0f) return -32768;
+    return (int16_t)f;
+}
+
+static uint16_t float_to_half(float f)
+{
+    union { float f; uint32_t u; } v;
+    uint32_t sign, exp, mant;
+    v.f = f;
+    sign = (v.u >> 16) & 0x8000;
+    exp = (v.u >> 23) & 0xFF;
+    mant = v.u & 0x7FFFFF;
+    if (exp == 0xFF) /* inf or nan */
+        return sign | 0x7C00 | (mant != 0 ? 0x200 : 0);
+    if (exp > 127 + 15) /* overflow */
+        return sign | 0x7C00;
+    if (exp < 127 - 24) /* underflow to zero */
+        return sign;
+    if (exp < 127 - 14) /* subnormal */
+    {
+        uint32_t shift = 127 - 14 - exp + 13;
+        mant |= 0x800000;
+        return sign | ((mant + (1u << (shift - 1))) >> shift);
+    }
+    /* rounding to nearest, the carry to the exponent is correct */
+    return sign | ((((exp - 127 + 15) << 10) | (mant >> 13)) + ((mant >> 12) & 1));
+}
+
+static void encode_oct16(const float *n, int8_t *res)
+{
+    float len = fabsf(n[0]) + fabsf(n[1]) + fabsf(n[2]);
+    float u, v;
+    if (len < 1e-8f)
+    {
+        res[0] = 0;
+        res[1] = 0;
+        return;
+    }
+    u = n[0] / len;
+    v = n[1] / len;
+    if (n[2] < 0)
+    {
+        float tu = (1.0f - fabsf(v)) * (u >= 0 ? 1.0f : -1.0f);
+        float tv = (1.0f - fabsf(u)) * (v >= 0 ? 1.0f : -1.0f);
+        u = tu;
+        v = tv;
+    }
+    res[0] = (int8_t)floorf(u * 127.0f + 0.5f);
+    res[1] = (int8_t)floorf(v * 127.0f + 0.5f);
+}
+
+static __inline void put_vert(mesh_writer_t *w, int index, float x, float y, float z)
+{
+    uint8_t *ptr = w->vert + (size_t)index * w->vert_stride;
+    switch (w->vert_format)
+    {
+    case TTF_VERT_S16:
+    {
+        int16_t *v = (int16_t *)ptr;
+        v[0] = float_to_s16(x * w->vert_scale);
+        v[1] = float_to_s16(y * w->vert_scale);
+        if (w->vert_dim == 3) v[2] = float_to_s16(z * w->vert_scale);
+        break;
+    }
+    case TTF_VERT_F16:
+    {
+        uint16_t *v = (uint16_t *)ptr;
+        v[0] = float_to_half(x);
+        v[1] = float_to_half(y);
+        if (w->vert_dim == 3) v[2] = float_to_half(z);
+        break;
+    }
+    default:
+    {
+        float *v = (float *)ptr;
+        v[0] = x;
+        v[1] = y;
+        if (w->vert_dim == 3) v[2] = z;
+        break;
+    }
+    }
+}
+
+static __inline void put_normal(mesh_writer_t *w, int index, const float *n)
+{
+    if (w->normals == NULL) return;
+    uint8_t *ptr = w->normals + (size_t)index * w->normal_stride;
+    if (w->normal_format == TTF_NORMAL_OCT16)
+    {
+        encode_oct16(n, (int8_t *)ptr);
+        return;
+    }
+    float *res = (float *)ptr;
+    res[0] = n[0];
+    res[1] = n[1];
+    res[2] = n[2];
+}
+
+static __inline void put_face(mesh_writer_t *w, int index, int v1, int v2, int v3)
+{
+    if (w->index_size == 2)
+    {
+        uint16_t *f = (uint16_t *)(w->faces + (size_t)index * w->face_stride);
+        f[0] = (uint16_t)(v1 + w->base_vertex);
+        f[1] = (uint16_t)(v2 + w->base_vertex);
+        f[2] = (uint16_t)(v3 + w->base_vertex);
+        return;
+    }
+    int *f = (int *)(w->faces + (size_t)index * w->face_stride);
+    f[0] = v1 + w->base_vertex;
+    f[1] = v2 + w->base_vertex;
+    f[2] = v3 + w->base_vertex;
+}
+
+/**
+ * @brief Creating the linear outline and the mesher and running it
+ * @return Operation result TTF_XXX, outline and result are filled only if TTF_DONE returned
+ */
+static int glyph_mesher_run(const ttf_glyph_t *glyph, uint8_t quality, int features,
+                            ttf_outline_t **outline, mesher_t **result)
+{
+    ttf_outline_t *o;
+    mesher_t *mesh;
+    int res;
+
+    if (!GLYPH_HAS_OUTLINE(glyph))
+        return TTF_ERR_NO_OUTLINE;
+
+    if (quality < 8) quality = 8;
+    if (quality > 128) quality = 128;
+
+    /* Создаём outline и mesher */
+    o = ttf_linear_outline(glyph, quality);
+    if (o == NULL) return TTF_ERR_NOMEM;
+    if (o->total_points < 3)
+    {
+        ttf_free_outline(o);
+        return TTF_ERR_NO_OUTLINE;
+    }
+    mesh = create_mesher(o);
+    if (mesh == NULL)
+    {
+        ttf_free_outline(o);
+        return TTF_ERR_NOMEM;
+    }
+
+    /* Запускаем mesher */
+    res = MESHER_FAIL;
+    if (features & TTF_FEATURE_MONOTONE)
+    {
+        TRACE_BEGIN("monotone_mesher", glyph->index, NULL);
+        res = monotone_mesher(mesh);
+        TRACE_END("monotone_mesher");
+        if (res != MESHER_DONE)
+        {
+            /* the overlapped contours are handled by the full mesher */
+            free_mesher(mesh);
+            mesh = create_mesher(o);
+            if (mesh == NULL)
+            {
+                ttf_free_outline(o);
+                return TTF_ERR_NOMEM;
+            }
+        }
+    }
+    if (res != MESHER_DONE)
+        res = mesher(mesh, 128);
+    if (res == MESHER_ABORT)
+    {
+        ttf_free_outline(o);
+        free_mesher(mesh);
+        return TTF_ERR_BUDGET;
+    }
+    if (res == MESHER_FAIL || (res == MESHER_WARN && (features & TTF_FEATURE_IGN_ERR) == 0))
+    {
+        ttf_free_outline(o);
+        free_mesher(mesh);
+        return TTF_ERR_MESHER;
+    }
+
+    *outline = o;
+    *result = mesh;
+    return TTF_DONE;
+}
+
+int ttf_glyph_mesher_stats(ttf_glyph_t *glyph, uint8_t quality, ttf_mesher_stats_t *stats)
+{
+    ttf_outline_t *o;
+    mesher_t *mesh;
+    int res;
+
+    memset(stats, 0, sizeof(ttf_mesher_stats_t));
+    if (!GLYPH_HAS_OUTLINE(glyph))
+        return TTF_ERR_NO_OUTLINE;
+
+    if (quality < 8) quality = 8;
+    if (quality > 128) quality = 128;
+
+    o = ttf_linear_outline(glyph, quality);
+    if (o == NULL) return TTF_ERR_NOMEM;
+    if (o->total_points < 3)
+    {
+        ttf_free_outline(o);
+        return TTF_ERR_NO_OUTLINE;
+    }
+    mesh = create_mesher(o);
+    if (mesh == NULL)
+    {
+        ttf_free_outline(o);
+        return TTF_ERR_NOMEM;
+    }
+
+    res = mesher(mesh, 128);
+#ifdef TTF_MESHER_STATS
+    *stats = mesh->stats;
+#endif
+    stats->glyphs = 1;
+    stats->failed = res == MESHER_DONE ? 0 : 1;
+    free_mesher(mesh);
+    ttf_free_outline(o);
+    if (res == MESHER_ABORT) return TTF_ERR_BUDGET;
+    return res == MESHER_DONE ? TTF_DONE : TTF_ERR_MESHER;
+}
+
+int ttf_font_mesher_stats(ttf_t *ttf, uint8_t quality, ttf_mesher_stats_t *total, ttf_mesher_stats_t *glyphs)
+{
+    memset(total, 0, sizeof(ttf_mesher_stats_t));
+    for (int i = 0; i < ttf->nglyphs; i++)
+    {
+        ttf_mesher_stats_t st;
+        int res = ttf_glyph_mesher_stats(&ttf->glyphs[i], quality, &st);
+        if (glyphs != NULL) glyphs[i] = st;
+        if (res == TTF_ERR_NOMEM) return res;
+        total->glyphs += st.glyphs;
+        total->failed += st.failed;
+        total->vertices += st.vertices;
+        total->hull_steps += st.hull_steps;
+        total->edges += st.edges;
+        total->triangles += st.triangles;
+        total->flips += st.flips;
+        total->find_edge_probes += st.find_edge_probes;
+        total->constraints += st.constraints;
+        total->repairs += st.repairs;
+        total->time_sweep += st.time_sweep;
+        total->time_optimize += st.time_optimize;
+        total->time_constraints += st.time_constraints;
+        total->time_remove_excess += st.time_remove_excess;
+    }
+    return TTF_DONE;
+}
+
+/**
+ * @brief Number of the output triangles (nt) and the side quads (ne) of mesher
+ */
+static void count_mesher_output(mesher_t *mesh, int *nt, int *ne)
+{
+    *nt = 0;
+    *ne = 0;
+    for (mts_t *t = mesh->tused.next; t != &mesh->tused; t = t->next)
+    {
+        if (IS_CONTOUR_EDGE(t->edge[0])) (*ne)++;
+        if (IS_CONTOUR_EDGE(t->edge[1])) (*ne)++;
+        if (IS_CONTOUR_EDGE(t->edge[2])) (*ne)++;
+        (*nt)++;
+    }
+}
+
+/**
+ * @brief Writing the 2d mesh of mesher
+ * @return Number of the written triangles
+ */
+static int emit_mesh2d(mesher_t *mesh, mesh_writer_t *w)
+{
+    int nfaces = 0;
+
+    for (int i = 0; i < mesh->nv; i++)
+        put_vert(w, i, mesh->v[i].x, mesh->v[i].y, 0);
+
+    for (mts_t *t = mesh->tused.next; t != &mesh->tused; t = t->next)
+    {
+        mvs_t *v1, *v2, *v3;
+        float d1[2], d2[2];
+        if (IS_CONTOUR_EDGE(t->edge[1]))
+            SWAP(mes_t *, t->edge[0], t->edge[1])
+        else
+        if (IS_CONTOUR_EDGE(t->edge[2]))
+            SWAP(mes_t *, t->edge[0], t->edge[2])
+        v1 = EDGES_COMMON_VERT(t->edge[0], t->edge[1]);
+        v2 = EDGES_COMMON_VERT(t->edge[0], t->edge[2]);
+        v3 = EDGES_COMMON_VERT(t->edge[1], t->edge[2]);
+        VECSUB(d1, &v1->x, &v2->x);
+        VECSUB(d2, &v1->x, &v3->x);
+        if (VECCROSS(d1, d2) < 0)
+            SWAP(mvs_t *, v1, v2);
+        put_face(w, nfaces++, v1 - mesh->v, v2 - mesh->v, v3 - mesh->v);
+    }
+
+    return nfaces;
+}
+
+static int glyph2mesh(ttf_glyph_t *glyph, ttf_mesh_t **output, uint8_t quality, int features)
+{
+    ttf_outline_t *o;
+    mesher_t *mesh;
+    ttf_mesh_t *out;
+    mesh_writer_t w;
+    int res, nt, ne;
+
+    *output = NULL;
+    res = glyph_mesher_run(glyph, quality, features, &o, &mesh);
+    if (res != TTF_DONE) return res;
+
+    /* Считаем число треугольников */
+    count_mesher_output(mesh, &nt, &ne);
+
+    /* Создаём выходной объект */
+    out = (ttf_mesh_t *)mem_calloc(
+        /* this */  sizeof(ttf_mesh_t) +
+        /* vert */  mesh->nv * 2 * sizeof(float) +
+        /* faces */ nt * 3 * sizeof(int), 1);
+    if (out == NULL)
+    {
+        ttf_free_outline(o);
+        free_mesher(mesh);
+        return TTF_ERR_NOMEM;
+    }
+    out->nvert = mesh->nv;
+    out->outline = o;
+    *(void **)&out->vert = out + 1;
+    *(void **)&out->faces = &out->vert[out->nvert];
+
+    /* Заполняем выходной объект */
+    memset(&w, 0, sizeof(w));
+    w.vert = (uint8_t *)out->vert;
+    w.vert_stride = sizeof(*out->vert);
+    w.vert_dim = 2;
+    w.faces = (uint8_t *)out->faces;
+    w.face_stride = sizeof(*out->faces);
+    out->nfaces = emit_mesh2d(mesh, &w);
+    free_mesher(mesh);
+
+    if ((features & TTF_FEATURE_OPT_CACHE) && ttf_mesh_optimize(out) != TTF_DONE)
+    {
+        ttf_free_mesh(out);
+        return TTF_ERR_NOMEM;
+    }
+
+    *output = out;
+    return TTF_DONE;
+}
+
+int ttf_glyph2mesh(ttf_glyph_t *glyph, ttf_mesh_t **output, uint8_t quality, int features)
+{
+    int res;
+    TRACE_BEGIN("ttf_glyph2mesh", glyph->index, NULL);
+    res = glyph2mesh(glyph, output, quality, features);
+    TRACE_END("ttf_glyph2mesh");
+    return res;
+}
+
+/* -------------------------- Mesh cache ------------------------- */
+
+/*
+ * The mesh cache keeps the meshes of glyphs of one font. The composite
+ * glyph mesh is assembled from the meshes of its components, so the
+ * accented letters reuse the meshes of their base letters and marks.
+ * The meshed glyphs are kept in the hash table, so the cache size does
+ * not depend on the number of glyphs in font.
+ */
+
+#define MESH_CACHE_SIZE 16
+
+typedef struct mesh_cache_entry
+{
+    int index;                    /* glyph index or -1 for the empty entry */
+    int result;                   /* meshing result of glyph */
+    ttf_mesh_t *mesh;             /* mesh of glyph or NULL */
+} mesh_cache_entry_t;
+
+struct ttf_mesh_cache
+{
+    ttf_t *ttf;
+    uint8_t quality;
+    int features;
+    int count;                    /* number of meshed glyphs */
+    int size;                     /* size of entries hash table (power of 2) */
+    mesh_cache_entry_t *entries;  /* meshed glyphs, open addressing by glyph index */
+};
+
+static int cached_glyph2mesh(ttf_mesh_cache_t *cache, int index, int depth);
+
+static __inline int mesh_cache_slot(const ttf_mesh_cache_t *cache, int index)
+{
+    return (int)(((uint32_t)index * 0x9E3779B1u) >> 16) & (cache->size - 1);
+}
+
+/**
+ * @brief Entry of the meshed glyph or NULL if glyph is not meshed yet
+ */
+static mesh_cache_entry_t *mesh_cache_find(const ttf_mesh_cache_t *cache, int index)
+{
+    int i;
+    for (i = mesh_cache_slot(cache, index); cache->entries[i].index >= 0; i = (i + 1) & (cache->size - 1))
+        if (cache->entries[i].index == index)
+            return cache->entries + i;
+    return NULL;
+}
+
+/**
+ * @brief Free entry of the glyph in the hash table
+ */
+static mesh_cache_entry_t *mesh_cache_place(ttf_mesh_cache_t *cache, int index)
+{
+    int i;
+    for (i = mesh_cache_slot(cache, index); cache->entries[i].index >= 0; i = (i + 1) & (cache->size - 1));
+    return cache->entries + i;
+}
+
+/**
+ * @brief Adding the glyph entry, the table grows at the half load
+ * @return New entry or NULL if no memory
+ */
+static mesh_cache_entry_t *mesh_cache_insert(ttf_mesh_cache_t *cache, int index)
+{
+    mesh_cache_entry_t *e;
+    int i;
+
+    if ((cache->count + 1) * 2 > cache->size)
+    {
+        mesh_cache_entry_t *old = cache->entries;
+        int size = cache->size;
+        e = (mesh_cache_entry_t *)mem_alloc(sizeof(mesh_cache_entry_t) * size * 2);
+        if (e == NULL) return NULL;
+        for (i = 0; i < size * 2; i++)
+            e[i].index = -1;
+        cache->entries = e;
+        cache->size = size * 2;
+        for (i = 0; i < size; i++)
+            if (old[i].index >= 0)
+                *mesh_cache_place(cache, old[i].index) = old[i];
+        mem_free(old);
+    }
+
+    e = mesh_cache_place(cache, index);
+    e->index = index;
+    e->result = TTF_ERR_NO_OUTLINE;
+    e->mesh = NULL;
+    cache->count++;
+    return e;
+}
+
+/**
+ * @brief Bounding box of the transformed component glyph
+ */
+static void component_box(const ttf_component_t *c, float box[4])
+{
+    const ttf_glyph_t *g = c->glyph;
+    int i;
+    for (i = 0; i < 4; i++)
+    {
+        float x = g->xbounds[i & 1];
+        float y = g->ybounds[i >> 1];
+        float tx = c->matrix[0][0] * x + c->matrix[0][1] * y + c->offset[0];
+        float ty = c->matrix[1][0] * x + c->matrix[1][1] * y + c->offset[1];
+        if (i == 0 || tx < box[0]) box[0] = tx;
+        if (i == 0 || tx > box[1]) box[1] = tx;
+        if (i == 0 || ty < box[2]) box[2] = ty;
+        if (i == 0 || ty > box[3]) box[3] = ty;
+    }
+}
+
+/**
+ * @brief Checking that the composite glyph mesh can be assembled from the component meshes
+ *
+ * The components must not have OVERLAP_COMPOUND flag, their transformations
+ * must be non-degenerate and their bounding boxes must not intersect.
+ */
+static bool can_compose_mesh(const ttf_glyph_t *glyph)
+{
+    float a[4], b[4];
+    int i, j;
+    if (glyph->ncomponents == 0) return false;
+    for (i = 0; i < glyph->ncomponents; i++)
+    {
+        const ttf_component_t *c = glyph->components + i;
+        if (c->overlap) return false;
+        if (c->matrix[0][0] * c->matrix[1][1] - c->matrix[0][1] * c->matrix[1][0] == 0) return false;
+    }
+    for (i = 0; i < glyph->ncomponents; i++)
+    {
+        if (!GLYPH_HAS_OUTLINE(glyph->components[i].glyph)) continue;
+        component_box(glyph->components + i, a);
+        for (j = i + 1; j < glyph->ncomponents; j++)
+        {
+            if (!GLYPH_HAS_OUTLINE(glyph->components[j].glyph)) continue;
+            component_box(glyph->components + j, b);
+            if (a[0] < b[1] && b[0] < a[1] && a[2] < b[3] && b[2] < a[3])
+                return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Assembling the composite glyph mesh from the transformed component meshes
+ */
+static int compose_mesh(ttf_mesh_cache_t *cache, const ttf_glyph_t *glyph, int depth, ttf_mesh_t **output)
+{
+    ttf_mesh_t *out;
+    ttf_outline_t *o;
+    int nvert, nfaces, ncontours, npoints;
+    int i, j, res;
+
+    /* meshing the components */
+    nvert = nfaces = ncontours = npoints = 0;
+    for (i = 0; i < glyph->ncomponents; i++)
+    {
+        const ttf_mesh_t *m;
+        res = cached_glyph2mesh(cache, glyph->components[i].index, depth + 1);
+        if (res == TTF_ERR_NO_OUTLINE) continue;
+        if (res != TTF_DONE) return res;
+        m = mesh_cache_find(cache, glyph->components[i].index)->mesh;
+        nvert += m->nvert;
+        nfaces += m->nfaces;
+        ncontours += m->outline->ncontours;
+        npoints += m->outline->total_points;
+    }
+    if (nvert == 0) return TTF_ERR_NO_OUTLINE;
+
+    /* the output layout is the same as glyph2mesh one */
+    out = (ttf_mesh_t *)mem_calloc(
+        sizeof(ttf_mesh_t) +
+        nvert * 2 * sizeof(float) +
+        nfaces * 3 * sizeof(int), 1);
+    o = allocate_ttf_outline(ncontours, npoints);
+    if (out == NULL || o == NULL)
+    {
+        mem_free(out);
+        ttf_free_outline(o);
+        return TTF_ERR_NOMEM;
+    }
+    out->nvert = nvert;
+    out->nfaces = nfaces;
+    out->outline = o;
+    *(void **)&out->vert = out + 1;
+    *(void **)&out->faces = &out->vert[out->nvert];
+
+    nvert = nfaces = ncontours = 0;
+    for (i = 0; i < glyph->ncomponents; i++)
+    {
+        const ttf_component_t *c = glyph->components + i;
+        const mesh_cache_entry_t *e = mesh_cache_find(cache, c->index);
+        const ttf_mesh_t *m;
+        bool flip;
+        if (e == NULL || e->result != TTF_DONE) continue;
+        m = e->mesh;
+
+        for (j = 0; j < m->nvert; j++)
+        {
+            out->vert[nvert + j].x = c->matrix[0][0] * m->vert[j].x + c->matrix[0][1] * m->vert[j].y + c->offset[0];
+            out->vert[nvert + j].y = c->matrix[1][0] * m->vert[j].x + c->matrix[1][1] * m->vert[j].y + c->offset[1];
+        }
+
+        /* the mirrored component has the clockwise triangles */
+        flip = c->matrix[0][0] * c->matrix[1][1] - c->matrix[0][1] * c->matrix[1][0] < 0;
+        for (j = 0; j < m->nfaces; j++)
+        {
+            out->faces[nfaces + j].v1 = m->faces[j].v1 + nvert;
+            out->faces[nfaces + j].v2 = (flip ? m->faces[j].v3 : m->faces[j].v2) + nvert;
+            out->faces[nfaces + j].v3 = (flip ? m->faces[j].v2 : m->faces[j].v3) + nvert;
+        }
+
+        for (j = 0; j < m->outline->ncontours; j++, ncontours++)
+        {
+            const ttf_point_t *src = m->outline->cont[j].pt;
+            ttf_point_t *dst = o->cont[ncontours].pt;
+            int k;
+            o->cont[ncontours].length = m->outline->cont[j].length;
+            o->cont[ncontours].subglyph_id = c->index;
+            o->cont[ncontours].subglyph_order = i;
+            for (k = 0; k < o->cont[ncontours].length; k++)
+            {
+                dst[k] = src[k];
+                dst[k].x = c->matrix[0][0] * src[k].x + c->matrix[0][1] * src[k].y + c->offset[0];
+                dst[k].y = c->matrix[1][0] * src[k].x + c->matrix[1][1] * src[k].y + c->offset[1];
+            }
+            if (ncontours + 1 < o->ncontours)
+                o->cont[ncontours + 1].pt = dst + o->cont[ncontours].length;
+        }
+
+        nvert += m->nvert;
+        nfaces += m->nfaces;
+    }
+
+    if ((cache->features & TTF_FEATURE_OPT_CACHE) && ttf_mesh_optimize(out) != TTF_DONE)
+    {
+        ttf_free_mesh(out);
+        return TTF_ERR_NOMEM;
+    }
+
+    *output = out;
+    return TTF_DONE;
+}
+
+/**
+ * @brief Meshing the glyph by the first request
+ * @param depth Depth of the component reference, the composite glyph is
+ *              meshed as the flattened outline at the depth limit
+ */
+static int cached_glyph2mesh(ttf_mesh_cache_t *cache, int index, int depth)
+{
+    ttf_glyph_t *glyph = cache->ttf->glyphs + index;
+    mesh_cache_entry_t *e;
+    ttf_mesh_t *mesh = NULL;
+    int res;
+
+    e = mesh_cache_find(cache, index);
+    if (e != NULL) return e->result;
+
+    res = TTF_ERR_MESHER;
+    if (depth < COMPONENTS_DEPTH && can_compose_mesh(glyph))
+        res = compose_mesh(cache, glyph, depth, &mesh);
+
+    /* the flattened outline can be meshed even if a component fails */
+    if (res == TTF_ERR_MESHER)
+        res = glyph2mesh(glyph, &mesh, cache->quality, cache->features);
+
+    /* the memory and budget errors are not cached */
+    if (res == TTF_ERR_NOMEM || res == TTF_ERR_BUDGET)
+        return res;
+    e = mesh_cache_insert(cache, index);
+    if (e == NULL)
+    {
+        ttf_free_mesh(mesh);
+        return TTF_ERR_NOMEM;
+    }
+    e->result = res;
+    e->mesh = mesh;
+    return res;
+}
+
+ttf_mesh_cache_t *ttf_create_mesh_cache(ttf_t *ttf, uint8_t quality, int features)
+{
+    ttf_mesh_cache_t *res;
+    int i;
+
+    res = (ttf_mesh_cache_t *)mem_calloc(1, sizeof(ttf_mesh_cache_t));
+    if (res == NULL) return NULL;
+    res->entries = (mesh_cache_entry_t *)mem_alloc(sizeof(mesh_cache_entry_t) * MESH_CACHE_SIZE);
+    if (res->entries == NULL)
+    {
+        mem_free(res);
+        return NULL;
+    }
+    res->ttf = ttf;
+    res->quality = quality;
+    res->features = features;
+    res->size = MESH_CACHE_SIZE;
+    for (i = 0; i < res->size; i++)
+        res->entries[i].index = -1;
+    return res;
+}
+
+int ttf_cached_glyph2mesh(ttf_mesh_cache_t *cache, int index, const ttf_mesh_t **output)
+{
+    int res;
+
+    *output = NULL;
+    if (index < 0 || index >= cache->ttf->nglyphs)
+        return TTF_ERR_NO_OUTLINE;
+    TRACE_BEGIN("ttf_cached_glyph2mesh", index, NULL);
+    res = cached_glyph2mesh(cache, index, 0);
+    TRACE_END("ttf_cached_glyph2mesh");
+    if (res == TTF_DONE)
+        *output = mesh_cache_find(cache, index)->mesh;
+    return res;
+}
+
+/* -------------------------- Triangle fans ---------------------- */
+
+/*
+ * The stencil-then-cover output: every contour is the fan around its first
+ * point, the winding number of a point is computed by the stencil buffer
+ * and the cover quad fills the points with the non-zero winding number.
+ */
+
+static int glyph2fan(ttf_glyph_t *glyph, uint8_t quality, ttf_fan_t **output)
+{
+    ttf_outline_t *o;
+    ttf_fan_t *out;
+    float area, xmin, xmax, ymin, ymax;
+    int i, j, nfan, nv;
+
+    *output = NULL;
+    if (!GLYPH_HAS_OUTLINE(glyph))
+        return TTF_ERR_NO_OUTLINE;
+
+    if (quality < 8) quality = 8;
+    if (quality > 128) quality = 128;
+
+    o = ttf_linear_outline(glyph, quality);
+    if (o == NULL) return TTF_ERR_NOMEM;
+    if (o->total_points < 3)
+    {
+        ttf_free_outline(o);
+        return TTF_ERR_NO_OUTLINE;
+    }
+
+    nfan = 0;
+    for (i = 0; i < o->ncontours; i++)
+        if (o->cont[i].length >= 3)
+            nfan += o->cont[i].length - 2;
+
+    /* Create output object */
+    out = (ttf_fan_t *)mem_calloc(1,
+        sizeof(ttf_fan_t) +
+        (o->total_points + 4) * sizeof(*out->vert) +
+        (nfan + 2) * sizeof(*out->faces));
+    if (out == NULL)
+    {
+        ttf_free_outline(o);
+        return TTF_ERR_NOMEM;
+    }
+    out->outline = o;
+    out->nvert = o->total_points + 4;
+    out->nfaces = nfan + 2;
+    out->nfan = nfan;
+    out->fill_rule = TTF_SDF_NONZERO;
+    *(void **)&out->vert = out + 1;
+    *(void **)&out->faces = &out->vert[out->nvert];
+
+    /* Fans of contours */
+    area = 0;
+    nv = 0;
+    nfan = 0;
+    xmin = xmax = o->cont[0].pt[0].x;
+    ymin = ymax = o->cont[0].pt[0].y;
+    for (i = 0; i < o->ncontours; i++)
+    {
+        const ttf_point_t *pt = o->cont[i].pt;
+        int len = o->cont[i].length;
+        for (j = 0; j < len; j++)
+        {
+            out->vert[nv + j].x = pt[j].x;
+            out->vert[nv + j].y = pt[j].y;
+            if (pt[j].x < xmin) xmin = pt[j].x;
+            if (pt[j].x > xmax) xmax = pt[j].x;
+            if (pt[j].y < ymin) ymin = pt[j].y;
+            if (pt[j].y > ymax) ymax = pt[j].y;
+        }
+        for (j = 1; j + 1 < len; j++)
+        {
+            out->faces[nfan].v1 = nv;
+            out->faces[nfan].v2 = nv + j;
+            out->faces[nfan].v3 = nv + j + 1;
+            area += (pt[j].x - pt[0].x) * (pt[j + 1].y - pt[0].y) -
+                    (pt[j + 1].x - pt[0].x) * (pt[j].y - pt[0].y);
+            nfan++;
+        }
+        nv += len;
+    }
+    out->winding = area < 0 ? -1 : 1;
+
+    /* Cover quad, counterclockwise */
+    out->vert[nv + 0].x = xmin;
+    out->vert[nv + 0].y = ymin;
+    out->vert[nv + 1].x = xmax;
+    out->vert[nv + 1].y = ymin;
+    out->vert[nv + 2].x = xmax;
+    out->vert[nv + 2].y = ymax;
+    out->vert[nv + 3].x = xmin;
+    out->vert[nv + 3].y = ymax;
+    out->faces[nfan].v1 = nv + 0;
+    out->faces[nfan].v2 = nv + 1;
+    out->faces[nfan].v3 = nv + 2;
+    out->faces[nfan + 1].v1 = nv + 0;
+    out->faces[nfan + 1].v2 = nv + 2;
+    out->faces[nfan + 1].v3 = nv + 3;
+
+    *output = out;
+    return TTF_DONE;
+}
+
+int ttf_glyph2fan(ttf_glyph_t *glyph, uint8_t quality, ttf_fan_t **output)
+{
+    int res;
+    TRACE_BEGIN("ttf_glyph2fan", glyph->index, NULL);
+    res = glyph2fan(glyph, quality, output);
+    TRACE_END("ttf_glyph2fan");
+    return res;
+}
+
+static inline void calc_normal_to_ccw_edge(const mvs_t *v1, const mvs_t *v2, float *res)
+{
+    float dx = v2->x - v1->x;
+    float dy = v2->y - v1->y;
+    float factor = sqrt(dx * dx + dy * dy);
+    factor = factor < 1e-8 ? 0 : 1.0f / factor;
+    dx *= factor;
+    dy *= factor;
+    res[0] = dy;
+    res[1] = -dx;
+    res[2] = 0;
+}
+
+static void make_side_quad(const mvs_t *v1, const mvs_t *v2, mesh_writer_t *w,
+                           const int *vi, int fbase, float depth)
+{
+    /*
+
+          /\
+         /  \
+     v1 /    \ v2
+       /______\
+     #0| side |#3
+       |______|
+     #1        #2
+
+    */
+
+    /* four vertices with vi[0..3] indices */
+    put_vert(w, vi[0], v1->x, v1->y, +depth);
+    put_vert(w, vi[1], v1->x, v1->y, -depth);
+    put_vert(w, vi[2], v2->x, v2->y, -depth);
+    put_vert(w, vi[3], v2->x, v2->y, +depth);
+
+    /* first and second triangle indices */
+    put_face(w, fbase + 0, vi[0], vi[1], vi[3]);
+    put_face(w, fbase + 1, vi[1], vi[2], vi[3]);
+
+    /* calc normal to side quad */
+    float N[3];
+    float n01[3];
+    float n23[3];
+    calc_normal_to_ccw_edge(v1, v2, N);
+
+    /* vertex #0 and #1 normal */
+    if (v1->shd_flag)
+    {
+        const mvs_t *nb = v2 == v1->next_in_contour ? v1->prev_in_contour : v1->next_in_contour;
+        float nb_n[3];
+        calc_normal_to_ccw_edge(nb, v1, nb_n);
+        n01[0] = (N[0] + nb_n[0]) / 2;
+        n01[1] = (N[1] + nb_n[1]) / 2;
+        n01[2] = (N[2] + nb_n[2]) / 2;
+    }
+    else
+    {
+        n01[0] = N[0];
+        n01[1] = N[1];
+        n01[2] = N[2];
+    }
+
+    /* vertex #2 and #3 normal */
+    if (v2->shd_flag)
+    {
+        const mvs_t *nb = v1 == v2->next_in_contour ? v2->prev_in_contour : v2->next_in_contour;
+        float nb_n[3];
+        calc_normal_to_ccw_edge(v2, nb, nb_n);
+        n23[0] = (N[0] + nb_n[0]) / 2;
+        n23[1] = (N[1] + nb_n[1]) / 2;
+        n23[2] = (N[2] + nb_n[2]) / 2;
+    }
+    else
+    {
+        n23[0] = N[0];
         n23[1] = N[1];
         n23[2] = N[2];
     }
 
-    *n++ = n01[0]; *n++ = n01[1]; *n++ = n01[2];
-    *n++ = n01[0]; *n++ = n01[1]; *n++ = n01[2];
-    *n++ = n23[0]; *n++ = n23[1]; *n++ = n23[2];
-    *n++ = n23[0]; *n++ = n23[1]; *n++ = n23[2];
+    put_normal(w, vi[0], n01);
+    put_normal(w, vi[1], n01);
+    put_normal(w, vi[2], n23);
+    put_normal(w, vi[3], n23);
+}
+
+/**
+ * @brief Index of the front side vertex of contour vertex a at edge (a, b)
+ *
+ * In shared sides mode the front and the back side vertices of the smooth
+ * contour vertex are shared by both side quads, as their normals are equal.
+ * The sharp contour vertex has own pair of side vertices for each edge.
+ * The back vertex index is the front one plus one. If next is not NULL,
+ * the new pair is allocated if required.
+ */
+static int side_vertex_slot(const mesher_t *mesh, int *slots, const mvs_t *a, const mvs_t *b, int *next)
+{
+    int side = a->shd_flag || b == a->next_in_contour ? 0 : 1;
+    int *slot = &slots[(a - mesh->v) * 2 + side];
+    if (*slot < 0 && next != NULL)
+    {
+        *slot = *next;
+        *next += 2;
+    }
+    return *slot;
+}
+
+static void contour_edge_slots(const mesher_t *mesh, int *slots, const mvs_t *a, const mvs_t *b, int *next)
+{
+    side_vertex_slot(mesh, slots, a, b, next);
+    side_vertex_slot(mesh, slots, b, a, next);
+}
+
+/**
+ * @brief Allocation of the shared side vertices
+ * @param slots Array of nv * 2 length, see side_vertex_slot
+ * @return Number of the side vertices
+ */
+static int assign_side_slots(mesher_t *mesh, int *slots)
+{
+    int next = 0;
+    for (int i = 0; i < mesh->nv * 2; i++)
+        slots[i] = -1;
+    for (mts_t *t = mesh->tused.next; t != &mesh->tused; t = t->next)
+    {
+        mvs_t *v1, *v2, *v3;
+        v1 = EDGES_COMMON_VERT(t->edge[1], t->edge[0]);
+        v2 = EDGES_COMMON_VERT(t->edge[1], t->edge[2]);
+        v3 = EDGES_COMMON_VERT(t->edge[0], t->edge[2]);
+        if (IS_CONTOUR_EDGE(t->edge[0])) contour_edge_slots(mesh, slots, v3, v1, &next);
+        if (IS_CONTOUR_EDGE(t->edge[1])) contour_edge_slots(mesh, slots, v1, v2, &next);
+        if (IS_CONTOUR_EDGE(t->edge[2])) contour_edge_slots(mesh, slots, v2, v3, &next);
+    }
+    return next;
+}
+
+/**
+ * @brief Writing the side quad of contour edge (a, b)
+ * @param vbase Pointer to the next free vertex index (if no slots)
+ */
+static void emit_side_quad(mesher_t *mesh, int *slots, const mvs_t *a, const mvs_t *b,
+                           mesh_writer_t *w, int *vbase, int fbase, float depth)
+{
+    int vi[4];
+    if (slots != NULL)
+    {
+        int s1 = mesh->nv * 2 + side_vertex_slot(mesh, slots, a, b, NULL);
+        int s2 = mesh->nv * 2 + side_vertex_slot(mesh, slots, b, a, NULL);
+        vi[0] = s1;
+        vi[1] = s1 + 1;
+        vi[2] = s2 + 1;
+        vi[3] = s2;
+    }
+    else
+    {
+        vi[0] = *vbase + 0;
+        vi[1] = *vbase + 1;
+        vi[2] = *vbase + 2;
+        vi[3] = *vbase + 3;
+        *vbase += 4; /* four vertices */
+    }
+    make_side_quad(a, b, w, vi, fbase, depth);
+}
+
+/**
+ * @brief Writing the 3d mesh of mesher
+ * @param slots Shared side vertices (see assign_side_slots) or NULL
+ * @return Number of the written triangles
+ */
+static int emit_mesh3d(mesher_t *mesh, mesh_writer_t *w, float depth, int *slots)
+{
+    static const float front[3] = {0, 0, 1};
+    static const float back[3] = {0, 0, -1};
+
+    /* Fill vertices and normals of front and back planes */
+    depth *= 0.5f;
+    for (int i = 0; i < mesh->nv; i++)
+    {
+        put_vert(w, i, mesh->v[i].x, mesh->v[i].y, depth);
+        put_normal(w, i, front);
+    }
+    for (int i = 0; i < mesh->nv; i++)
+    {
+        put_vert(w, mesh->nv + i, mesh->v[i].x, mesh->v[i].y, -depth);
+        put_normal(w, mesh->nv + i, back);
+    }
+
+    int vbase = mesh->nv * 2;
+    int nfaces = 0;
+    for (mts_t *t = mesh->tused.next; t != &mesh->tused; t = t->next)
+    {
+        mvs_t *v1, *v2, *v3;
+
+        /*
+
+              v3
+              /\
+          e0 /  \ e2
+            /CCW!\
+           /______\
+        v1    e1    v2
+
+        */
+
+        v1 = EDGES_COMMON_VERT(t->edge[1], t->edge[0]);
+        v2 = EDGES_COMMON_VERT(t->edge[1], t->edge[2]);
+        v3 = EDGES_COMMON_VERT(t->edge[0], t->edge[2]);
+
+        /* front triangle */
+        put_face(w, nfaces++, v1 - mesh->v, v2 - mesh->v, v3 - mesh->v);
+
+        /* back triangle */
+        put_face(w, nfaces++, v3 - mesh->v + mesh->nv, v2 - mesh->v + mesh->nv, v1 - mesh->v + mesh->nv);
+
+        if (IS_CONTOUR_EDGE(t->edge[0]))
+        {
+            emit_side_quad(mesh, slots, v3, v1, w, &vbase, nfaces, depth);
+            nfaces += 2; /* two triangles */
+        }
+        if (IS_CONTOUR_EDGE(t->edge[1]))
+        {
+            emit_side_quad(mesh, slots, v1, v2, w, &vbase, nfaces, depth);
+            nfaces += 2;
+        }
+        if (IS_CONTOUR_EDGE(t->edge[2]))
+        {
+            emit_side_quad(mesh, slots, v2, v3, w, &vbase, nfaces, depth);
+            nfaces += 2;
+        }
+    }
+
+    return nfaces;
+}
+
+static int glyph2mesh3d(ttf_glyph_t *glyph, ttf_mesh3d_t **output, uint8_t quality, int features, float depth)
+{
+    ttf_outline_t *o;
+    mesher_t *mesh;
+    ttf_mesh3d_t *out;
+    mesh_writer_t w;
+    int res, nt, ne, nside;
+    int *slots;
+
+    *output = NULL;
+    res = glyph_mesher_run(glyph, quality, features, &o, &mesh);
+    if (res != TTF_DONE) return res;
+
+    /* Count the number of triangles and outer edges */
+    count_mesher_output(mesh, &nt, &ne);
+    slots = NULL;
+    nside = ne * 4;
+    if (features & TTF_FEATURE_SHARED_SIDES)
+    {
+        slots = (int *)mem_alloc(mesh->nv * 2 * sizeof(int));
+        if (slots == NULL)
+        {
+            ttf_free_outline(o);
+            free_mesher(mesh);
+            return TTF_ERR_NOMEM;
+        }
+        nside = assign_side_slots(mesh, slots);
+    }
+
+    /* Create output object */
+    out = (ttf_mesh3d_t *)mem_alloc(
+        sizeof(ttf_mesh3d_t) +
+        (mesh->nv * 2 + nside) * sizeof(*out->vert) +
+        (nt * 2 + ne * 2) * sizeof(*out->faces) +
+        (mesh->nv * 2 + nside) * sizeof(*out->normals)
+    );
+    if (out == NULL)
+    {
+        mem_free(slots);
+        ttf_free_outline(o);
+        free_mesher(mesh);
+        return TTF_ERR_NOMEM;
+    }
+    out->outline = o;
+    out->nvert = mesh->nv * 2 + nside;
+    out->nfaces = nt * 2 + ne * 2;
+    *(void **)&out->vert = out + 1;
+    *(void **)&out->faces = &out->vert[out->nvert];
+    *(void **)&out->normals = &out->faces[out->nfaces];
+
+    memset(&w, 0, sizeof(w));
+    w.vert = (uint8_t *)out->vert;
+    w.vert_stride = sizeof(*out->vert);
+    w.vert_dim = 3;
+    w.faces = (uint8_t *)out->faces;
+    w.face_stride = sizeof(*out->faces);
+    w.normals = (uint8_t *)out->normals;
+    w.normal_stride = sizeof(*out->normals);
+    emit_mesh3d(mesh, &w, depth, slots);
+    free_mesher(mesh);
+    mem_free(slots);
+
+    if ((features & TTF_FEATURE_OPT_CACHE) && ttf_mesh3d_optimize(out) != TTF_DONE)
+    {
+        ttf_free_mesh3d(out);
+        return TTF_ERR_NOMEM;
+    }
+
+    *output = out;
+    return TTF_DONE;
+}
+
+int ttf_glyph2mesh3d(ttf_glyph_t *glyph, ttf_mesh3d_t **output, uint8_t quality, int features, float depth)
+{
+    int res;
+    TRACE_BEGIN("ttf_glyph2mesh3d", glyph->index, NULL);
+    res = glyph2mesh3d(glyph, output, quality, features, depth);
+    TRACE_END("ttf_glyph2mesh3d");
+    return res;
+}
+
+/**
+ * @brief Preparing the writer to the target buffers
+ * @return false if the target capacity or the index size is not enough
+ */
+static bool init_target_writer(mesh_writer_t *w, ttf_mesh_target_t *target, int dim, int nvert, int nfaces)
+{
+    int vsize, nsize;
+    if (nvert > target->max_vert || nfaces > target->max_faces)
+        return false;
+    if (target->index_size == 2 && target->base_vertex + nvert > 65536)
+        return false;
+    vsize = target->vert_format == TTF_VERT_F32 ? (int)sizeof(float) : (int)sizeof(int16_t);
+    nsize = target->normal_format == TTF_NORMAL_OCT16 ? 2 : (int)sizeof(float) * 3;
+    memset(w, 0, sizeof(*w));
+    w->vert = (uint8_t *)target->vert;
+    w->vert_stride = target->vert_stride != 0 ? target->vert_stride : vsize * dim;
+    w->vert_dim = dim;
+    w->faces = (uint8_t *)target->faces;
+    w->face_stride = target->face_stride != 0 ? target->face_stride : (target->index_size == 2 ? 2 : 4) * 3;
+    w->normals = dim == 3 ? (uint8_t *)target->normals : NULL;
+    w->normal_stride = target->normal_stride != 0 ? target->normal_stride : nsize;
+    w->base_vertex = target->base_vertex;
+    w->index_size = target->index_size;
+    w->vert_format = target->vert_format;
+    w->vert_scale = target->vert_scale != 0 ? target->vert_scale : TTF_VERT_S16_SCALE;
+    w->normal_format = target->normal_format;
+    return true;
+}
+
+static int glyph2mesh_to(ttf_glyph_t *glyph, uint8_t quality, int features, ttf_mesh_target_t *target)
+{
+    ttf_outline_t *o;
+    mesher_t *mesh;
+    mesh_writer_t w;
+    int res, nt, ne;
+
+    target->nvert = 0;
+    target->nfaces = 0;
+    res = glyph_mesher_run(glyph, quality, features, &o, &mesh);
+    if (res != TTF_DONE) return res;
+
+    count_mesher_output(mesh, &nt, &ne);
+    if (init_target_writer(&w, target, 2, mesh->nv, nt))
+    {
+        target->nvert = mesh->nv;
+        target->nfaces = emit_mesh2d(mesh, &w);
+    }
+    else
+        res = TTF_ERR_BUFSIZE;
+
+    ttf_free_outline(o);
+    free_mesher(mesh);
+    return res;
+}
+
+static int glyph2mesh3d_to(ttf_glyph_t *glyph, uint8_t quality, int features, float depth, ttf_mesh_target_t *target)
+{
+    ttf_outline_t *o;
+    mesher_t *mesh;
+    mesh_writer_t w;
+    int res, nt, ne, nside;
+    int *slots;
+
+    target->nvert = 0;
+    target->nfaces = 0;
+    res = glyph_mesher_run(glyph, quality, features, &o, &mesh);
+    if (res != TTF_DONE) return res;
+
+    count_mesher_output(mesh, &nt, &ne);
+    slots = NULL;
+    nside = ne * 4;
+    if (features & TTF_FEATURE_SHARED_SIDES)
+    {
+        slots = (int *)mem_alloc(mesh->nv * 2 * sizeof(int));
+        if (slots == NULL)
+        {
+            ttf_free_outline(o);
+            free_mesher(mesh);
+            return TTF_ERR_NOMEM;
+        }
+        nside = assign_side_slots(mesh, slots);
+    }
+
+    if (init_target_writer(&w, target, 3, mesh->nv * 2 + nside, nt * 2 + ne * 2))
+    {
+        target->nvert = mesh->nv * 2 + nside;
+        target->nfaces = emit_mesh3d(mesh, &w, depth, slots);
+    }
+    else
+        res = TTF_ERR_BUFSIZE;
+
+    mem_free(slots);
+    ttf_free_outline(o);
+    free_mesher(mesh);
+    return res;
+}
+
+int ttf_glyph2mesh_to(ttf_glyph_t *glyph, uint8_t quality, int features, ttf_mesh_target_t *target)
+{
+    const ttf_allocator_t *prev = thread_allocator;
+    int res;
+    if (target->allocator != NULL) thread_allocator = target->allocator;
+    res = glyph2mesh_to(glyph, quality, features, target);
+    thread_allocator = prev;
+    return res;
+}
+
+int ttf_glyph2mesh3d_to(ttf_glyph_t *glyph, uint8_t quality, int features, float depth, ttf_mesh_target_t *target)
+{
+    const ttf_allocator_t *prev = thread_allocator;
+    int res;
+    if (target->allocator != NULL) thread_allocator = target->allocator;
+    res = glyph2mesh3d_to(glyph, quality, features, depth, target);
+    thread_allocator = prev;
+    return res;
+}
+
+/**
+ * @brief Offset directions of the contour vertices
+ * @param dir Output outward offset vector of every vertex, nv * 2 length
+ * @param nrm Output outward shading normal of every vertex, nv * 2 length
+ *
+ * The offset vector is the miter of two adjacent contour edges, it moves
+ * both edges by one unit. The miter length is limited by 4 units.
+ */
+static void contour_offsets(mesher_t *mesh, float *dir, float *nrm)
+{
+    memset(dir, 0, mesh->nv * 2 * sizeof(float));
+    for (mts_t *t = mesh->tused.next; t != &mesh->tused; t = t->next)
+    {
+        mvs_t *v[3];
+        v[0] = EDGES_COMMON_VERT(t->edge[1], t->edge[0]);
+        v[1] = EDGES_COMMON_VERT(t->edge[1], t->edge[2]);
+        v[2] = EDGES_COMMON_VERT(t->edge[0], t->edge[2]);
+        for (int i = 0; i < 3; i++)
+        {
+            /* edges e0, e1, e2 are (v3, v1), (v1, v2), (v2, v3) */
+            mvs_t *a = v[(i + 2) % 3];
+            mvs_t *b = v[i];
+            float n[3];
+            if (!IS_CONTOUR_EDGE(t->edge[i])) continue;
+            calc_normal_to_ccw_edge(a, b, n);
+            dir[(a - mesh->v) * 2 + 0] += n[0];
+            dir[(a - mesh->v) * 2 + 1] += n[1];
+            dir[(b - mesh->v) * 2 + 0] += n[0];
+            dir[(b - mesh->v) * 2 + 1] += n[1];
+        }
+    }
+    for (int i = 0; i < mesh->nv; i++)
+    {
+        float *s = dir + i * 2;
+        float len2 = s[0] * s[0] + s[1] * s[1];
+        float len = sqrtf(len2);
+        nrm[i * 2 + 0] = len < 1e-8f ? 0 : s[0] / len;
+        nrm[i * 2 + 1] = len < 1e-8f ? 0 : s[1] / len;
+        /* s = n1 + n2, miter = 2 * s / |s|^2 */
+        if (len2 < 0.25f) len2 = 0.25f;
+        s[0] = 2.0f * s[0] / len2;
+        s[1] = 2.0f * s[1] / len2;
+    }
+}
+
+/**
+ * @brief Writing the side strip of contour edge (a, b) between two profile steps
+ */
+static void make_profile_quad(mesher_t *mesh, const mvs_t *a, const mvs_t *b,
+                              const float *dir, const float *nrm,
+                              const float *p1, const float *p2,
+                              mesh_writer_t *w, int vbase, int fbase)
+{
+    int ia = a - mesh->v;
+    int ib = b - mesh->v;
+    float en[3], na[3], nb[3], dr, dz, len;
+
+    /* ring vertices, see make_side_quad for the order */
+    put_vert(w, vbase + 0, a->x - dir[ia * 2] * p1[0], a->y - dir[ia * 2 + 1] * p1[0], p1[1]);
+    put_vert(w, vbase + 1, a->x - dir[ia * 2] * p2[0], a->y - dir[ia * 2 + 1] * p2[0], p2[1]);
+    put_vert(w, vbase + 2, b->x - dir[ib * 2] * p2[0], b->y - dir[ib * 2 + 1] * p2[0], p2[1]);
+    put_vert(w, vbase + 3, b->x - dir[ib * 2] * p1[0], b->y - dir[ib * 2 + 1] * p1[0], p1[1]);
+    put_face(w, fbase + 0, vbase + 0, vbase + 1, vbase + 3);
+    put_face(w, fbase + 1, vbase + 1, vbase + 2, vbase + 3);
+
+    /* the surface normal is (-dz * n, dr), where n is 2d outward normal */
+    /* and dr is the outward movement of the profile step */
+    calc_normal_to_ccw_edge(a, b, en);
+    dr = p1[0] - p2[0];
+    dz = p2[1] - p1[1];
+    len = sqrtf(dr * dr + dz * dz);
+    if (len > 1e-8f)
+    {
+        dr /= len;
+        dz /= len;
+    }
+    na[0] = -dz * (a->shd_flag ? nrm[ia * 2] : en[0]);
+    na[1] = -dz * (a->shd_flag ? nrm[ia * 2 + 1] : en[1]);
+    na[2] = dr;
+    nb[0] = -dz * (b->shd_flag ? nrm[ib * 2] : en[0]);
+    nb[1] = -dz * (b->shd_flag ? nrm[ib * 2 + 1] : en[1]);
+    nb[2] = dr;
+    put_normal(w, vbase + 0, na);
+    put_normal(w, vbase + 1, na);
+    put_normal(w, vbase + 2, nb);
+    put_normal(w, vbase + 3, nb);
+}
+
+int ttf_glyph2mesh3d_profile(ttf_glyph_t *glyph, ttf_mesh3d_t **output, uint8_t quality, int features,
+                             const float *profile, int nsteps)
+{
+    static const float front[3] = {0, 0, 1};
+    static const float back[3] = {0, 0, -1};
+    ttf_outline_t *o;
+    mesher_t *mesh;
+    ttf_mesh3d_t *out;
+    mesh_writer_t w;
+    const float *last;
+    float *dir, *nrm;
+    int res, nt, ne, nv, nfaces, vbase;
+
+    *output = NULL;
+    if (profile == NULL || nsteps < 2)
+        return TTF_ERR_ARG;
+    res = glyph_mesher_run(glyph, quality, features, &o, &mesh);
+    if (res != TTF_DONE) return res;
+
+    count_mesher_output(mesh, &nt, &ne);
+    nv = mesh->nv;
+
+    /* Create output object and the temporary offsets */
+    out = (ttf_mesh3d_t *)mem_alloc(
+        sizeof(ttf_mesh3d_t) +
+        (nv * 2 + ne * 4 * (nsteps - 1)) * sizeof(*out->vert) +
+        (nt * 2 + ne * 2 * (nsteps - 1)) * sizeof(*out->faces) +
+        (nv * 2 + ne * 4 * (nsteps - 1)) * sizeof(*out->normals)
+    );
+    dir = (float *)mem_alloc(nv * 4 * sizeof(float));
+    if (out == NULL || dir == NULL)
+    {
+        mem_free(out);
+        mem_free(dir);
+        ttf_free_outline(o);
+        free_mesher(mesh);
+        return TTF_ERR_NOMEM;
+    }
+    out->outline = o;
+    out->nvert = nv * 2 + ne * 4 * (nsteps - 1);
+    out->nfaces = nt * 2 + ne * 2 * (nsteps - 1);
+    *(void **)&out->vert = out + 1;
+    *(void **)&out->faces = &out->vert[out->nvert];
+    *(void **)&out->normals = &out->faces[out->nfaces];
+    nrm = dir + nv * 2;
+    contour_offsets(mesh, dir, nrm);
+
+    memset(&w, 0, sizeof(w));
+    w.vert = (uint8_t *)out->vert;
+    w.vert_stride = sizeof(*out->vert);
+    w.vert_dim = 3;
+    w.faces = (uint8_t *)out->faces;
+    w.face_stride = sizeof(*out->faces);
+    w.normals = (uint8_t *)out->normals;
+    w.normal_stride = sizeof(*out->normals);
+
+    /* Caps: the first step is the front one, the last step is the back one */
+    last = profile + (nsteps - 1) * 2;
+    for (int i = 0; i < nv; i++)
+    {
+        put_vert(&w, i,
+                 mesh->v[i].x - dir[i * 2] * profile[0],
+                 mesh->v[i].y - dir[i * 2 + 1] * profile[0], profile[1]);
+        put_normal(&w, i, front);
+        put_vert(&w, nv + i,
+                 mesh->v[i].x - dir[i * 2] * last[0],
+                 mesh->v[i].y - dir[i * 2 + 1] * last[0], last[1]);
+        put_normal(&w, nv + i, back);
+    }
+
+    nfaces = 0;
+    vbase = nv * 2;
+    for (mts_t *t = mesh->tused.next; t != &mesh->tused; t = t->next)
+    {
+        mvs_t *v[3];
+        v[0] = EDGES_COMMON_VERT(t->edge[1], t->edge[0]);
+        v[1] = EDGES_COMMON_VERT(t->edge[1], t->edge[2]);
+        v[2] = EDGES_COMMON_VERT(t->edge[0], t->edge[2]);
+        put_face(&w, nfaces++, v[0] - mesh->v, v[1] - mesh->v, v[2] - mesh->v);
+        put_face(&w, nfaces++, v[2] - mesh->v + nv, v[1] - mesh->v + nv, v[0] - mesh->v + nv);
+        for (int i = 0; i < 3; i++)
+        {
+            if (!IS_CONTOUR_EDGE(t->edge[i])) continue;
+            for (int k = 0; k < nsteps - 1; k++)
+            {
+                make_profile_quad(mesh, v[(i + 2) % 3], v[i], dir, nrm,
+                                  profile + k * 2, profile + k * 2 + 2, &w, vbase, nfaces);
+                vbase += 4;
+                nfaces += 2;
+            }
+        }
+    }
+    free_mesher(mesh);
+    mem_free(dir);
+
+    if ((features & TTF_FEATURE_OPT_CACHE) && ttf_mesh3d_optimize(out) != TTF_DONE)
+    {
+        ttf_free_mesh3d(out);
+        return TTF_ERR_NOMEM;
+    }
+
+    *output = out;
+    return TTF_DONE;
+}
+
+/**
+ * @brief Number of the linear outline points of glyph (upper bound)
+ */
+static int linear_outline_size(const ttf_glyph_t *glyph, uint8_t quality)
+{
+    ttf_outline_t *temp;
+    const ttf_outline_t *o = glyph_outline(glyph, &temp);
+    int i, n;
+    if (o == NULL) return 0;
+    if (quality < 8) quality = 8;
+    if (quality > 128) quality = 128;
+    n = 0;
+    for (i = 0; i < o->ncontours; i++)
+        n += linearize_contour(o->cont[i].pt, NULL, o->cont[i].length, quality);
+    ttf_free_outline(temp);
+    return n;
+}
+
+void ttf_glyph_mesh_bounds(const ttf_glyph_t *glyph, uint8_t quality, int *max_vert, int *max_faces)
+{
+    /* the mesher creates no new points, and the triangulation of */
+    /* n points has no more than 2n + 1 triangles (see MAXV_TO_MAXT) */
+    int n = linear_outline_size(glyph, quality);
+    *max_vert = n;
+    *max_faces = n < 3 ? 0 : MAXV_TO_MAXT(n + 2);
+}
+
+void ttf_glyph_mesh3d_bounds(const ttf_glyph_t *glyph, uint8_t quality, int *max_vert, int *max_faces)
+{
+    /* each contour edge gives a side quad per adjacent triangle, */
+    /* so there are no more than 2n quads */
+    int n = linear_outline_size(glyph, quality);
+    *max_vert = n * 2 + n * 2 * 4;
+    *max_faces = n < 3 ? 0 : MAXV_TO_MAXT(n + 2) * 2 + n * 2 * 2;
+}
+
+/* segment of the curve outline: line or quadratic curve from p to the next segment start */
+typedef struct curve_seg
+{
+    float p[2];                   /* start point (on curve) */
+    float c[2];                   /* control point of quadratic curve */
+    int quad;                     /* segment is quadratic curve */
+    int concave;                  /* control point is inside of the glyph */
+    int split;                    /* curve is marked for splitting */
+    int cont;                     /* contour index */
+} curve_seg_t;
+
+typedef struct curve_outline
+{
+    int nsegs;                    /* number of segments */
+    int ncontours;                /* number of contours */
+    int *first;                   /* first segment of contour, ncontours + 1 length */
+    curve_seg_t *segs;            /* segments */
+} curve_outline_t;
+
+#define CURVE_SPLIT_PASSES 4      /* limit of the overlapped curves splitting */
+
+static __inline const float *curve_seg_end(const curve_outline_t *co, int i)
+{
+    int c = co->segs[i].cont;
+    return co->segs[i + 1 == co->first[c + 1] ? co->first[c] : i + 1].p;
+}
+
+static __inline float orient2d(const float *a, const float *b, const float *c)
+{
+    return (b[0] - a[0]) * (c[1] - a[1]) - (b[1] - a[1]) * (c[0] - a[0]);
+}
+
+static bool segments_cross(const float *a, const float *b, const float *c, const float *d)
+{
+    float o1 = orient2d(a, b, c);
+    float o2 = orient2d(a, b, d);
+    float o3 = orient2d(c, d, a);
+    float o4 = orient2d(c, d, b);
+    return ((o1 > EPSILON && o2 < -EPSILON) || (o1 < -EPSILON && o2 > EPSILON)) &&
+           ((o3 > EPSILON && o4 < -EPSILON) || (o3 < -EPSILON && o4 > EPSILON));
+}
+
+static bool point_in_triangle(const float *p, const float *a, const float *b, const float *c)
+{
+    float o1 = orient2d(a, b, p);
+    float o2 = orient2d(b, c, p);
+    float o3 = orient2d(c, a, p);
+    return (o1 > EPSILON && o2 > EPSILON && o3 > EPSILON) ||
+           (o1 < -EPSILON && o2 < -EPSILON && o3 < -EPSILON);
+}
+
+/**
+ * @brief Checking if point p lies inside or on the border of triangle abc
+ */
+static bool point_on_triangle(const float *p, const float *a, const float *b, const float *c)
+{
+    float o1 = orient2d(a, b, p);
+    float o2 = orient2d(b, c, p);
+    float o3 = orient2d(c, a, p);
+    return (o1 > -EPSILON && o2 > -EPSILON && o3 > -EPSILON) ||
+           (o1 < EPSILON && o2 < EPSILON && o3 < EPSILON);
+}
+
+/**
+ * @brief Checking if the hull triangle of curve i overlaps other segments
+ */
+static bool curve_hull_overlapped(const curve_outline_t *co, int i)
+{
+    const float *p0 = co->segs[i].p;
+    const float *c = co->segs[i].c;
+    const float *p1 = curve_seg_end(co, i);
+    for (int k = 0; k < co->nsegs; k++)
+    {
+        const curve_seg_t *s = &co->segs[k];
+        const float *end = curve_seg_end(co, k);
+        if (k == i) continue;
+        if (point_in_triangle(s->p, p0, c, p1)) return true;
+        if (s->quad)
+        {
+            /* control point on the chord of other curve makes the polygons touch */
+            if (point_on_triangle(s->c, p0, c, p1)) return true;
+            if (segments_cross(s->p, s->c, p0, c) || segments_cross(s->p, s->c, c, p1)) return true;
+            if (segments_cross(s->c, end, p0, c) || segments_cross(s->c, end, c, p1)) return true;
+        }
+        else
+        {
+            if (segments_cross(s->p, end, p0, c) || segments_cross(s->p, end, c, p1)) return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Creating the curve outline of glyph outline
+ * @return false if no memory
+ *
+ * The implied on-curve points between two off-curve points are added,
+ * so every segment is a line or a quadratic curve. The contour of all
+ * off-curve points is started at the implied point.
+ */
+static bool create_curve_outline(const ttf_outline_t *o, curve_outline_t *co)
+{
+    ttf_point_t *q;
+    int i, j;
+    co->ncontours = o->ncontours;
+    co->nsegs = 0;
+    co->first = (int *)mem_alloc((o->ncontours + 1) * sizeof(int) + o->total_points * 2 * sizeof(curve_seg_t));
+    if (co->first == NULL) return false;
+    co->segs = (curve_seg_t *)(co->first + o->ncontours + 1);
+    q = (ttf_point_t *)mem_alloc((o->total_points * 2 + 1) * sizeof(ttf_point_t));
+    if (q == NULL)
+    {
+        mem_free(co->first);
+        return false;
+    }
+    for (i = 0; i < o->ncontours; i++)
+    {
+        const ttf_point_t *pt = o->cont[i].pt;
+        int len = o->cont[i].length;
+        int start = co->nsegs;
+        int base, n;
+        co->first[i] = start;
+        if (len < 2) continue;
+
+        /* normalized contour q: starts on curve, no two off-curve points in a row */
+        for (base = 0; base < len && !pt[base].onc; base++);
+        n = 0;
+        if (base == len)
+        {
+            base = 0;
+            q[n].x = (pt[len - 1].x + pt[0].x) / 2;
+            q[n].y = (pt[len - 1].y + pt[0].y) / 2;
+            q[n++].onc = 1;
+        }
+        for (j = 0; j < len; j++)
+        {
+            const ttf_point_t *p = &pt[(base + j) % len];
+            if (!p->onc && n > 0 && !q[n - 1].onc)
+            {
+                q[n].x = (q[n - 1].x + p->x) / 2;
+                q[n].y = (q[n - 1].y + p->y) / 2;
+                q[n++].onc = 1;
+            }
+            q[n++] = *p;
+        }
+
+        for (j = 0; j < n; j++)
+        {
+            curve_seg_t *s = &co->segs[co->nsegs];
+            if (!q[j].onc) continue;
+            s->p[0] = q[j].x;
+            s->p[1] = q[j].y;
+            s->quad = 0;
+            s->concave = 0;
+            s->split = 0;
+            s->cont = i;
+            if (!q[(j + 1) % n].onc)
+            {
+                s->c[0] = q[(j + 1) % n].x;
+                s->c[1] = q[(j + 1) % n].y;
+                s->quad = herons_area_p(&q[j], &q[(j + 1) % n], &q[(j + 2) % n]) > EPSILON;
+            }
+            co->nsegs++;
+        }
+        if (co->nsegs - start < 2)
+            co->nsegs = start;
+    }
+    co->first[o->ncontours] = co->nsegs;
+    mem_free(q);
+    return true;
+}
+
+/**
+ * @brief Splitting of curves whose hull triangles overlap other segments
+ * @return false if no memory
+ */
+static bool split_overlapped_curves(curve_outline_t *co)
+{
+    for (int pass = 0; pass < CURVE_SPLIT_PASSES; pass++)
+    {
+        int nsplit = 0;
+        for (int i = 0; i < co->nsegs; i++)
+        {
+            co->segs[i].split = co->segs[i].quad && curve_hull_overlapped(co, i);
+            nsplit += co->segs[i].split;
+        }
+        if (nsplit == 0) break;
+
+        int *first = (int *)mem_alloc((co->ncontours + 1) * sizeof(int) + (co->nsegs + nsplit) * sizeof(curve_seg_t));
+        if (first == NULL) return false;
+        curve_seg_t *segs = (curve_seg_t *)(first + co->ncontours + 1);
+        int n = 0;
+        for (int c = 0; c < co->ncontours; c++)
+        {
+            first[c] = n;
+            for (int i = co->first[c]; i < co->first[c + 1]; i++)
+            {
+                const curve_seg_t *s = &co->segs[i];
+                const float *end = curve_seg_end(co, i);
+                segs[n] = *s;
+                if (!s->split)
+                {
+                    n++;
+                    continue;
+                }
+                /* de Casteljau subdivision at t = 0.5 */
+                float m0[2], m1[2];
+                m0[0] = (s->p[0] + s->c[0]) / 2;
+                m0[1] = (s->p[1] + s->c[1]) / 2;
+                m1[0] = (s->c[0] + end[0]) / 2;
+                m1[1] = (s->c[1] + end[1]) / 2;
+                segs[n].c[0] = m0[0];
+                segs[n].c[1] = m0[1];
+                segs[n + 1] = *s;
+                segs[n + 1].p[0] = (m0[0] + m1[0]) / 2;
+                segs[n + 1].p[1] = (m0[1] + m1[1]) / 2;
+                segs[n + 1].c[0] = m1[0];
+                segs[n + 1].c[1] = m1[1];
+                n += 2;
+            }
+        }
+        first[co->ncontours] = n;
+        mem_free(co->first);
+        co->first = first;
+        co->segs = segs;
+        co->nsegs = n;
+    }
+    return true;
+}
+
+/**
+ * @brief Creating the polygon of on-curve points and concave control points
+ * @return Polygon outline or NULL if no memory
+ */
+static ttf_outline_t *curve_control_polygon(curve_outline_t *co, const ttf_outline_t *src)
+{
+    ttf_outline_t *hull, *poly;
+    int i, j, n;
+
+    /* the hull polygon of all points is used to define the filled side of contours */
+    hull = allocate_ttf_outline(co->ncontours, co->nsegs * 2);
+    if (hull == NULL) return NULL;
+    for (i = 0, n = 0; i < co->ncontours; i++)
+    {
+        hull->cont[i].pt = hull->cont[0].pt + n;
+        hull->cont[i].subglyph_id = src->cont[i].subglyph_id;
+        hull->cont[i].subglyph_order = src->cont[i].subglyph_order;
+        for (j = co->first[i]; j < co->first[i + 1]; j++)
+        {
+            hull->cont[0].pt[n].x = co->segs[j].p[0];
+            hull->cont[0].pt[n++].y = co->segs[j].p[1];
+            if (!co->segs[j].quad) continue;
+            hull->cont[0].pt[n].x = co->segs[j].c[0];
+            hull->cont[0].pt[n++].y = co->segs[j].c[1];
+        }
+        hull->cont[i].length = n - (int)(hull->cont[i].pt - hull->cont[0].pt);
+    }
+    hull->total_points = n;
+
+    for (i = 0; i < co->ncontours; i++)
+    {
+        const ttf_point_t *pt = hull->cont[i].pt;
+        int len = hull->cont[i].length;
+        float area = 0;
+        int nested_to;
+        bool filled_left;
+        if (len < 3) continue;
+        for (j = 0; j < len; j++)
+        {
+            const ttf_point_t *a = &pt[j];
+            const ttf_point_t *b = &pt[(j + 1) % len];
+            area += a->x * b->y - b->x * a->y;
+        }
+        filled_left = (area > 0) != !ttf_outline_contour_info_majority(hull, hull->cont[i].subglyph_order, i, &nested_to);
+        for (j = co->first[i]; j < co->first[i + 1]; j++)
+        {
+            curve_seg_t *s = &co->segs[j];
+            if (s->quad)
+                s->concave = (orient2d(s->p, curve_seg_end(co, j), s->c) > 0) == filled_left;
+        }
+    }
+    ttf_free_outline(hull);
+
+    /* the polygon goes along chords of convex curves and through control points of concave ones */
+    poly = allocate_ttf_outline(co->ncontours, co->nsegs * 2);
+    if (poly == NULL) return NULL;
+    for (i = 0, n = 0; i < co->ncontours; i++)
+    {
+        ttf_point_t *pt = poly->cont[0].pt + n;
+        int len = 0;
+        poly->cont[i].pt = pt;
+        poly->cont[i].subglyph_id = src->cont[i].subglyph_id;
+        poly->cont[i].subglyph_order = src->cont[i].subglyph_order;
+        for (j = co->first[i]; j < co->first[i + 1]; j++)
+        {
+            pt[len].x = co->segs[j].p[0];
+            pt[len].y = co->segs[j].p[1];
+            pt[len++].onc = 1;
+            if (!co->segs[j].concave) continue;
+            pt[len].x = co->segs[j].c[0];
+            pt[len++].y = co->segs[j].c[1];
+        }
+        len = ttf_fix_linear_bags(pt, len);
+        poly->cont[i].length = len;
+        n += len;
+    }
+    poly->total_points = n;
+    return poly;
+}
+
+int ttf_glyph2curvemesh(ttf_glyph_t *glyph, ttf_curvemesh_t **output, int features)
+{
+    const ttf_outline_t *o;
+    ttf_outline_t *poly, *temp;
+    curve_outline_t co;
+    mesher_t *mesh;
+    ttf_curvemesh_t *out;
+    mesh_writer_t w;
+    int i, res, nt, ne, ncurves;
+
+    *output = NULL;
+    if (!GLYPH_HAS_OUTLINE(glyph))
+        return TTF_ERR_NO_OUTLINE;
+    o = glyph_outline(glyph, &temp);
+    if (o == NULL)
+        return TTF_ERR_NOMEM;
+
+    /* Create the curve outline and the polygon to triangulate */
+    if (!create_curve_outline(o, &co))
+    {
+        ttf_free_outline(temp);
+        return TTF_ERR_NOMEM;
+    }
+    poly = NULL;
+    if (split_overlapped_curves(&co))
+        poly = curve_control_polygon(&co, o);
+    ttf_free_outline(temp);
+    if (poly == NULL)
+    {
+        mem_free(co.first);
+        return TTF_ERR_NOMEM;
+    }
+    if (poly->total_points < 3)
+    {
+        mem_free(co.first);
+        ttf_free_outline(poly);
+        return TTF_ERR_NO_OUTLINE;
+    }
+
+    /* Triangulate the polygon */
+    mesh = create_mesher(poly);
+    if (mesh == NULL)
+    {
+        mem_free(co.first);
+        ttf_free_outline(poly);
+        return TTF_ERR_NOMEM;
+    }
+    res = mesher(mesh, 128);
+    if (res == MESHER_ABORT || res == MESHER_FAIL || (res == MESHER_WARN && (features & TTF_FEATURE_IGN_ERR) == 0))
+    {
+        mem_free(co.first);
+        ttf_free_outline(poly);
+        free_mesher(mesh);
+        return res == MESHER_ABORT ? TTF_ERR_BUDGET : TTF_ERR_MESHER;
+    }
+    count_mesher_output(mesh, &nt, &ne);
+    ncurves = 0;
+    for (i = 0; i < co.nsegs; i++)
+        ncurves += co.segs[i].quad;
+
+    /* Create output object */
+    out = (ttf_curvemesh_t *)mem_calloc(
+        sizeof(ttf_curvemesh_t) +
+        (mesh->nv + ncurves * 3) * (sizeof(*out->vert) + sizeof(*out->coef)) +
+        (nt + ncurves) * sizeof(*out->faces), 1);
+    if (out == NULL)
+    {
+        mem_free(co.first);
+        ttf_free_outline(poly);
+        free_mesher(mesh);
+        return TTF_ERR_NOMEM;
+    }
+    out->nvert = mesh->nv + ncurves * 3;
+    out->ncurves = ncurves;
+    out->outline = poly;
+    *(void **)&out->vert = out + 1;
+    *(void **)&out->coef = &out->vert[out->nvert];
+    *(void **)&out->faces = &out->coef[out->nvert];
+
+    /* The solid triangles */
+    memset(&w, 0, sizeof(w));
+    w.vert = (uint8_t *)out->vert;
+    w.vert_stride = sizeof(*out->vert);
+    w.vert_dim = 2;
+    w.faces = (uint8_t *)out->faces;
+    w.face_stride = sizeof(*out->faces);
+    out->nfaces = emit_mesh2d(mesh, &w);
+    for (i = 0; i < mesh->nv; i++)
+    {
+        out->coef[i].u = 0;
+        out->coef[i].v = 1;
+        out->coef[i].s = 1;
+    }
+
+    /* The curve triangles with (0, 0), (1/2, 0), (1, 1) coordinates */
+    int nv = mesh->nv;
+    for (i = 0; i < co.nsegs; i++)
+    {
+        const curve_seg_t *seg = &co.segs[i];
+        const float *pts[3];
+        if (!seg->quad) continue;
+        pts[0] = seg->p;
+        pts[1] = seg->c;
+        pts[2] = curve_seg_end(&co, i);
+        for (int k = 0; k < 3; k++)
+        {
+            out->vert[nv + k].x = pts[k][0];
+            out->vert[nv + k].y = pts[k][1];
+            out->coef[nv + k].u = k * 0.5f;
+            out->coef[nv + k].v = k == 2 ? 1.0f : 0.0f;
+            out->coef[nv + k].s = seg->concave ? -1.0f : 1.0f;
+        }
+        out->faces[out->nfaces].v1 = nv;
+        if (orient2d(pts[0], pts[1], pts[2]) > 0)
+        {
+            out->faces[out->nfaces].v2 = nv + 1;
+            out->faces[out->nfaces].v3 = nv + 2;
+        }
+        else
+        {
+            out->faces[out->nfaces].v2 = nv + 2;
+            out->faces[out->nfaces].v3 = nv + 1;
+        }
+        out->nfaces++;
+        nv += 3;
+    }
+
+    mem_free(co.first);
+    free_mesher(mesh);
+    *output = out;
+    return TTF_DONE;
+}
+
+bool ttf_curvemesh_contains(const ttf_curvemesh_t *mesh, float x, float y)
+{
+    int first_curve = mesh->nfaces - mesh->ncurves;
+    for (int i = 0; i < mesh->nfaces; i++)
+    {
+        int i1 = mesh->faces[i].v1;
+        int i2 = mesh->faces[i].v2;
+        int i3 = mesh->faces[i].v3;
+        float d = (mesh->vert[i2].y - mesh->vert[i3].y) * (mesh->vert[i1].x - mesh->vert[i3].x) +
+                  (mesh->vert[i3].x - mesh->vert[i2].x) * (mesh->vert[i1].y - mesh->vert[i3].y);
+        float a, b, c;
+        if (fabsf(d) < 1e-12f) continue;
+        a = ((mesh->vert[i2].y - mesh->vert[i3].y) * (x - mesh->vert[i3].x) +
+             (mesh->vert[i3].x - mesh->vert[i2].x) * (y - mesh->vert[i3].y)) / d;
+        b = ((mesh->vert[i3].y - mesh->vert[i1].y) * (x - mesh->vert[i3].x) +
+             (mesh->vert[i1].x - mesh->vert[i3].x) * (y - mesh->vert[i3].y)) / d;
+        c = 1.0f - a - b;
+        /* the tolerance closes the rounding gaps between neighbour triangles */
+        if (a < -1e-5f || b < -1e-5f || c < -1e-5f) continue;
+        if (i < first_curve) return true;
+        /* the implicit form of quadratic curve: s * (u^2 - v) <= 0 is filled */
+        float u = a * mesh->coef[i1].u + b * mesh->coef[i2].u + c * mesh->coef[i3].u;
+        float v = a * mesh->coef[i1].v + b * mesh->coef[i2].v + c * mesh->coef[i3].v;
+        if (mesh->coef[i1].s * (u * u - v) <= 0) return true;
+    }
+    return false;
+}
+
+/******************************************************************************/
+/******************************************************************************/
+/******************************************************************************/
+/******************************************************************************/
+/************************************ END *************************************/
+/*********************************** MESHER ***********************************/
+/******************************************************************************/
+/******************************************************************************/
+/******************************************************************************/
+/******************************************************************************/
+
+/* Vertex cache optimization, T. Forsyth "Linear-Speed Vertex Cache Optimisation" */
+
+#define VCACHE_SIZE 32
+#define VCACHE_FIFO_SIZE 16       /* FIFO cache size to check the result */
+
+typedef struct vcache_opt
+{
+    int *valence;                 /* number of the not emitted triangles of vertex */
+    int *offset;                  /* first item of vertex in tris array */
+    int *tris;                    /* triangles of vertices */
+    int *pos;                     /* position of vertex in cache or -1 */
+    float *vscore;                /* vertex score */
+    float *tscore;                /* triangle score */
+    bool *emitted;                /* triangle was emitted flag */
+} vcache_opt_t;
+
+static float vcache_vertex_score(int pos, int valence)
+{
+    float score;
+    if (valence == 0) return -1.0f;
+    if (pos < 0)
+        score = 0.0f;
+    else
+    if (pos < 3)
+        score = 0.75f;
+    else
+    {
+        score = 1.0f - (float)(pos - 3) / (VCACHE_SIZE - 3);
+        score = score * sqrtf(score);
+    }
+    return score + 2.0f / sqrtf((float)valence);
+}
+
+/**
+ * @brief Number of the vertex cache misses of the triangle list
+ * @param stamp Temporary array with length of maximal vertex index + 1
+ */
+static int vcache_misses(const int *faces, int nfaces, int cache_size, int *stamp, int nvert)
+{
+    int i, misses;
+    for (i = 0; i < nvert; i++)
+        stamp[i] = -cache_size;
+
+    /* FIFO cache: vertex is cached if it was loaded less than cache_size misses ago */
+    misses = 0;
+    for (i = 0; i < nfaces * 3; i++)
+    {
+        int v = faces[i];
+        if (misses - stamp[v] >= cache_size)
+            stamp[v] = ++misses;
+    }
+    return misses;
+}
+
+/**
+ * @brief Reordering of the faces for the post-transform vertex cache
+ * @return false if no memory
+ *
+ * The scores are tuned for LRU cache, the small meshes can get more
+ * misses of FIFO cache after reordering. The original order of faces
+ * is kept in this case.
+ */
+static bool optimize_faces(int *faces, int nfaces, int nvert)
+{
+    vcache_opt_t o;
+    int cache[VCACHE_SIZE + 3];
+    int ncache, i, j, k, cursor, best;
+    int *result;
+    void *mem;
+
+    if (nfaces == 0) return true;
+    mem = mem_calloc(1,
+        nvert * sizeof(int) * 3 +        /* valence, offset, pos */
+        nvert * sizeof(float) +          /* vscore */
+        nfaces * 3 * sizeof(int) * 2 +   /* tris, result */
+        nfaces * sizeof(float) +         /* tscore */
+        nfaces * sizeof(bool));          /* emitted */
+    if (mem == NULL) return false;
+    o.valence = (int *)mem;
+    o.offset = o.valence + nvert;
+    o.pos = o.offset + nvert;
+    o.tris = o.pos + nvert;
+    result = o.tris + nfaces * 3;
+    o.vscore = (float *)(result + nfaces * 3);
+    o.tscore = o.vscore + nvert;
+    o.emitted = (bool *)(o.tscore + nfaces);
+
+    /* triangles of every vertex */
+    for (i = 0; i < nfaces * 3; i++)
+        o.valence[faces[i]]++;
+    for (i = 0, k = 0; i < nvert; i++)
+    {
+        o.offset[i] = k;
+        k += o.valence[i];
+        o.valence[i] = 0;
+    }
+    for (i = 0; i < nfaces * 3; i++)
+    {
+        int v = faces[i];
+        o.tris[o.offset[v] + o.valence[v]++] = i / 3;
+    }
+
+    /* initial scores */
+    for (i = 0; i < nvert; i++)
+    {
+        o.pos[i] = -1;
+        o.vscore[i] = vcache_vertex_score(-1, o.valence[i]);
+    }
+    best = 0;
+    for (i = 0; i < nfaces; i++)
+    {
+        o.tscore[i] = o.vscore[faces[i * 3]] + o.vscore[faces[i * 3 + 1]] + o.vscore[faces[i * 3 + 2]];
+        if (o.tscore[i] > o.tscore[best]) best = i;
+    }
+
+    ncache = 0;
+    cursor = 0;
+    for (i = 0; i < nfaces; i++)
+    {
+        int *t;
+        int nc;
+        int tmp[VCACHE_SIZE + 3];
+
+        /* the best triangle was not found in the cache */
+        if (best < 0)
+        {
+            while (o.emitted[cursor]) cursor++;
+            best = cursor;
+        }
+
+        /* emit triangle */
+        t = faces + best * 3;
+        result[i * 3 + 0] = t[0];
+        result[i * 3 + 1] = t[1];
+        result[i * 3 + 2] = t[2];
+        o.emitted[best] = true;
+
+        /* remove it from the triangle lists of vertices */
+        for (j = 0; j < 3; j++)
+        {
+            int *list = o.tris + o.offset[t[j]];
+            int n = o.valence[t[j]];
+            for (k = 0; k < n; k++)
+                if (list[k] == best)
+                {
+                    list[k] = list[n - 1];
+                    break;
+                }
+            o.valence[t[j]]--;
+        }
+
+        /* move triangle vertices to the cache top */
+        tmp[0] = t[0];
+        tmp[1] = t[1];
+        tmp[2] = t[2];
+        nc = 3;
+        for (j = 0; j < ncache; j++)
+            if (cache[j] != t[0] && cache[j] != t[1] && cache[j] != t[2])
+                tmp[nc++] = cache[j];
+        for (j = 0; j < nc; j++)
+        {
+            cache[j] = tmp[j];
+            o.pos[tmp[j]] = j < VCACHE_SIZE ? j : -1;
+        }
+        ncache = nc > VCACHE_SIZE ? VCACHE_SIZE : nc;
+
+        /* update scores of cached vertices and their triangles */
+        for (j = 0; j < nc; j++)
+        {
+            int v = cache[j];
+            o.vscore[v] = vcache_vertex_score(o.pos[v], o.valence[v]);
+        }
+        best = -1;
+        for (j = 0; j < nc; j++)
+        {
+            int v = cache[j];
+            int *list = o.tris + o.offset[v];
+            for (k = 0; k < o.valence[v]; k++)
+            {
+                int tri = list[k];
+                int *tv = faces + tri * 3;
+                o.tscore[tri] = o.vscore[tv[0]] + o.vscore[tv[1]] + o.vscore[tv[2]];
+                if (best < 0 || o.tscore[tri] > o.tscore[best])
+                    best = tri;
+            }
+        }
+    }
+
+    /* the positions in cache are not needed anymore */
+    if (vcache_misses(result, nfaces, VCACHE_FIFO_SIZE, o.pos, nvert) <
+        vcache_misses(faces, nfaces, VCACHE_FIFO_SIZE, o.pos, nvert))
+        memcpy(faces, result, nfaces * 3 * sizeof(int));
+    mem_free(mem);
+    return true;
+}
+
+/**
+ * @brief Renumbering of vertices in order of the first use by faces
+ * @param remap Output array of new indices of vertices with nvert length
+ */
+static void optimize_fetch(int *faces, int nfaces, int nvert, int *remap)
+{
+    int i, next;
+    for (i = 0; i < nvert; i++)
+        remap[i] = -1;
+    next = 0;
+    for (i = 0; i < nfaces * 3; i++)
+    {
+        if (remap[faces[i]] < 0)
+            remap[faces[i]] = next++;
+        faces[i] = remap[faces[i]];
+    }
+    for (i = 0; i < nvert; i++)
+        if (remap[i] < 0)
+            remap[i] = next++;
+}
+
+/**
+ * @brief Moving of array elements to the remap positions
+ */
+static void permute_array(void *data, int count, int size, const int *remap, void *temp)
+{
+    int i;
+    for (i = 0; i < count; i++)
+        memcpy((char *)temp + (size_t)remap[i] * size, (char *)data + (size_t)i * size, size);
+    memcpy(data, temp, (size_t)count * size);
+}
+
+int ttf_mesh_optimize(ttf_mesh_t *mesh)
+{
+    int *remap;
+    if (!optimize_faces(&mesh->faces[0].v1, mesh->nfaces, mesh->nvert))
+        return TTF_ERR_NOMEM;
+    remap = (int *)mem_alloc(mesh->nvert * (sizeof(int) + sizeof(*mesh->vert)) + 1);
+    if (remap == NULL) return TTF_ERR_NOMEM;
+    optimize_fetch(&mesh->faces[0].v1, mesh->nfaces, mesh->nvert, remap);
+    permute_array(mesh->vert, mesh->nvert, sizeof(*mesh->vert), remap, remap + mesh->nvert);
+    mem_free(remap);
+    return TTF_DONE;
+}
+
+int ttf_mesh3d_optimize(ttf_mesh3d_t *mesh)
+{
+    int *remap;
+    if (!optimize_faces(&mesh->faces[0].v1, mesh->nfaces, mesh->nvert))
+        return TTF_ERR_NOMEM;
+    remap = (int *)mem_alloc(mesh->nvert * (sizeof(int) + sizeof(*mesh->vert)) + 1);
+    if (remap == NULL) return TTF_ERR_NOMEM;
+    optimize_fetch(&mesh->faces[0].v1, mesh->nfaces, mesh->nvert, remap);
+    permute_array(mesh->vert, mesh->nvert, sizeof(*mesh->vert), remap, remap + mesh->nvert);
+    permute_array(mesh->normals, mesh->nvert, sizeof(*mesh->normals), remap, remap + mesh->nvert);
+    mem_free(remap);
+    return TTF_DONE;
+}
+
+int ttf_mesh_acmr(const int *faces, int nfaces, int cache_size, float *acmr)
+{
+    int i, nvert, misses;
+    int *stamp;
+
+    *acmr = 0;
+    if (nfaces <= 0) return TTF_DONE;
+    if (cache_size < 3) cache_size = 3;
+
+    nvert = 0;
+    for (i = 0; i < nfaces * 3; i++)
+        if (faces[i] >= nvert)
+            nvert = faces[i] + 1;
+    stamp = (int *)mem_alloc(nvert * sizeof(int));
+    if (stamp == NULL) return TTF_ERR_NOMEM;
+    misses = vcache_misses(faces, nfaces, cache_size, stamp, nvert);
+    mem_free(stamp);
+    *acmr = (float)misses / nfaces;
+    return TTF_DONE;
+}
+
+/******************************************************************************/
+/******************************************************************************/
+/******************************************************************************/
+/******************************************************************************/
+/********************************* RASTERIZER *********************************/
+/******************************************************************************/
+/******************************************************************************/
+/******************************************************************************/
+/******************************************************************************/
+
+/* Signed area accumulation rasterizer. Every line adds the signed */
+/* coverage differences to the accumulation buffer, the running sum */
+/* of the row gives the pixel coverage (see R. Levien, font-rs). */
+
+typedef struct raster
+{
+    float *acc;                   /* accumulation buffer, height rows of pitch floats */
+    int pitch;                    /* row length, width + 2 */
+    int width;                    /* bitmap width in pixels */
+    int height;                   /* bitmap height in pixels */
+    float scale;                  /* pixels per EM */
+    float dx;                     /* glyph origin in the bitmap */
+    float dy;
+} raster_t;
+
+static void raster_line(raster_t *r, const float *p0, const float *p1)
+{
+    float x0 = p0[0], y0 = p0[1];
+    float x1 = p1[0], y1 = p1[1];
+    float dir, dxdy, x;
+    int y, yend;
+
+    if (y0 == y1) return;
+    if (y0 < y1)
+        dir = 1.0f;
+    else
+    {
+        dir = -1.0f;
+        SWAP(float, x0, x1);
+        SWAP(float, y0, y1);
+    }
+    dxdy = (x1 - x0) / (y1 - y0);
+    x = x0;
+    if (y0 < 0.0f)
+    {
+        x -= y0 * dxdy;
+        y0 = 0.0f;
+    }
+    if (y1 > r->height) y1 = (float)r->height;
+    yend = (int)ceilf(y1);
+
+    for (y = (int)y0; y < yend; y++)
+    {
+        float *row = r->acc + y * r->pitch;
+        float dy = ((float)(y + 1) < y1 ? (float)(y + 1) : y1) - ((float)y > y0 ? (float)y : y0);
+        float xnext = x + dxdy * dy;
+        float d = dy * dir;
+        float xa = x < xnext ? x : xnext;
+        float xb = x < xnext ? xnext : x;
+        int ia, ib;
+        if (xa < 0.0f) xa = 0.0f;
+        if (xb > r->width) xb = (float)r->width;
+        if (xa > xb) xa = xb;
+        ia = (int)xa;
+        ib = (int)ceilf(xb);
+        if (ib <= ia + 1)
+        {
+            /* the line is inside one pixel column */
+            float xm = 0.5f * (xa + xb) - ia;
+            row[ia] += d - d * xm;
+            row[ia + 1] += d * xm;
+        }
+        else
+        {
+            float s = 1.0f / (xb - xa);
+            float fa = xa - ia;
+            float a0 = 0.5f * s * (1.0f - fa) * (1.0f - fa);
+            float fb = xb - ib + 1.0f;
+            float am = 0.5f * s * fb * fb;
+            row[ia] += d * a0;
+            if (ib == ia + 2)
+                row[ia + 1] += d * (1.0f - a0 - am);
+            else
+            {
+                float a1 = s * (1.5f - fa);
+                float a2;
+                int i;
+                row[ia + 1] += d * (a1 - a0);
+                for (i = ia + 2; i < ib - 1; i++)
+                    row[i] += d * s;
+                a2 = a1 + (ib - ia - 3) * s;
+                row[ib - 1] += d * (1.0f - a2 - am);
+            }
+            row[ib] += d * am;
+        }
+        x = xnext;
+    }
+}
+
+static void raster_quad(raster_t *r, const float *p0, const float *p1, const float *p2)
+{
+    float ddx = p0[0] - 2.0f * p1[0] + p2[0];
+    float ddy = p0[1] - 2.0f * p1[1] + p2[1];
+    float dev = ddx * ddx + ddy * ddy;
+    float prev[2], next[2];
+    int i, n;
+
+    if (dev < 0.333f)
+    {
+        raster_line(r, p0, p2);
+        return;
+    }
+    /* number of segments for the flattening error less than 1/8 pixel */
+    n = 1 + (int)sqrtf(sqrtf(3.0f * dev));
+    prev[0] = p0[0];
+    prev[1] = p0[1];
+    for (i = 1; i <= n; i++)
+    {
+        float t = (float)i / n;
+        float a = (1.0f - t) * (1.0f - t);
+        float b = 2.0f * t * (1.0f - t);
+        float c = t * t;
+        next[0] = a * p0[0] + b * p1[0] + c * p2[0];
+        next[1] = a * p0[1] + b * p1[1] + c * p2[1];
+        raster_line(r, prev, next);
+        prev[0] = next[0];
+        prev[1] = next[1];
+    }
+}
+
+static __inline void raster_point(const raster_t *r, const ttf_point_t *p, float *res)
+{
+    res[0] = p->x * r->scale + r->dx;
+    res[1] = r->dy - p->y * r->scale;
+}
+
+/* Segment callback of raster_contour, c is NULL for the line segment */
+typedef void (*raster_seg_fn)(void *ctx, const float *p0, const float *c, const float *p1);
+
+/**
+ * @brief Walking of contour of quadratic outline in the raster coordinates
+ *
+ * The implied on-curve points between two off-curve points are used
+ * as the curve ends. The contour of all off-curve points is started
+ * at the implied point.
+ */
+static void raster_contour(const raster_t *r, const ttf_point_t *pt, int len, raster_seg_fn fn, void *ctx)
+{
+    float start[2], curr[2], ctrl[2], p[2];
+    bool has_ctrl;
+    int first, count, i;
+
+    if (len < 2) return;
+    for (first = 0; first < len && !pt[first].onc; first++);
+    if (first < len)
+    {
+        raster_point(r, &pt[first], start);
+        count = len - 1;
+        first++;
+    }
+    else
+    {
+        float a[2], b[2];
+        raster_point(r, &pt[len - 1], a);
+        raster_point(r, &pt[0], b);
+        start[0] = (a[0] + b[0]) * 0.5f;
+        start[1] = (a[1] + b[1]) * 0.5f;
+        count = len;
+        first = 0;
+    }
+
+    curr[0] = start[0];
+    curr[1] = start[1];
+    has_ctrl = false;
+    for (i = 0; i < count; i++)
+    {
+        const ttf_point_t *src = &pt[(first + i) % len];
+        raster_point(r, src, p);
+        if (src->onc)
+        {
+            if (has_ctrl)
+                fn(ctx, curr, ctrl, p); else
+                fn(ctx, curr, NULL, p);
+            has_ctrl = false;
+            curr[0] = p[0];
+            curr[1] = p[1];
+            continue;
+        }
+        if (has_ctrl)
+        {
+            float m[2];
+            m[0] = (ctrl[0] + p[0]) * 0.5f;
+            m[1] = (ctrl[1] + p[1]) * 0.5f;
+            fn(ctx, curr, ctrl, m);
+            curr[0] = m[0];
+            curr[1] = m[1];
+        }
+        ctrl[0] = p[0];
+        ctrl[1] = p[1];
+        has_ctrl = true;
+    }
+    if (has_ctrl)
+        fn(ctx, curr, ctrl, start); else
+        fn(ctx, curr, NULL, start);
+}
+
+static void raster_seg(void *ctx, const float *p0, const float *c, const float *p1)
+{
+    if (c == NULL)
+        raster_line((raster_t *)ctx, p0, p1); else
+        raster_quad((raster_t *)ctx, p0, c, p1);
+}
+
+/**
+ * @brief Converting of accumulation buffer row to 8-bit coverage
+ */
+static void raster_accumulate(const float *acc, uint8_t *dst, int width)
+{
+    float sum = 0.0f;
+    int x = 0;
+#if defined(TTF_SSE2)
+    const __m128 mask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 k255 = _mm_set1_ps(255.0f);
+    __m128 offset = _mm_setzero_ps();
+    for (; x + 4 <= width; x += 4)
+    {
+        /* prefix sum of 4 items plus the sum of previous items */
+        __m128 v = _mm_loadu_ps(acc + x);
+        __m128i c;
+        int packed;
+        v = _mm_add_ps(v, _mm_castsi128_ps(_mm_slli_si128(_mm_castps_si128(v), 4)));
+        v = _mm_add_ps(v, _mm_castsi128_ps(_mm_slli_si128(_mm_castps_si128(v), 8)));
+        v = _mm_add_ps(v, offset);
+        offset = _mm_shuffle_ps(v, v, _MM_SHUFFLE(3, 3, 3, 3));
+        v = _mm_min_ps(_mm_and_ps(v, mask), one);
+        c = _mm_cvtps_epi32(_mm_mul_ps(v, k255));
+        c = _mm_packs_epi32(c, c);
+        c = _mm_packus_epi16(c, c);
+        packed = _mm_cvtsi128_si32(c);
+        memcpy(dst + x, &packed, 4);
+    }
+    sum = _mm_cvtss_f32(offset);
+#endif
+    for (; x < width; x++)
+    {
+        float c;
+        sum += acc[x];
+        c = fabsf(sum);
+        c = c < 1.0f ? c : 1.0f;
+        dst[x] = (uint8_t)(c * 255.0f + 0.5f);
+    }
+}
+
+void ttf_glyph_bitmap_box(const ttf_glyph_t *glyph, float scale, const float offset[2], int box[4])
+{
+    const ttf_outline_t *o = glyph->outline;
+    const ttf_qoutline_t *q = glyph->qoutline;
+    float ox = offset == NULL ? 0.0f : offset[0];
+    float oy = offset == NULL ? 0.0f : offset[1];
+    ttf_outline_t *temp = NULL;
+    float xmin, xmax, ymin, ymax;
+    int i;
+
+    box[0] = box[1] = box[2] = box[3] = 0;
+    if (o == NULL && q == NULL && GLYPH_HAS_OUTLINE(glyph))
+        o = glyph_outline(glyph, &temp);
+    if (o != NULL && o->total_points != 0)
+    {
+        xmin = xmax = o->cont[0].pt[0].x;
+        ymin = ymax = o->cont[0].pt[0].y;
+        for (i = 0; i < o->ncontours; i++)
+            for (int j = 0; j < o->cont[i].length; j++)
+            {
+                const ttf_point_t *p = &o->cont[i].pt[j];
+                if (p->x < xmin) xmin = p->x;
+                if (p->x > xmax) xmax = p->x;
+                if (p->y < ymin) ymin = p->y;
+                if (p->y > ymax) ymax = p->y;
+            }
+        ttf_free_outline(temp);
+    }
+    else
+    if (o == NULL && q != NULL && q->total_points != 0)
+    {
+        /* the quantized outline bounds are scaled to em at the end */
+        int b[4] = {q->pt[0][0], q->pt[0][0], q->pt[0][1], q->pt[0][1]};
+        for (i = 1; i < q->total_points; i++)
+        {
+            if (q->pt[i][0] < b[0]) b[0] = q->pt[i][0];
+            if (q->pt[i][0] > b[1]) b[1] = q->pt[i][0];
+            if (q->pt[i][1] < b[2]) b[2] = q->pt[i][1];
+            if (q->pt[i][1] > b[3]) b[3] = q->pt[i][1];
+        }
+        xmin = b[0] * q->scale;
+        xmax = b[1] * q->scale;
+        ymin = b[2] * q->scale;
+        ymax = b[3] * q->scale;
+    }
+    else
+        return;
+    box[0] = (int)floorf(xmin * scale + ox);
+    box[1] = (int)ceilf(ymax * scale + oy);
+    box[2] = (int)ceilf(xmax * scale + ox) - box[0];
+    box[3] = box[1] - (int)floorf(ymin * scale + oy);
+}
+
+int ttf_glyph2bitmap(ttf_glyph_t *glyph, float scale, const float offset[2], uint8_t *buffer, int stride)
+{
+    raster_t r;
+    const ttf_outline_t *o;
+    ttf_outline_t *temp;
+    int box[4], i, y;
+
+    if (!GLYPH_HAS_OUTLINE(glyph))
+        return TTF_ERR_NO_OUTLINE;
+    ttf_glyph_bitmap_box(glyph, scale, offset, box);
+    if (stride < box[2])
+        return TTF_ERR_BUFSIZE;
+    if (box[2] == 0 || box[3] == 0)
+        return TTF_DONE;
+
+    r.width = box[2];
+    r.height = box[3];
+    r.pitch = box[2] + 2;
+    r.scale = scale;
+    r.dx = (offset == NULL ? 0.0f : offset[0]) - box[0];
+    r.dy = box[1] - (offset == NULL ? 0.0f : offset[1]);
+    r.acc = (float *)mem_calloc((size_t)r.pitch * r.height, sizeof(float));
+    if (r.acc == NULL)
+        return TTF_ERR_NOMEM;
+    o = glyph_outline(glyph, &temp);
+    if (o == NULL)
+    {
+        mem_free(r.acc);
+        return TTF_ERR_NOMEM;
+    }
+
+    for (i = 0; i < o->ncontours; i++)
+        raster_contour(&r, o->cont[i].pt, o->cont[i].length, raster_seg, &r);
+    for (y = 0; y < r.height; y++)
+        raster_accumulate(r.acc + y * r.pitch, buffer + (size_t)y * stride, r.width);
+
+    ttf_free_outline(temp);
+    mem_free(r.acc);
+    return TTF_DONE;
+}
+
+/* Signed distance field atlas. The work is split to tiles of SDF_TILE */
+/* rows of glyph rectangles, the tiles are processed by the threads. */
+
+#define SDF_TILE 32
+#define SDF_CELL 8
+
+typedef struct sdf_seg
+{
+    float p[3][2];                /* start, control and end points */
+    bool quad;                    /* false for the line segment */
+} sdf_seg_t;
+
+typedef struct sdf_segs
+{
+    sdf_seg_t *seg;
+    int count;
+} sdf_segs_t;
+
+typedef struct sdf_job
+{
+    ttf_t *ttf;
+    ttf_atlas_t *atlas;
+    int flags;
+    int *tile_glyph;              /* glyph rectangle of the tile */
+    int *tile_row;                /* first row of the tile */
+    int ntiles;
+    volatile long next;           /* next tile to process */
+    volatile int error;
+} sdf_job_t;
+
+#if defined(TTF_NO_THREADS)
+#   define SDF_NEXT_TILE(job) ((job)->next++)
+#elif defined(TTF_WINDOWS)
+#   define SDF_NEXT_TILE(job) (InterlockedIncrement(&(job)->next) - 1)
+#else
+#   define SDF_NEXT_TILE(job) __sync_fetch_and_add(&(job)->next, 1)
+#endif
+
+/**
+ * @brief Collecting of the contour segments, curves are splitted to y-monotone parts
+ */
+static void sdf_collect(void *ctx, const float *p0, const float *c, const float *p1)
+{
+    sdf_segs_t *segs = (sdf_segs_t *)ctx;
+    sdf_seg_t *s = &segs->seg[segs->count++];
+    float a, t;
+    s->p[0][0] = p0[0];
+    s->p[0][1] = p0[1];
+    s->p[2][0] = p1[0];
+    s->p[2][1] = p1[1];
+    s->quad = c != NULL && fabsf((c[0] - p0[0]) * (p1[1] - p0[1]) - (c[1] - p0[1]) * (p1[0] - p0[0])) > EPSILON;
+    if (!s->quad)
+    {
+        s->p[1][0] = (p0[0] + p1[0]) * 0.5f;
+        s->p[1][1] = (p0[1] + p1[1]) * 0.5f;
+        return;
+    }
+    s->p[1][0] = c[0];
+    s->p[1][1] = c[1];
+
+    /* y extremum inside of the curve */
+    a = p0[1] - 2.0f * c[1] + p1[1];
+    if (fabsf(a) < EPSILON) return;
+    t = (p0[1] - c[1]) / a;
+    if (t <= 0.0f || t >= 1.0f) return;
+    {
+        sdf_seg_t *n = &segs->seg[segs->count++];
+        float m0[2], m1[2], m[2];
+        m0[0] = p0[0] + (c[0] - p0[0]) * t;
+        m0[1] = p0[1] + (c[1] - p0[1]) * t;
+        m1[0] = c[0] + (p1[0] - c[0]) * t;
+        m1[1] = c[1] + (p1[1] - c[1]) * t;
+        m[0] = m0[0] + (m1[0] - m0[0]) * t;
+        m[1] = m0[1] + (m1[1] - m0[1]) * t;
+        *n = *s;
+        s->p[1][0] = m0[0];
+        s->p[1][1] = m0[1];
+        s->p[2][0] = m[0];
+        s->p[2][1] = m[1];
+        n->p[0][0] = m[0];
+        n->p[0][1] = m[1];
+        n->p[1][0] = m1[0];
+        n->p[1][1] = m1[1];
+    }
+}
+
+/**
+ * @brief Squared distance from point to segment
+ *
+ * The closest point of curve is the root of cubic equation
+ * d/dt |B(t) - p|^2 = 0, it is solved analytically.
+ */
+static float sdf_distance2(const sdf_seg_t *s, const float *p)
+{
+    double ax = s->p[1][0] - s->p[0][0], ay = s->p[1][1] - s->p[0][1];
+    double bx = s->p[0][0] - 2.0 * s->p[1][0] + s->p[2][0];
+    double by = s->p[0][1] - 2.0 * s->p[1][1] + s->p[2][1];
+    double dx = s->p[0][0] - p[0], dy = s->p[0][1] - p[1];
+    double bb = bx * bx + by * by;
+    double t[3], res;
+    int i, n;
+
+    if (!s->quad || bb < 1e-12)
+    {
+        /* line from p0 to p2 */
+        double lx = s->p[2][0] - s->p[0][0], ly = s->p[2][1] - s->p[0][1];
+        double ll = lx * lx + ly * ly;
+        double k = ll > 1e-12 ? -(dx * lx + dy * ly) / ll : 0.0;
+        k = k < 0.0 ? 0.0 : k > 1.0 ? 1.0 : k;
+        dx += lx * k;
+        dy += ly * k;
+        return (float)(dx * dx + dy * dy);
+    }
+
+    {
+        /* t^3 + 3 kx t^2 + 3 ky t + kz = 0 is reduced to the depressed cubic */
+        double kk = 1.0 / bb;
+        double kx = kk * (ax * bx + ay * by);
+        double ky = kk * (2.0 * (ax * ax + ay * ay) + dx * bx + dy * by) / 3.0;
+        double kz = kk * (dx * ax + dy * ay);
+        double pp = ky - kx * kx;
+        double q = kx * (2.0 * kx * kx - 3.0 * ky) + kz;
+        double h = q * q + 4.0 * pp * pp * pp;
+        if (h >= 0.0)
+        {
+            double u, v;
+            h = sqrt(h);
+            u = (h - q) * 0.5;
+            v = (-h - q) * 0.5;
+            u = u < 0.0 ? -pow(-u, 1.0 / 3.0) : pow(u, 1.0 / 3.0);
+            v = v < 0.0 ? -pow(-v, 1.0 / 3.0) : pow(v, 1.0 / 3.0);
+            t[0] = u + v - kx;
+            n = 1;
+        }
+        else
+        {
+            double z = sqrt(-pp);
+            double a = acos(q / (pp * z * 2.0)) / 3.0;
+            double m = cos(a);
+            double k = sin(a) * 1.732050808;
+            t[0] = (m + m) * z - kx;
+            t[1] = (-k - m) * z - kx;
+            t[2] = (k - m) * z - kx;
+            n = 3;
+        }
+    }
+
+    res = -1.0;
+    for (i = 0; i < n; i++)
+    {
+        double tt = t[i] < 0.0 ? 0.0 : t[i] > 1.0 ? 1.0 : t[i];
+        /* B(t) - p = d + 2 a t + b t^2 */
+        double ex = dx + (2.0 * ax + bx * tt) * tt;
+        double ey = dy + (2.0 * ay + by * tt) * tt;
+        double e = ex * ex + ey * ey;
+        if (res < 0.0 || e < res) res = e;
+    }
+    return (float)res;
+}
+
+/**
+ * @brief Crossing of y-monotone segment by horizontal line
+ * @return Winding direction 1 or -1, 0 if there is no crossing
+ */
+static int sdf_crossing(const sdf_seg_t *s, float y, float *x)
+{
+    float y0 = s->p[0][1];
+    float y2 = s->p[2][1];
+    float a, b, c, t;
+    if (!((y0 <= y && y < y2) || (y2 <= y && y < y0)))
+        return 0;
+    if (!s->quad)
+    {
+        t = (y - y0) / (y2 - y0);
+        *x = s->p[0][0] + (s->p[2][0] - s->p[0][0]) * t;
+        return y2 > y0 ? 1 : -1;
+    }
+    a = y0 - 2.0f * s->p[1][1] + y2;
+    b = 2.0f * (s->p[1][1] - y0);
+    c = y0 - y;
+    if (fabsf(a) < EPSILON)
+        t = -c / b;
+    else
+    {
+        float d = b * b - 4.0f * a * c;
+        float q, t1, t2;
+        q = -0.5f * (b + (b < 0.0f ? -1.0f : 1.0f) * sqrtf(d > 0.0f ? d : 0.0f));
+        t1 = q / a;
+        t2 = q != 0.0f ? c / q : t1;
+        t = fabsf(t1 - 0.5f) < fabsf(t2 - 0.5f) ? t1 : t2;
+    }
+    t = t < 0.0f ? 0.0f : t > 1.0f ? 1.0f : t;
+    *x = (1.0f - t) * (1.0f - t) * s->p[0][0] + 2.0f * t * (1.0f - t) * s->p[1][0] + t * t * s->p[2][0];
+    return y2 > y0 ? 1 : -1;
+}
+
+/**
+ * @brief Calculation of the atlas texels of one tile
+ * @return TTF_DONE or TTF_ERR_NOMEM
+ */
+static int sdf_tile(sdf_job_t *job, int tile)
+{
+    ttf_atlas_t *atlas = job->atlas;
+    const ttf_atlas_glyph_t *rect = &atlas->glyphs[job->tile_glyph[tile]];
+    ttf_outline_t *temp;
+    const ttf_outline_t *o = glyph_outline(&job->ttf->glyphs[rect->glyph], &temp);
+    int row0 = job->tile_row[tile];
+    int row1 = row0 + SDF_TILE < rect->h ? row0 + SDF_TILE : rect->h;
+    float range = atlas->range;
+    raster_t r;
+    sdf_segs_t segs;
+    int *cells, *items = NULL, gw, gh, maxsegs, i, x, y;
+    float *xs;
+    int *dirs;
+    void *mem;
+
+    if (o == NULL) return TTF_ERR_NOMEM;
+    maxsegs = (o->total_points + o->ncontours) * 2;
+    gw = (rect->w + SDF_CELL - 1) / SDF_CELL;
+    gh = (row1 - row0 + SDF_CELL - 1) / SDF_CELL;
+    mem = mem_alloc(maxsegs * (sizeof(sdf_seg_t) + sizeof(float) + sizeof(int)) +
+                 (gw * gh + 1) * sizeof(int));
+    if (mem == NULL)
+    {
+        ttf_free_outline(temp);
+        return TTF_ERR_NOMEM;
+    }
+    segs.seg = (sdf_seg_t *)mem;
+    segs.count = 0;
+    xs = (float *)(segs.seg + maxsegs);
+    dirs = (int *)(xs + maxsegs);
+    cells = dirs + maxsegs;
+
+    /* segments in the texel coordinates of glyph rectangle */
+    memset(&r, 0, sizeof(r));
+    r.scale = atlas->scale;
+    r.dx = (float)-rect->left;
+    r.dy = (float)rect->top;
+    for (i = 0; i < o->ncontours; i++)
+        raster_contour(&r, o->cont[i].pt, o->cont[i].length, sdf_collect, &segs);
+
+    /* grid of the tile cells with segments closer than range to the cell */
+    memset(cells, 0, (gw * gh + 1) * sizeof(int));
+    for (int pass = 0; pass < 2; pass++)
+    {
+        for (i = 0; i < segs.count; i++)
+        {
+            const sdf_seg_t *s = &segs.seg[i];
+            float bx0 = s->p[0][0], bx1 = s->p[0][0], by0 = s->p[0][1], by1 = s->p[0][1];
+            int cx0, cx1, cy0, cy1;
+            for (int k = 1; k < 3; k++)
+            {
+                if (s->p[k][0] < bx0) bx0 = s->p[k][0];
+                if (s->p[k][0] > bx1) bx1 = s->p[k][0];
+                if (s->p[k][1] < by0) by0 = s->p[k][1];
+                if (s->p[k][1] > by1) by1 = s->p[k][1];
+            }
+            cx0 = (int)floorf((bx0 - range) / SDF_CELL);
+            cx1 = (int)floorf((bx1 + range) / SDF_CELL);
+            cy0 = (int)floorf((by0 - range - row0) / SDF_CELL);
+            cy1 = (int)floorf((by1 + range - row0) / SDF_CELL);
+            if (cx0 < 0) cx0 = 0;
+            if (cy0 < 0) cy0 = 0;
+            if (cx1 >= gw) cx1 = gw - 1;
+            if (cy1 >= gh) cy1 = gh - 1;
+            for (y = cy0; y <= cy1; y++)
+                for (x = cx0; x <= cx1; x++)
+                    if (pass == 0)
+                        cells[y * gw + x + 1]++; else
+                        items[cells[y * gw + x]++] = i;
+        }
+        if (pass == 0)
+        {
+            /* cells[c] becomes the first item of cell c */
+            for (i = 0; i < gw * gh; i++)
+                cells[i + 1] += cells[i];
+            items = (int *)mem_alloc((cells[gw * gh] + 1) * sizeof(int));
+            if (items == NULL)
+            {
+                ttf_free_outline(temp);
+                mem_free(mem);
+                return TTF_ERR_NOMEM;
+            }
+        }
+    }
+    /* the second pass has moved cells[c] to the first item of cell c + 1 */
+    for (i = gw * gh; i > 0; i--)
+        cells[i] = cells[i - 1];
+    cells[0] = 0;
+
+    for (y = row0; y < row1; y++)
+    {
+        uint8_t *dst = atlas->pixels + (size_t)(rect->y + y) * atlas->width + rect->x;
+        float p[2];
+        int n = 0, k = 0, wind = 0;
+
+        /* crossings of the texel row center sorted by x */
+        p[1] = y + 0.5f;
+        for (i = 0; i < segs.count; i++)
+        {
+            float cx;
+            int dir = sdf_crossing(&segs.seg[i], p[1], &cx);
+            int j;
+            if (dir == 0) continue;
+            for (j = n; j > 0 && xs[j - 1] > cx; j--)
+            {
+                xs[j] = xs[j - 1];
+                dirs[j] = dirs[j - 1];
+            }
+            xs[j] = cx;
+            dirs[j] = dir;
+            n++;
+        }
+
+        for (x = 0; x < rect->w; x++)
+        {
+            const int *cell = cells + ((y - row0) / SDF_CELL) * gw + x / SDF_CELL;
+            float d2 = range * range;
+            float d;
+            bool inside;
+            p[0] = x + 0.5f;
+            for (; k < n && xs[k] < p[0]; k++)
+                wind += dirs[k];
+            inside = (job->flags & TTF_SDF_EVENODD) ? (k & 1) != 0 : wind != 0;
+            for (i = cell[0]; i < cell[1]; i++)
+            {
+                float e = sdf_distance2(&segs.seg[items[i]], p);
+                if (e < d2) d2 = e;
+            }
+            d = sqrtf(d2) / range * 0.5f;
+            d = inside ? 0.5f + d : 0.5f - d;
+            dst[x] = (uint8_t)(d * 255.0f + 0.5f);
+        }
+    }
+
+    ttf_free_outline(temp);
+    mem_free(items);
+    mem_free(mem);
+    return TTF_DONE;
+}
+
+#if defined(TTF_WINDOWS) && !defined(TTF_NO_THREADS)
+static DWORD WINAPI sdf_worker(LPVOID arg)
+#else
+static void *sdf_worker(void *arg)
+#endif
+{
+    sdf_job_t *job = (sdf_job_t *)arg;
+    for (;;)
+    {
+        long tile = SDF_NEXT_TILE(job);
+        if (tile >= job->ntiles) break;
+        if (sdf_tile(job, (int)tile) != TTF_DONE)
+            job->error = TTF_ERR_NOMEM;
+    }
+    return 0;
+}
+
+/**
+ * @brief Running of the SDF workers, the calling thread is one of them
+ */
+static void sdf_run(sdf_job_t *job, int threads)
+{
+#if defined(TTF_NO_THREADS)
+    (void)threads;
+    sdf_worker(job);
+#else
+#   if defined(TTF_WINDOWS)
+    HANDLE handles[TTF_MAX_THREADS];
+#   else
+    pthread_t handles[TTF_MAX_THREADS];
+#   endif
+    int i, started = 0;
+    if (threads <= 0)
+    {
+#   if defined(TTF_WINDOWS)
+        SYSTEM_INFO info;
+        GetSystemInfo(&info);
+        threads = (int)info.dwNumberOfProcessors;
+#   else
+        threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+#   endif
+    }
+    if (threads > job->ntiles) threads = job->ntiles;
+    if (threads > TTF_MAX_THREADS) threads = TTF_MAX_THREADS;
+    for (i = 1; i < threads; i++)
+    {
+#   if defined(TTF_WINDOWS)
+        handles[started] = CreateThread(NULL, 0, sdf_worker, job, 0, NULL);
+        if (handles[started] == NULL) break;
+#   else
+        if (pthread_create(&handles[started], NULL, sdf_worker, job) != 0) break;
+#   endif
+        started++;
+    }
+    sdf_worker(job);
+    for (i = 0; i < started; i++)
+    {
+#   if defined(TTF_WINDOWS)
+        WaitForSingleObject(handles[i], INFINITE);
+        CloseHandle(handles[i]);
+#   else
+        pthread_join(handles[i], NULL);
+#   endif
+    }
+#endif
+}
+
+static int compare_rect_heights(const void *a, const void *b)
+{
+    const int *ia = (const int *)a;
+    const int *ib = (const int *)b;
+    if (ia[0] != ib[0]) return ib[0] - ia[0];
+    return ia[1] - ib[1];
+}
+
+int ttf_glyphs2sdf(ttf_t *ttf, const int *glyphs, int count, float scale, float range,
+                   int width, int flags, int threads, ttf_atlas_t **output)
+{
+    ttf_atlas_glyph_t *rects;
+    ttf_atlas_t *atlas;
+    sdf_job_t job;
+    int *order, pad, i, x, y, shelf, height, ntiles;
+    double area;
+
+    *output = NULL;
+    if (count < 0 || scale <= 0.0f || range <= 0.0f)
+        return TTF_ERR_ARG;
+    for (i = 0; i < count; i++)
+        if (glyphs[i] < 0 || glyphs[i] >= ttf->nglyphs)
+            return TTF_ERR_NO_OUTLINE;
+
+    /* Glyph rectangles with the padding of range */
+    pad = (int)ceilf(range);
+    rects = (ttf_atlas_glyph_t *)mem_calloc(count + 1, sizeof(*rects));
+    order = (int *)mem_alloc((count + 1) * 2 * sizeof(int));
+    if (rects == NULL || order == NULL)
+    {
+        mem_free(rects);
+        mem_free(order);
+        return TTF_ERR_NOMEM;
+    }
+    area = 0;
+    for (i = 0; i < count; i++)
+    {
+        int box[4];
+        rects[i].glyph = glyphs[i];
+        ttf_glyph_bitmap_box(&ttf->glyphs[glyphs[i]], scale, NULL, box);
+        if (box[2] > 0 && box[3] > 0)
+        {
+            rects[i].left = box[0] - pad;
+            rects[i].top = box[1] + pad;
+            rects[i].w = box[2] + pad * 2;
+            rects[i].h = box[3] + pad * 2;
+        }
+        if (width > 0 && rects[i].w > width)
+        {
+            mem_free(rects);
+            mem_free(order);
+            return TTF_ERR_BUFSIZE;
+        }
+        area += (double)rects[i].w * rects[i].h;
+        order[i * 2 + 0] = rects[i].h;
+        order[i * 2 + 1] = i;
+    }
+    if (width <= 0)
+    {
+        width = (int)ceil(sqrt(area * 1.1));
+        for (i = 0; i < count; i++)
+            if (rects[i].w > width)
+                width = rects[i].w;
+        if (width == 0) width = 1;
+    }
+
+    /* Shelf packing in order of the rectangle height */
+    qsort(order, count, sizeof(int) * 2, compare_rect_heights);
+    x = y = shelf = 0;
+    ntiles = 0;
+    for (i = 0; i < count; i++)
+    {
+        ttf_atlas_glyph_t *g = &rects[order[i * 2 + 1]];
+        if (g->w == 0) continue;
+        if (x + g->w > width)
+        {
+            x = 0;
+            y += shelf;
+            shelf = 0;
+        }
+        g->x = x;
+        g->y = y;
+        x += g->w;
+        if (g->h > shelf) shelf = g->h;
+        ntiles += (g->h + SDF_TILE - 1) / SDF_TILE;
+    }
+    height = y + shelf;
+    mem_free(order);
+
+    /* Create output object */
+    atlas = (ttf_atlas_t *)mem_calloc(1, sizeof(ttf_atlas_t) + count * sizeof(*rects) + (size_t)width * height);
+    if (atlas == NULL)
+    {
+        mem_free(rects);
+        return TTF_ERR_NOMEM;
+    }
+    atlas->width = width;
+    atlas->height = height;
+    atlas->nglyphs = count;
+    atlas->scale = scale;
+    atlas->range = range;
+    atlas->glyphs = (ttf_atlas_glyph_t *)(atlas + 1);
+    atlas->pixels = (uint8_t *)(atlas->glyphs + count);
+    memcpy(atlas->glyphs, rects, count * sizeof(*rects));
+    mem_free(rects);
+
+    /* Tiles of glyph rows */
+    memset(&job, 0, sizeof(job));
+    job.ttf = ttf;
+    job.atlas = atlas;
+    job.flags = flags;
+    job.ntiles = ntiles;
+    job.tile_glyph = (int *)mem_alloc((ntiles + 1) * 2 * sizeof(int));
+    if (job.tile_glyph == NULL)
+    {
+        mem_free(atlas);
+        return TTF_ERR_NOMEM;
+    }
+    job.tile_row = job.tile_glyph + ntiles + 1;
+    ntiles = 0;
+    for (i = 0; i < count; i++)
+        for (y = 0; y < atlas->glyphs[i].h; y += SDF_TILE)
+        {
+            job.tile_glyph[ntiles] = i;
+            job.tile_row[ntiles++] = y;
+        }
+
+    sdf_run(&job, threads);
+    mem_free(job.tile_glyph);
+    if (job.error != TTF_DONE)
+    {
+        mem_free(atlas);
+        return job.error;
+    }
+
+    *output = atlas;
+    return TTF_DONE;
 }
 
-int ttf_glyph2mesh3d(ttf_glyph_t *glyph, ttf_mesh3d_t **output, uint8_t quality, int features, float depth)
+/* Band structure for the direct outline rendering, E. Lengyel "GPU-Centered */
+/* Font Rendering Directly from Glyph Outlines". The curves crossing every */
+/* horizontal (vertical) band are sorted by the max x (y) in descending order, */
+/* so the ray casting to +x (+y) stops at the first curve behind the pixel. */
+
+#define BANDS_MAX 16
+
+typedef struct bands_build
 {
-    ttf_outline_t *o;
-    mesher_t *mesh;
-    ttf_mesh3d_t *out;
-    int res;
+    ttf_bands_t *out;
+    int count;
+} bands_build_t;
 
-    *output = NULL;
-    if (glyph->outline == NULL)
-        return TTF_ERR_NO_OUTLINE;
+/**
+ * @brief Collecting of the curves, raster_contour with unit scale gives negative y
+ */
+static void bands_collect(void *ctx, const float *p0, const float *c, const float *p1)
+{
+    bands_build_t *b = (bands_build_t *)ctx;
+    float *curve = b->out->curves[b->count++];
+    curve[0] = p0[0];
+    curve[1] = -p0[1];
+    curve[2] = c != NULL ? c[0] : (p0[0] + p1[0]) * 0.5f;
+    curve[3] = c != NULL ? -c[1] : -(p0[1] + p1[1]) * 0.5f;
+    curve[4] = p1[0];
+    curve[5] = -p1[1];
+}
 
-    if (quality < 8) quality = 8;
-    if (quality > 128) quality = 128;
+static float bands_curve_max(const float *curve, int axis)
+{
+    float m = curve[axis];
+    if (curve[axis + 2] > m) m = curve[axis + 2];
+    if (curve[axis + 4] > m) m = curve[axis + 4];
+    return m;
+}
 
-    /* Create outline and mesher */
-    o = ttf_linear_outline(glyph, quality);
-    if (o == NULL) return TTF_ERR_NOMEM;
-    if (o->total_points < 3)
+static float bands_curve_min(const float *curve, int axis)
+{
+    float m = curve[axis];
+    if (curve[axis + 2] < m) m = curve[axis + 2];
+    if (curve[axis + 4] < m) m = curve[axis + 4];
+    return m;
+}
+
+/**
+ * @brief Sorting of the band curves by the max coordinate in descending order
+ *
+ * Insertion sort is stable, so the equal curves keep the outline order.
+ */
+static void bands_sort(const ttf_bands_t *b, int axis, int *refs, int count)
+{
+    for (int i = 1; i < count; i++)
     {
-        ttf_free_outline(o);
-        return TTF_ERR_NO_OUTLINE;
+        int curr = refs[i];
+        float key = bands_curve_max(b->curves[curr], axis);
+        int j = i;
+        while (j > 0 && bands_curve_max(b->curves[refs[j - 1]], axis) < key)
+        {
+            refs[j] = refs[j - 1];
+            j--;
+        }
+        refs[j] = curr;
     }
-    mesh = create_mesher(o);
-    if (mesh == NULL)
+}
+
+/**
+ * @brief Filling of the band lists of one direction
+ * @param axis 1 for the horizontal bands (split by y), 0 for the vertical ones
+ * @param refs Output curve references or NULL to count them
+ * @return Number of references
+ */
+static int bands_fill(ttf_bands_t *b, int axis, int *first, int *refs)
+{
+    int n = axis == 1 ? b->nhbands : b->nvbands;
+    float lo = b->bounds[axis];
+    float size = b->bounds[axis + 2] - lo;
+    int total = 0;
+    for (int band = 0; band < n; band++)
     {
-        ttf_free_outline(o);
-        return TTF_ERR_NOMEM;
+        float b0 = lo + size * band / n;
+        float b1 = lo + size * (band + 1) / n;
+        if (first != NULL) first[band] = total;
+        for (int i = 0; i < b->ncurves; i++)
+        {
+            const float *curve = b->curves[i];
+            /* the curves along the ray direction never cross it */
+            if (curve[axis] == curve[axis + 2] && curve[axis] == curve[axis + 4]) continue;
+            if (bands_curve_max(curve, axis) < b0 || bands_curve_min(curve, axis) > b1) continue;
+            if (refs != NULL) refs[total] = i;
+            total++;
+        }
     }
+    if (first != NULL) first[n] = total;
+    return total;
+}
 
-    /* Start mesher */
-    res = mesher(mesh, 128);
-    if (res == MESHER_FAIL) goto failed;
-    if (res == MESHER_WARN && (features & TTF_FEATURE_IGN_ERR) == 0) goto failed;
+int ttf_glyph2bands(ttf_glyph_t *glyph, int nbands, ttf_bands_t **output)
+{
+    const ttf_outline_t *o;
+    ttf_outline_t *temp;
+    ttf_bands_t hdr, *out;
+    bands_build_t build;
+    raster_t r;
+    int maxcurves, nh, nv, i;
 
-    /* Count the number of triangles and outer edges */
-    int nt = 0;
-    int ne = 0;
-    for (mts_t *t = mesh->tused.next; t != &mesh->tused; t = t->next)
+    *output = NULL;
+    if (!GLYPH_HAS_OUTLINE(glyph))
+        return TTF_ERR_NO_OUTLINE;
+    o = glyph_outline(glyph, &temp);
+    if (o == NULL)
+        return TTF_ERR_NOMEM;
+
+    /* Collect the curves to the temporary object to count the band references */
+    maxcurves = o->total_points + o->ncontours;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.curves = (float (*)[6])mem_alloc((maxcurves + 1) * sizeof(*hdr.curves));
+    if (hdr.curves == NULL)
+    {
+        ttf_free_outline(temp);
+        return TTF_ERR_NOMEM;
+    }
+    memset(&r, 0, sizeof(r));
+    r.scale = 1.0f;
+    build.out = &hdr;
+    build.count = 0;
+    for (i = 0; i < o->ncontours; i++)
+        raster_contour(&r, o->cont[i].pt, o->cont[i].length, bands_collect, &build);
+    ttf_free_outline(temp);
+    hdr.ncurves = build.count;
+    for (i = 0; i < hdr.ncurves; i++)
     {
-        if (IS_CONTOUR_EDGE(t->edge[0])) ne++;
-        if (IS_CONTOUR_EDGE(t->edge[1])) ne++;
-        if (IS_CONTOUR_EDGE(t->edge[2])) ne++;
-        nt++;
+        for (int axis = 0; axis < 2; axis++)
+        {
+            float mn = bands_curve_min(hdr.curves[i], axis);
+            float mx = bands_curve_max(hdr.curves[i], axis);
+            if (i == 0 || mn < hdr.bounds[axis]) hdr.bounds[axis] = mn;
+            if (i == 0 || mx > hdr.bounds[axis + 2]) hdr.bounds[axis + 2] = mx;
+        }
     }
+    if (nbands <= 0)
+        nbands = hdr.ncurves / 4;
+    if (nbands < 1) nbands = 1;
+    if (nbands > BANDS_MAX) nbands = BANDS_MAX;
+    hdr.nhbands = hdr.nvbands = nbands;
+    nh = bands_fill(&hdr, 1, NULL, NULL);
+    nv = bands_fill(&hdr, 0, NULL, NULL);
 
     /* Create output object */
-    out = (ttf_mesh3d_t *)malloc(
-        sizeof(ttf_mesh3d_t) +
-        (mesh->nv * 2 + ne * 4) * sizeof(*out->vert) +
-        (nt * 2 + ne * 2) * sizeof(*out->faces) +
-        (mesh->nv * 2 + ne * 4) * sizeof(*out->normals)
-    );
+    out = (ttf_bands_t *)mem_alloc(
+        sizeof(ttf_bands_t) +
+        hdr.ncurves * sizeof(*hdr.curves) +
+        (nbands + 1) * 2 * sizeof(int) +
+        (nh + nv) * sizeof(int));
     if (out == NULL)
     {
-        ttf_free_outline(o);
-        free_mesher(mesh);
+        mem_free(hdr.curves);
         return TTF_ERR_NOMEM;
     }
-    out->outline = o;
-    out->nvert = mesh->nv * 2 + ne * 4;
-    out->nfaces = nt * 2 + ne * 2;
-    *(void **)&out->vert = out + 1;
-    *(void **)&out->faces = &out->vert[out->nvert];
-    *(void **)&out->normals = &out->faces[out->nfaces];
-
-    /* Fill vertices and normals of front and back planes */
-    depth *= 0.5f;
-    float *n = &out->normals[0].x;
-    float *v = &out->vert[0].x;
-    for (int i = 0; i < mesh->nv; i++)
+    *out = hdr;
+    out->curves = (float (*)[6])(out + 1);
+    out->hband = (int *)(out->curves + hdr.ncurves);
+    out->vband = out->hband + nbands + 1;
+    out->refs = out->vband + nbands + 1;
+    out->nrefs = nh + nv;
+    memcpy(out->curves, hdr.curves, hdr.ncurves * sizeof(*hdr.curves));
+    mem_free(hdr.curves);
+    bands_fill(out, 1, out->hband, out->refs);
+    bands_fill(out, 0, out->vband, out->refs + nh);
+    for (i = 0; i < nbands; i++)
+        out->vband[i] += nh;
+    out->vband[nbands] += nh;
+
+    /* Sort the band curves for the early exit */
+    for (i = 0; i < nbands; i++)
     {
-        *v++ = mesh->v[i].x;
-        *v++ = mesh->v[i].y;
-        *v++ = depth;
-        *n++ = 0;
-        *n++ = 0;
-        *n++ = 1;
+        bands_sort(out, 0, out->refs + out->hband[i], out->hband[i + 1] - out->hband[i]);
+        bands_sort(out, 1, out->refs + out->vband[i], out->vband[i + 1] - out->vband[i]);
     }
-    for (int i = 0; i < mesh->nv; i++)
+
+    *output = out;
+    return TTF_DONE;
+}
+
+/**
+ * @brief Coverage of the ray from pixel center to +x by the band curves
+ * @param axis 0 for the ray to +x, 1 for the ray to +y
+ */
+static float bands_ray(const ttf_bands_t *b, int axis, const int *refs, int count,
+                       float x, float y, float ppem)
+{
+    float cov = 0.0f;
+    int u = axis;                 /* coordinate along the ray */
+    int v = 1 - axis;             /* coordinate across the ray */
+    float pu = axis == 0 ? x : y;
+    float pv = axis == 0 ? y : x;
+    for (int i = 0; i < count; i++)
     {
-        *v++ = mesh->v[i].x;
-        *v++ = mesh->v[i].y;
-        *v++ = -depth;
-        *n++ = 0;
-        *n++ = 0;
-        *n++ = -1;
+        const float *c = b->curves[refs[i]];
+        float p1u = c[u] - pu, p1v = c[v] - pv;
+        float p2u = c[u + 2] - pu, p2v = c[v + 2] - pv;
+        float p3u = c[u + 4] - pu, p3v = c[v + 4] - pv;
+        float au, av, bu, bv, t1, t2, r1, r2;
+        unsigned code;
+
+        /* all the next curves are behind the pixel */
+        if (bands_curve_max(c, u) - pu < -0.5f / ppem) break;
+
+        /* roots eligibility by signs of the curve points */
+        code = (0x2E74u >> ((p1v > 0.0f ? 2 : 0) + (p2v > 0.0f ? 4 : 0) + (p3v > 0.0f ? 8 : 0))) & 3;
+        if (code == 0) continue;
+
+        au = p1u - p2u * 2.0f + p3u;
+        av = p1v - p2v * 2.0f + p3v;
+        bu = p1u - p2u;
+        bv = p1v - p2v;
+        if (fabsf(av) < 1.0f / 65536.0f)
+            t1 = t2 = p1v * 0.5f / bv;
+        else
+        {
+            float d = bv * bv - av * p1v;
+            d = sqrtf(d > 0.0f ? d : 0.0f);
+            t1 = (bv - d) / av;
+            t2 = (bv + d) / av;
+        }
+        r1 = ((au * t1 - bu * 2.0f) * t1 + p1u) * ppem + 0.5f;
+        r2 = ((au * t2 - bu * 2.0f) * t2 + p1u) * ppem + 0.5f;
+        if (code & 1) cov += r1 < 0.0f ? 0.0f : r1 > 1.0f ? 1.0f : r1;
+        if (code > 1) cov -= r2 < 0.0f ? 0.0f : r2 > 1.0f ? 1.0f : r2;
     }
+    cov = fabsf(cov);
+    return cov < 1.0f ? cov : 1.0f;
+}
 
-    int *idx = &out->faces[0].v1;
+static __inline int bands_index(const ttf_bands_t *b, int axis, int n, float p)
+{
+    float size = b->bounds[axis + 2] - b->bounds[axis];
+    int band = size > 0.0f ? (int)((p - b->bounds[axis]) / size * n) : 0;
+    if (band < 0) return 0;
+    return band < n ? band : n - 1;
+}
 
-    int vbase = mesh->nv * 2;
-    for (mts_t *t = mesh->tused.next; t != &mesh->tused; t = t->next)
-    {
-        mvs_t *v1, *v2, *v3;
+float ttf_bands_coverage(const ttf_bands_t *bands, float x, float y, float ppem)
+{
+    int hb = bands_index(bands, 1, bands->nhbands, y);
+    int vb = bands_index(bands, 0, bands->nvbands, x);
+    float hcov = bands_ray(bands, 0, bands->refs + bands->hband[hb], bands->hband[hb + 1] - bands->hband[hb], x, y, ppem);
+    float vcov = bands_ray(bands, 1, bands->refs + bands->vband[vb], bands->vband[vb + 1] - bands->vband[vb], x, y, ppem);
+    return (hcov + vcov) * 0.5f;
+}
 
-        /*
+/******************************************************************************/
+/******************************************************************************/
+/******************************************************************************/
+/******************************************************************************/
+/************************************ END *************************************/
+/********************************* RASTERIZER *********************************/
+/******************************************************************************/
+/******************************************************************************/
+/******************************************************************************/
+/******************************************************************************/
 
-              v3
-              /\
-          e0 /  \ e2
-            /CCW!\
-           /______\
-        v1    e1    v2
+static int compare_ints(const void *a, const void *b)
+{
+    int ia = *(const int *)a;
+    int ib = *(const int *)b;
+    return ia < ib ? -1 : (ia > ib ? 1 : 0);
+}
 
-        */
+/**
+ * @brief Placing the glyphs of utf-8 text
+ * @return Array of glyph records without the mesh ranges or NULL if no memory
+ */
+static ttf_text_glyph_t *layout_text(const ttf_t *ttf, const char *utf8, int len,
+                                     const ttf_layout_t *opts, int *nglyphs, float *width,
+                                     float *height, int *nlines)
+{
+    const uint8_t *s = (const uint8_t *)utf8;
+    ttf_text_glyph_t *res;
+    float line_height, x, y, max;
+    int pos, n, count, line_start, prev;
 
-        v1 = EDGES_COMMON_VERT(t->edge[1], t->edge[0]);
-        v2 = EDGES_COMMON_VERT(t->edge[1], t->edge[2]);
-        v3 = EDGES_COMMON_VERT(t->edge[0], t->edge[2]);
+    /* the number of characters is not more than the number of bytes */
+    res = (ttf_text_glyph_t *)mem_calloc(len + 1, sizeof(ttf_text_glyph_t));
+    if (res == NULL) return NULL;
 
-        /* front triangle */
-        *idx++ = v1 - mesh->v;
-        *idx++ = v2 - mesh->v;
-        *idx++ = v3 - mesh->v;
+    if (ttf->os2.fsSelection.utm)
+        line_height = ttf->os2.sTypoAscender - ttf->os2.sTypoDescender + ttf->os2.sTypoLineGap;
+    else
+        line_height = ttf->hhea.ascender - ttf->hhea.descender + ttf->hhea.lineGap;
+    if (line_height <= 0) line_height = 1.0f;
+    if (opts->line_spacing > 0) line_height *= opts->line_spacing;
 
-        /* back triangle */
-        *idx++ = v3 - mesh->v + mesh->nv;
-        *idx++ = v2 - mesh->v + mesh->nv;
-        *idx++ = v1 - mesh->v + mesh->nv;
+    count = 0;
+    line_start = 0;
+    prev = -1;
+    x = 0.0f;
+    y = 0.0f;
+    max = 0.0f;
+    *nlines = 1;
+    for (pos = 0; pos <= len; pos += n)
+    {
+        uint32_t c = '\n';
+        n = 1;
+        if (pos < len)
+            n = utf8_decode(s + pos, len - pos, &c);
 
-        if (IS_CONTOUR_EDGE(t->edge[0]))
+        if (c == '\n')
         {
-            make_side_quad(v3, v1, t->edge[0], v, idx, n, vbase, depth);
-            vbase += 4; /* four vertices */
-            v += 4 * 3; /* four vertices with three coordinates */
-            n += 4 * 3;
-            idx += 6;
+            /* line width without the spacing after last character */
+            float w = count > line_start ? x - opts->letter_spacing : 0.0f;
+            float shift = 0.0f;
+            if (opts->align == TTF_ALIGN_CENTER) shift = -w * 0.5f;
+            if (opts->align == TTF_ALIGN_RIGHT) shift = -w;
+            for (int i = line_start; i < count; i++)
+                res[i].x += shift;
+            if (w > max) max = w;
+            if (pos >= len) break;
+            line_start = count;
+            prev = -1;
+            x = 0.0f;
+            y -= line_height;
+            (*nlines)++;
+            continue;
         }
-        if (IS_CONTOUR_EDGE(t->edge[1]))
+
+        /* missing characters are drawn by the glyph #0 */
+        int g = ttf_find_glyph(ttf, c);
+        if (g < 0) g = 0;
+        if (prev >= 0 && !opts->no_kerning)
+            x += ttf_kerning(ttf, prev, g);
+        res[count].glyph = g;
+        res[count].offset = pos;
+        res[count].x = x;
+        res[count].y = y;
+        count++;
+        x += ttf->glyphs[g].advance + opts->letter_spacing;
+        prev = g;
+    }
+
+    *nglyphs = count;
+    *width = max;
+    *height = -y + line_height;
+    return res;
+}
+
+/**
+ * @brief Sorted list of distinct glyphs of the text
+ * @return Number of distinct glyphs or -1 if no memory
+ */
+static int text_distinct_glyphs(const ttf_text_glyph_t *items, int count, int **glyphs)
+{
+    int *res;
+    int i, n;
+
+    res = (int *)mem_alloc(sizeof(int) * (count + 1));
+    if (res == NULL) return -1;
+    for (i = 0; i < count; i++)
+        res[i] = items[i].glyph;
+    qsort(res, count, sizeof(int), compare_ints);
+    for (i = 0, n = 0; i < count; i++)
+        if (n == 0 || res[n - 1] != res[i])
+            res[n++] = res[i];
+    *glyphs = res;
+    return n;
+}
+
+static int find_int(const int *sorted, int count, int value)
+{
+    int lsi = 0;
+    int rsi = count - 1;
+    while (lsi <= rsi)
+    {
+        int mid = (lsi + rsi) / 2;
+        if (sorted[mid] == value) return mid;
+        if (sorted[mid] < value)
+            lsi = mid + 1; else
+            rsi = mid - 1;
+    }
+    return -1;
+}
+
+static const ttf_layout_t default_layout;
+
+int ttf_text2mesh(ttf_t *ttf, const char *utf8, int len, uint8_t quality,
+                  const ttf_layout_t *opts, ttf_text_mesh_t **output)
+{
+    ttf_text_glyph_t *items;
+    ttf_text_mesh_t *out;
+    ttf_mesh_cache_t *cache;
+    const ttf_mesh_t **meshes;
+    int *glyphs;
+    int nitems, nglyphs, nlines, nvert, nfaces, i, j;
+    float width, height;
+    int res;
+
+    *output = NULL;
+    if (ttf->glyphs == NULL || ttf->nglyphs == 0)
+        return TTF_ERR_NO_METRICS;
+    if (opts == NULL) opts = &default_layout;
+    if (len < 0) len = strlen(utf8);
+
+    items = layout_text(ttf, utf8, len, opts, &nitems, &width, &height, &nlines);
+    if (items == NULL) return TTF_ERR_NOMEM;
+    nglyphs = text_distinct_glyphs(items, nitems, &glyphs);
+    if (nglyphs < 0)
+    {
+        mem_free(items);
+        return TTF_ERR_NOMEM;
+    }
+    meshes = (const ttf_mesh_t **)mem_calloc(nglyphs + 1, sizeof(ttf_mesh_t *));
+    cache = ttf_create_mesh_cache(ttf, quality, opts->features);
+    if (meshes == NULL || cache == NULL)
+    {
+        res = TTF_ERR_NOMEM;
+        goto done;
+    }
+
+    /* every distinct glyph is meshed once, the composite */
+    /* glyphs reuse the meshes of their components */
+    for (i = 0; i < nglyphs; i++)
+    {
+        res = ttf_cached_glyph2mesh(cache, glyphs[i], &meshes[i]);
+        if (res == TTF_ERR_NO_OUTLINE) continue;
+        if (res == TTF_ERR_MESHER && (opts->features & TTF_FEATURE_IGN_ERR) != 0) continue;
+        if (res != TTF_DONE) goto done;
+    }
+
+    /* count the merged buffer size */
+    nvert = 0;
+    nfaces = 0;
+    for (i = 0; i < nitems; i++)
+    {
+        const ttf_mesh_t *m = meshes[find_int(glyphs, nglyphs, items[i].glyph)];
+        if (m == NULL) continue;
+        nvert += m->nvert;
+        nfaces += m->nfaces;
+    }
+
+    /* create output object */
+    out = (ttf_text_mesh_t *)mem_calloc(
+        sizeof(ttf_text_mesh_t) +
+        nvert * sizeof(*out->vert) +
+        nfaces * sizeof(*out->faces) +
+        nitems * sizeof(ttf_text_glyph_t), 1);
+    if (out == NULL)
+    {
+        res = TTF_ERR_NOMEM;
+        goto done;
+    }
+    out->nvert = nvert;
+    out->nfaces = nfaces;
+    out->nglyphs = nitems;
+    out->nlines = nlines;
+    out->width = width;
+    out->height = height;
+    *(void **)&out->vert = out + 1;
+    *(void **)&out->faces = &out->vert[nvert];
+    out->glyphs = (ttf_text_glyph_t *)&out->faces[nfaces];
+
+    /* fill the merged buffer */
+    nvert = 0;
+    nfaces = 0;
+    for (i = 0; i < nitems; i++)
+    {
+        ttf_text_glyph_t *g = out->glyphs + i;
+        const ttf_mesh_t *m = meshes[find_int(glyphs, nglyphs, items[i].glyph)];
+        *g = items[i];
+        g->first_vert = nvert;
+        g->first_face = nfaces;
+        if (m == NULL) continue;
+        g->nvert = m->nvert;
+        g->nfaces = m->nfaces;
+        for (j = 0; j < m->nvert; j++)
         {
-            make_side_quad(v1, v2, t->edge[1], v, idx, n, vbase, depth);
-            vbase += 4; /* four vertices */
-            v += 4 * 3; /* four vertices with three coordinates */
-            n += 4 * 3;
-            idx += 6;
+            out->vert[nvert + j].x = m->vert[j].x + g->x;
+            out->vert[nvert + j].y = m->vert[j].y + g->y;
         }
-        if (IS_CONTOUR_EDGE(t->edge[2]))
+        for (j = 0; j < m->nfaces; j++)
         {
-            make_side_quad(v2, v3, t->edge[2], v, idx, n, vbase, depth);
-            vbase += 4; /* four vertices */
-            v += 4 * 3; /* four vertices with three coordinates */
-            n += 4 * 3;
-            idx += 6;
+            out->faces[nfaces + j].v1 = m->faces[j].v1 + nvert;
+            out->faces[nfaces + j].v2 = m->faces[j].v2 + nvert;
+            out->faces[nfaces + j].v3 = m->faces[j].v3 + nvert;
         }
+        nvert += m->nvert;
+        nfaces += m->nfaces;
     }
 
     *output = out;
-    free_mesher(mesh);
-    return TTF_DONE;
+    res = TTF_DONE;
 
-failed:
-    ttf_free_outline(o);
-    free_mesher(mesh);
-    return TTF_ERR_MESHER;
+done:
+    ttf_free_mesh_cache(cache);
+    mem_free(meshes);
+    mem_free(glyphs);
+    mem_free(items);
+    return res;
 }
 
-/******************************************************************************/
-/******************************************************************************/
-/******************************************************************************/
-/******************************************************************************/
-/************************************ END *************************************/
-/*********************************** MESHER ***********************************/
-/******************************************************************************/
-/******************************************************************************/
-/******************************************************************************/
-/******************************************************************************/
+int ttf_text2mesh3d(ttf_t *ttf, const char *utf8, int len, uint8_t quality,
+                    const ttf_layout_t *opts, float depth, ttf_text_mesh3d_t **output)
+{
+    ttf_text_glyph_t *items;
+    ttf_text_mesh3d_t *out;
+    ttf_mesh3d_t **meshes;
+    int *glyphs;
+    int nitems, nglyphs, nlines, nvert, nfaces, i, j;
+    float width, height;
+    int res;
+
+    *output = NULL;
+    if (ttf->glyphs == NULL || ttf->nglyphs == 0)
+        return TTF_ERR_NO_METRICS;
+    if (opts == NULL) opts = &default_layout;
+    if (len < 0) len = strlen(utf8);
+
+    items = layout_text(ttf, utf8, len, opts, &nitems, &width, &height, &nlines);
+    if (items == NULL) return TTF_ERR_NOMEM;
+    nglyphs = text_distinct_glyphs(items, nitems, &glyphs);
+    if (nglyphs < 0)
+    {
+        mem_free(items);
+        return TTF_ERR_NOMEM;
+    }
+    meshes = (ttf_mesh3d_t **)mem_calloc(nglyphs + 1, sizeof(ttf_mesh3d_t *));
+    if (meshes == NULL)
+    {
+        res = TTF_ERR_NOMEM;
+        goto done;
+    }
+
+    /* every distinct glyph is meshed once */
+    for (i = 0; i < nglyphs; i++)
+    {
+        res = ttf_glyph2mesh3d(ttf->glyphs + glyphs[i], &meshes[i], quality, opts->features, depth);
+        if (res == TTF_ERR_NO_OUTLINE) continue;
+        if (res == TTF_ERR_MESHER && (opts->features & TTF_FEATURE_IGN_ERR) != 0) continue;
+        if (res != TTF_DONE) goto done;
+    }
+
+    /* count the merged buffer size */
+    nvert = 0;
+    nfaces = 0;
+    for (i = 0; i < nitems; i++)
+    {
+        ttf_mesh3d_t *m = meshes[find_int(glyphs, nglyphs, items[i].glyph)];
+        if (m == NULL) continue;
+        nvert += m->nvert;
+        nfaces += m->nfaces;
+    }
+
+    /* create output object */
+    out = (ttf_text_mesh3d_t *)mem_calloc(
+        sizeof(ttf_text_mesh3d_t) +
+        nvert * sizeof(*out->vert) +
+        nfaces * sizeof(*out->faces) +
+        nvert * sizeof(*out->normals) +
+        nitems * sizeof(ttf_text_glyph_t), 1);
+    if (out == NULL)
+    {
+        res = TTF_ERR_NOMEM;
+        goto done;
+    }
+    out->nvert = nvert;
+    out->nfaces = nfaces;
+    out->nglyphs = nitems;
+    out->nlines = nlines;
+    out->width = width;
+    out->height = height;
+    *(void **)&out->vert = out + 1;
+    *(void **)&out->faces = &out->vert[nvert];
+    *(void **)&out->normals = &out->faces[nfaces];
+    out->glyphs = (ttf_text_glyph_t *)&out->normals[nvert];
+
+    /* fill the merged buffer */
+    nvert = 0;
+    nfaces = 0;
+    for (i = 0; i < nitems; i++)
+    {
+        ttf_text_glyph_t *g = out->glyphs + i;
+        ttf_mesh3d_t *m = meshes[find_int(glyphs, nglyphs, items[i].glyph)];
+        *g = items[i];
+        g->first_vert = nvert;
+        g->first_face = nfaces;
+        if (m == NULL) continue;
+        g->nvert = m->nvert;
+        g->nfaces = m->nfaces;
+        for (j = 0; j < m->nvert; j++)
+        {
+            out->vert[nvert + j].x = m->vert[j].x + g->x;
+            out->vert[nvert + j].y = m->vert[j].y + g->y;
+            out->vert[nvert + j].z = m->vert[j].z;
+        }
+        memcpy(out->normals + nvert, m->normals, m->nvert * sizeof(*out->normals));
+        for (j = 0; j < m->nfaces; j++)
+        {
+            out->faces[nfaces + j].v1 = m->faces[j].v1 + nvert;
+            out->faces[nfaces + j].v2 = m->faces[j].v2 + nvert;
+            out->faces[nfaces + j].v3 = m->faces[j].v3 + nvert;
+        }
+        nvert += m->nvert;
+        nfaces += m->nfaces;
+    }
+
+    *output = out;
+    res = TTF_DONE;
+
+done:
+    if (meshes != NULL)
+        for (i = 0; i < nglyphs; i++)
+            ttf_free_mesh3d(meshes[i]);
+    mem_free(meshes);
+    mem_free(glyphs);
+    mem_free(items);
+    return res;
+}
 
 int ttf_export_to_obj(ttf_t *ttf, const char *file_name, uint8_t quality)
 {
     FILE *f = fopen(file_name, "wb");
     if (f == NULL) return TTF_ERR_OPEN;
+    TRACE_BEGIN("ttf_export_to_obj", -1, file_name);
     if (fprintf(f, "# File generated by ttf2mesh %s\n", TTF2MESH_VERSION) == 0) goto werror;
     if (fprintf(f, "# Font full name: %s\n", ttf->names.full_name) == 0) goto werror;
     if (fprintf(f, "# Font family, subfamily: %s, %s\n", ttf->names.family, ttf->names.subfamily) == 0) goto werror;
@@ -4489,8 +11066,7 @@ int ttf_export_to_obj(ttf_t *ttf, const char *file_name, uint8_t quality)
         if (fprintf(f, "o symbol U+%04X glyph %i xadv %.3f lsb %.3f rsb %.3f\n",
                     (int)ttf->chars[i], (int)ttf->char2glyph[i], g->advance,
                     g->lbearing, g->rbearing) == 0) goto werror;
-        bool has_data = g->outline != NULL;
-        if (has_data) has_data = g->outline->total_points >= 3;
+        bool has_data = GLYPH_HAS_OUTLINE(g) && g->npoints >= 3;
         if (!has_data)
         {
             if (fprintf(f, "# No points in this glyph\n\n") == 0) goto werror;
@@ -4526,30 +11102,92 @@ int ttf_export_to_obj(ttf_t *ttf, const char *file_name, uint8_t quality)
     if (fprintf(f, "# %i total triangles\n", ttotal) == 0) goto werror;
     if (fprintf(f, "# %i total vertices\n", vtotal) == 0) goto werror;
     fclose(f);
+    TRACE_END("ttf_export_to_obj");
     return TTF_DONE;
 
 werror:
     fclose(f);
+    TRACE_END("ttf_export_to_obj");
     return TTF_ERR_WRITING;
 }
 
 void ttf_free_outline(ttf_outline_t *outline)
 {
-    free(outline);
+    mem_free(outline);
 }
 
 void ttf_free_mesh(ttf_mesh_t *mesh)
 {
     if (mesh == NULL) return;
-    free(mesh->outline);
-    free(mesh);
+    mem_free(mesh->outline);
+    mem_free(mesh);
 }
 
 void ttf_free_mesh3d(ttf_mesh3d_t *mesh)
 {
     if (mesh == NULL) return;
-    free(mesh->outline);
-    free(mesh);
+    mem_free(mesh->outline);
+    mem_free(mesh);
+}
+
+void ttf_free_curvemesh(ttf_curvemesh_t *mesh)
+{
+    if (mesh == NULL) return;
+    mem_free(mesh->outline);
+    mem_free(mesh);
+}
+
+void ttf_free_fan(ttf_fan_t *fan)
+{
+    if (fan == NULL) return;
+    mem_free(fan->outline);
+    mem_free(fan);
+}
+
+void ttf_free_atlas(ttf_atlas_t *atlas)
+{
+    mem_free(atlas);
+}
+
+void ttf_free_prepared_outline(ttf_prepared_outline_t *prepared)
+{
+    mem_free(prepared);
+}
+
+void ttf_free_bands(ttf_bands_t *bands)
+{
+    mem_free(bands);
+}
+
+void ttf_free_mesh_cache(ttf_mesh_cache_t *cache)
+{
+    int i;
+    if (cache == NULL) return;
+    for (i = 0; i < cache->size; i++)
+        if (cache->entries[i].index >= 0)
+            ttf_free_mesh(cache->entries[i].mesh);
+    mem_free(cache->entries);
+    mem_free(cache);
+}
+
+void ttf_free_text_mesh(ttf_text_mesh_t *mesh)
+{
+    mem_free(mesh);
+}
+
+void ttf_free_text_mesh3d(ttf_text_mesh3d_t *mesh)
+{
+    mem_free(mesh);
+}
+
+void ttf_free_query(ttf_query_t *query)
+{
+    mem_free(query);
+}
+
+void ttf_free_index(ttf_index_t *index)
+{
+    mem_free(index);
 }
 
 void ttf_free_list(ttf_t **list)
@@ -4557,36 +11195,13 @@ void ttf_free_list(ttf_t **list)
     if (list == NULL) return;
     for (int i = 0; list[i] != NULL; i++)
         ttf_free(list[i]);
-    free(list);
+    mem_free(list);
 }
 
 void ttf_free(ttf_t *ttf)
 {
-    int i;
     if (ttf == NULL) return;
-    free(ttf->chars);
-    if (ttf->glyphs)
-        for (i = 0; i < ttf->nglyphs; i++)
-            ttf_free_outline(ttf->glyphs[i].outline);
-    #define free_string(s) if (s != empty_string) free((char *)s)
-    free_string(ttf->filename         );
-    free_string(ttf->names.copyright   );
-    free_string(ttf->names.family      );
-    free_string(ttf->names.subfamily   );
-    free_string(ttf->names.unique_id   );
-    free_string(ttf->names.full_name   );
-    free_string(ttf->names.version     );
-    free_string(ttf->names.ps_name     );
-    free_string(ttf->names.trademark   );
-    free_string(ttf->names.manufacturer);
-    free_string(ttf->names.designer    );
-    free_string(ttf->names.description );
-    free_string(ttf->names.url_vendor  );
-    free_string(ttf->names.url_designer);
-    free_string(ttf->names.license_desc);
-    free_string(ttf->names.locense_url );
-    free_string(ttf->names.sample_text );
-    free(ttf);
+    arena_free(ttf);
 }
 
 #ifdef __cplusplus
@@ -23,6 +23,71 @@
  */
 
 /*
+    Release 1.7
+        New Features and Improvements:
+            - precompiled font matching queries (ttf_query_t) and indexed font
+              lists (ttf_index_t) for repeated font lookups
+            - per-character coverage set ttf_t::coverage, ttf_has_char and
+              ttf_resolve_fallback functions for the font fallback chains
+            - ttf_load_from_mem_ex and ttf_load_from_file_ex functions with the
+              TTF_LOAD_METRICS mode that skips the glyph outlines
+            - ttf_measure_text function
+            - kerning support: GPOS PairPos and legacy 'kern' tables are parsed,
+              see ttf_kerning and ttf_kerning_run functions
+            - ttf_text2mesh and ttf_text2mesh3d functions build the merged mesh
+              of the whole text
+            - ttf_glyph2mesh_to and ttf_glyph2mesh3d_to functions write the mesh
+              to caller-provided buffers (ttf_mesh_target_t), see also
+              ttf_glyph_mesh_bounds and ttf_glyph_mesh3d_bounds
+            - 16-bit indices, int16/half-float vertices and octahedral normals
+              output formats of ttf_mesh_target_t
+            - vertex cache optimization of meshes: ttf_mesh_optimize,
+              ttf_mesh3d_optimize, TTF_FEATURE_OPT_CACHE and ttf_mesh_acmr
+            - TTF_FEATURE_SHARED_SIDES feature of ttf_glyph2mesh3d shares the
+              side wall vertices of the adjacent quads at smooth contour points
+            - ttf_glyph2mesh3d_profile function for the bevelled and multi-step
+              extrusion with single mesher pass
+            - ttf_glyph2curvemesh function builds the mesh with the quadratic
+              curve triangles for resolution-independent GPU rendering
+            - ttf_glyph2bitmap and ttf_glyph_bitmap_box functions rasterize
+              the glyph outline to anti-aliased coverage bitmap
+            - ttf_glyphs2sdf function builds the multithreaded signed distance
+              field atlas of the glyph set
+            - ttf_outline_prepare and ttf_outline_contains_batch functions for
+              the band indexed batch point-in-glyph queries
+            - ttf_glyph2bands function exports the glyph curves with the
+              horizontal and vertical band lists for direct outline rendering
+              on GPU, ttf_bands_coverage is its CPU reference evaluator
+            - TTF_MESHER_STATS build option enables the mesher stage counters
+              and timers, see ttf_glyph_mesher_stats and ttf_font_mesher_stats
+            - TTF_TRACING build option records the timeline of font loading,
+              glyph meshing and mesher stages, see ttf_trace_start and
+              ttf_trace_stop functions
+            - ttf_set_allocator and ttf_set_thread_allocator functions route
+              all library allocations to the user allocator,
+              ttf_mesh_target_t::allocator sets it for a single call
+            - Font object is placed in a few large memory slabs with the glyph
+              outlines in glyph order, ttf_free does not walk the glyphs
+            - TTF_LOAD_QUANTIZED loading flag keeps the glyph outlines in font
+              units (see ttf_qoutline_t), ttf_glyph_outline decodes them
+            - Composite glyphs keep their components (see ttf_component_t),
+              TTF_LOAD_COMPONENTS loading flag does not flatten them
+            - ttf_create_mesh_cache and ttf_cached_glyph2mesh functions build
+              the composite glyph meshes from the cached component meshes,
+              ttf_text2mesh uses them
+            - TTF_FEATURE_MONOTONE feature selects the fast mesher engine of
+              the monotone polygon triangulation for the flat text
+            - ttf_glyph2fan function builds the triangle fans of contours and
+              the cover quad for the stencil-then-cover rendering without
+              triangulation (see ttf_fan_t)
+            - ttf_set_thread_mesher_budget function limits the mesher work
+              per glyph by steps, flips and time and allows to cancel it from
+              other thread, TTF_ERR_BUDGET is returned on abort
+        Non-Backwards Compatible Changes:
+            -
+        Bug fixes:
+            -
+
     Release 1.6 (April 23, 2023)
         New Features and Improvements:
             - smooth shading on the glyph geometry in ttf_glyph2mesh3d function
@@ -103,7 +168,7 @@
 extern "C" {
 #endif
 
-#define TTF2MESH_VERSION   "1.6"  /* current library version */
+#define TTF2MESH_VERSION   "1.7"  /* current library version */
 
 #define TTF_MAX_FILE       32     /* font file size limit, MB */
 
@@ -121,6 +186,10 @@ extern "C" {
 #define TTF_ERR_MESHER     9      /* unable to create mesh */
 #define TTF_ERR_NO_OUTLINE 10     /* glyph has no outline */
 #define TTF_ERR_WRITING    11     /* error writing file */
+#define TTF_ERR_NO_METRICS 12     /* font was loaded without glyph metrics */
+#define TTF_ERR_BUFSIZE    13     /* output buffer is too small */
+#define TTF_ERR_BUDGET     14     /* mesher budget is exhausted or meshing is cancelled */
+#define TTF_ERR_ARG        15     /* invalid function argument */
 
 /* definitions for ttf_list_match function */
 
@@ -140,8 +209,35 @@ extern "C" {
 #define TTF_QUALITY_NORMAL 20     /* default quality value for some functions */
 #define TTF_QUALITY_HIGH   50     /* default quality value for some functions */
 
+#define TTF_LOAD_FULL      0      /* ttf_load_from_xxx_ex flag: load all the font data */
+#define TTF_LOAD_HEADERS   1      /* ttf_load_from_xxx_ex flag: load only the font headers and character set */
+#define TTF_LOAD_METRICS   2      /* ttf_load_from_xxx_ex flag: load all except the glyph outlines */
+#define TTF_LOAD_QUANTIZED 4      /* ttf_load_from_xxx_ex flag: keep the glyph outlines in font units */
+#define TTF_LOAD_COMPONENTS 8     /* ttf_load_from_xxx_ex flag: do not flatten the composite glyphs */
+
 #define TTF_FEATURES_DFLT   0     /* default value of ttf_glyph2mesh features parameter */
 #define TTF_FEATURE_IGN_ERR 1     /* flag of ttf_glyph2mesh to ignore uncritical mesh errors */
+#define TTF_FEATURE_OPT_CACHE 2   /* flag of ttf_glyph2mesh to optimize the mesh for vertex cache (see ttf_mesh_optimize) */
+#define TTF_FEATURE_SHARED_SIDES 4 /* flag of ttf_glyph2mesh3d to share the side vertices at smooth contour points */
+#define TTF_FEATURE_MONOTONE 8    /* flag of ttf_glyph2mesh to triangulate by monotone decomposition without optimization */
+
+#define TTF_SDF_NONZERO     0     /* ttf_glyphs2sdf flag: inside of the outline is defined by non-zero winding rule */
+#define TTF_SDF_EVENODD     1     /* ttf_glyphs2sdf flag: inside of the outline is defined by even-odd rule */
+
+/* text alignment values of ttf_layout_t::align */
+
+#define TTF_ALIGN_LEFT     0      /* lines are started at x = 0 */
+#define TTF_ALIGN_CENTER   1      /* lines are centered at x = 0 */
+#define TTF_ALIGN_RIGHT    2      /* lines are ended at x = 0 */
+
+/* output formats of ttf_mesh_target_t */
+
+#define TTF_VERT_F32       0      /* float coordinates */
+#define TTF_VERT_S16       1      /* int16_t fixed point coordinates, see ttf_mesh_target_t::vert_scale */
+#define TTF_VERT_F16       2      /* IEEE 754 half-float coordinates */
+#define TTF_NORMAL_F32     0      /* float x, y, z normal */
+#define TTF_NORMAL_OCT16   1      /* two int8_t of octahedral encoded normal */
+#define TTF_VERT_S16_SCALE 4096   /* default fixed point scale of TTF_VERT_S16 format */
 
 /* lenght of userdata array in ttf_t and ttf_glyph_t structures */
 
@@ -157,6 +253,26 @@ typedef struct ttf_point         ttf_point_t;
 typedef struct ttf_mesh          ttf_mesh_t;
 typedef struct ttf_mesh3d        ttf_mesh3d_t;
 typedef struct unicode_bmp_range ubrange_t;
+typedef struct ttf_query         ttf_query_t;
+typedef struct ttf_index         ttf_index_t;
+typedef struct ttf_run           ttf_run_t;
+typedef struct ttf_layout        ttf_layout_t;
+typedef struct ttf_text_glyph    ttf_text_glyph_t;
+typedef struct ttf_text_mesh     ttf_text_mesh_t;
+typedef struct ttf_text_mesh3d   ttf_text_mesh3d_t;
+typedef struct ttf_mesh_target   ttf_mesh_target_t;
+typedef struct ttf_curvemesh     ttf_curvemesh_t;
+typedef struct ttf_fan           ttf_fan_t;
+typedef struct ttf_atlas         ttf_atlas_t;
+typedef struct ttf_atlas_glyph   ttf_atlas_glyph_t;
+typedef struct ttf_prepared_outline ttf_prepared_outline_t;
+typedef struct ttf_bands         ttf_bands_t;
+typedef struct ttf_mesher_stats  ttf_mesher_stats_t;
+typedef struct ttf_mesher_budget ttf_mesher_budget_t;
+typedef struct ttf_allocator     ttf_allocator_t;
+typedef struct ttf_qoutline      ttf_qoutline_t;
+typedef struct ttf_component     ttf_component_t;
+typedef struct ttf_mesh_cache    ttf_mesh_cache_t;
 
 /**
  * @brief Loaded font structure
@@ -260,6 +376,18 @@ struct ttf_file
         float caretSlope;         /* The slope of the cursor in radians, ~0 for horizontal not italic font and ~0.2 for italic font */
     } hhea;
 
+    /* sparse set of characters mapped to glyphs by "cmap" table (see ttf_has_char) */
+    /* it is filled regardless of the headers_only loading mode */
+    struct
+    {
+        int npages;               /* number of 256-character pages presented in font */
+        uint32_t *pages;          /* sorted page indeces (utf32 >> 8) with npages length */
+        uint32_t (*bits)[8];      /* 256-bit map of characters for each page */
+    } coverage;
+
+    /* kerning data of GPOS or "kern" tables (see ttf_kerning) */
+    struct ttf_kern *kern;
+
     /* for external use */
 
     void *userdata[TTF_FILE_USERDATA];
@@ -291,6 +419,9 @@ struct ttf_glyph
     /* glyph outline */
 
     ttf_outline_t *outline;       /* original outline of the glyph or NULL */
+    ttf_qoutline_t *qoutline;     /* quantized outline (TTF_LOAD_QUANTIZED mode) or NULL */
+    int ncomponents;              /* number of components of the composite glyph */
+    ttf_component_t *components;  /* components of the composite glyph or NULL */
 
     /* for external use */
 
@@ -326,6 +457,43 @@ struct ttf_point
     uint32_t res : 29;            /* reserved for internal use */
 };
 
+/**
+ * @brief The quantized outline struct
+ *
+ * The outline is stored in font units, which are scaled to em by the
+ * functions that use it. The points of the scaled composite glyph
+ * components are rounded to font units.
+ */
+struct ttf_qoutline
+{
+    int total_points;             /* total points within all contours */
+    int ncontours;                /* number of contours in outline */
+    float scale;                  /* font units to em scale (1 / unitsPerEm) */
+    struct
+    {
+        uint16_t length;          /* number of contour points */
+        uint16_t subglyph_id;     /* subglyph index for composite glyphs */
+        uint16_t subglyph_order;  /* subglyph reading order */
+    } *cont;                      /* contours array with ncontours length */
+    int16_t (*pt)[2];             /* x and y of points in font units with total_points length */
+    uint8_t *onc;                 /* on curve flags, bit (i & 7) of byte (i >> 3) for point i */
+};
+
+/**
+ * @brief The composite glyph component struct
+ *
+ * The component point (x, y) is placed to the composite glyph at
+ * (m[0][0] * x + m[0][1] * y + offset[0], m[1][0] * x + m[1][1] * y + offset[1]).
+ */
+struct ttf_component
+{
+    int index;                    /* glyph index of the component */
+    const ttf_glyph_t *glyph;     /* the component glyph */
+    float matrix[2][2];           /* transformation matrix */
+    float offset[2];              /* offset in EM */
+    bool overlap;                 /* OVERLAP_COMPOUND flag: the components overlap */
+};
+
 /**
  * @brief The mesh struct
  */
@@ -385,8 +553,346 @@ struct unicode_bmp_range
     const char *name; /* range name */
 };
 
+/**
+ * @brief Text run resolved by ttf_resolve_fallback function
+ */
+struct ttf_run
+{
+    int offset;       /* offset of the run in utf-8 string, bytes */
+    int length;       /* length of the run in utf-8 string, bytes */
+    int font;         /* index of font in list or -1 if no font covers the run */
+};
+
+/**
+ * @brief Text layout options of ttf_text2mesh and ttf_text2mesh3d functions
+ *
+ * Zero-initialized structure (or NULL pointer) sets the default layout.
+ */
+struct ttf_layout
+{
+    float line_spacing;           /* line height multiplier, 0 is equal to 1 */
+    float letter_spacing;         /* additional spacing between characters, em units */
+    int align;                    /* lines alignment TTF_ALIGN_XXX */
+    bool no_kerning;              /* do not apply the font kerning */
+    int features;                 /* features of glyph meshing, see ttf_glyph2mesh */
+};
+
+/**
+ * @brief Glyph record of the text mesh
+ */
+struct ttf_text_glyph
+{
+    int glyph;                    /* glyph index in font */
+    int offset;                   /* offset of the character in utf-8 string, bytes */
+    float x;                      /* glyph origin x (em units) */
+    float y;                      /* glyph origin y (baseline of glyph line) */
+    int first_vert;               /* first vertex of the glyph in vert array */
+    int nvert;                    /* number of the glyph vertices */
+    int first_face;               /* first triangle of the glyph in faces array */
+    int nfaces;                   /* number of the glyph triangles */
+};
+
+/**
+ * @brief 2d mesh of the text
+ */
+struct ttf_text_mesh
+{
+    int nvert;                    /* length of vert array */
+    int nfaces;                   /* length of faces array */
+    int nglyphs;                  /* length of glyphs array */
+    int nlines;                   /* number of text lines */
+    float width;                  /* width of the longest line */
+    float height;                 /* height of all text lines */
+    struct
+    {
+        float x;
+        float y;
+    } *vert;                      /* vertices of all glyphs */
+    struct
+    {
+        int v1;                   /* index of vertex #1 of triangle */
+        int v2;                   /* index of vertex #2 of triangle */
+        int v3;                   /* index of vertex #3 of triangle */
+    } *faces;                     /* triangles of all glyphs */
+    ttf_text_glyph_t *glyphs;     /* placed characters in text order */
+};
+
+/**
+ * @brief 3d mesh of the text
+ */
+struct ttf_text_mesh3d
+{
+    int nvert;                    /* length of vert and normals arrays */
+    int nfaces;                   /* length of faces array */
+    int nglyphs;                  /* length of glyphs array */
+    int nlines;                   /* number of text lines */
+    float width;                  /* width of the longest line */
+    float height;                 /* height of all text lines */
+    struct
+    {
+        float x;
+        float y;
+        float z;
+    } *vert;                      /* vertices of all glyphs */
+    struct
+    {
+        int v1;                   /* index of vertex #1 of triangle */
+        int v2;                   /* index of vertex #2 of triangle */
+        int v3;                   /* index of vertex #3 of triangle */
+    } *faces;                     /* triangles of all glyphs */
+    struct
+    {
+        float x;
+        float y;
+        float z;
+    } *normals;                   /* vertex normals */
+    ttf_text_glyph_t *glyphs;     /* placed characters in text order */
+};
+
+/**
+ * @brief The mesh with quadratic curve triangles
+ *
+ * The solid triangles go first, the last ncurves triangles are the curve
+ * ones. Each curve triangle has own three vertices: the curve start point,
+ * the control point and the curve end point with (0, 0), (1/2, 0) and (1, 1)
+ * curve coordinates. The point of triangle is filled if s * (u * u - v) <= 0
+ * for the interpolated u and v, so the same check can be done by fragment
+ * shader for all triangles (solid vertices have u = 0, v = 1, s = 1).
+ */
+struct ttf_curvemesh
+{
+    int nvert;                    /* length of vert and coef arrays */
+    int nfaces;                   /* length of faces array */
+    int ncurves;                  /* number of curve triangles at the end of faces */
+    struct
+    {
+        float x;
+        float y;
+    } *vert;                      /* vertices */
+    struct
+    {
+        float u;                  /* curve coordinates */
+        float v;
+        float s;                  /* fill side of the curve: 1 or -1 */
+    } *coef;                      /* curve coordinates of vertices */
+    struct
+    {
+        int v1;                   /* index of vertex #1 of triangle */
+        int v2;                   /* index of vertex #2 of triangle */
+        int v3;                   /* index of vertex #3 of triangle */
+    } *faces;                     /* triangles */
+    ttf_outline_t *outline;       /* the triangulated control polygon */
+};
+
+/**
+ * @brief Triangle fans of the glyph for stencil-then-cover rendering
+ *
+ * The vertices are the points of linear outline followed by four corners
+ * of the outline bounds. Every contour is drawn as the fan around its first
+ * point, the first nfan triangles are the fans and the last two triangles
+ * are the cover quad. The fan triangles keep the contour direction, so the
+ * number of the counterclockwise triangles covering a point minus the number
+ * of the clockwise ones is the winding number of the point. The stencil pass
+ * draws the fans with increment for front faces and decrement for back faces,
+ * then the cover quad is drawn with the stencil test by fill_rule.
+ */
+struct ttf_fan
+{
+    int nvert;                    /* length of vert array */
+    int nfaces;                   /* length of faces array */
+    int nfan;                     /* number of fan triangles, the two cover triangles follow them */
+    int fill_rule;                /* TTF_SDF_NONZERO or TTF_SDF_EVENODD, it is always non-zero for glyphs */
+    int winding;                  /* sign of winding number of the filled points, -1 for clockwise outer contours */
+    struct
+    {
+        float x;
+        float y;
+    } *vert;                      /* vertices */
+    struct
+    {
+        int v1;                   /* index of vertex #1 of triangle */
+        int v2;                   /* index of vertex #2 of triangle */
+        int v3;                   /* index of vertex #3 of triangle */
+    } *faces;                     /* triangles */
+    ttf_outline_t *outline;       /* see ttf_linear_outline() */
+};
+
+/**
+ * @brief Glyph rectangle in the SDF atlas
+ */
+struct ttf_atlas_glyph
+{
+    int glyph;                    /* glyph index in font */
+    int x;                        /* left column of the rectangle in atlas */
+    int y;                        /* top row of the rectangle in atlas */
+    int w;                        /* rectangle width, 0 for the glyph without contours */
+    int h;                        /* rectangle height */
+    int left;                     /* rectangle left edge relative to the glyph origin, in texels */
+    int top;                      /* rectangle top edge relative to the glyph origin, in texels (y goes up) */
+};
+
+/**
+ * @brief Signed distance field atlas
+ *
+ * The texel value is 128 on the outline, 255 inside and 0 outside at the
+ * range distance from the outline and farther. The texel (x, y) of the glyph
+ * rectangle has center at ((left + x + 0.5) / scale, (top - y - 0.5) / scale)
+ * in EM relative to the glyph origin.
+ */
+struct ttf_atlas
+{
+    int width;                    /* atlas width in texels */
+    int height;                   /* atlas height in texels */
+    int nglyphs;                  /* length of glyphs array */
+    float scale;                  /* texels per EM */
+    float range;                  /* distance range in texels */
+    uint8_t *pixels;              /* width * height texels, the top row goes first */
+    ttf_atlas_glyph_t *glyphs;    /* glyph rectangles in order of the requested glyphs */
+};
+
+/**
+ * @brief Band structure of the glyph curves for direct outline rendering
+ *
+ * Every curve is the quadratic Bezier (x1, y1, x2, y2, x3, y3) in EM, the
+ * lines have the control point in the middle. The glyph bounds are split
+ * into nhbands horizontal bands of equal height and into nvbands vertical
+ * bands of equal width. The curves crossing the horizontal band i are
+ * refs[hband[i]] ... refs[hband[i + 1] - 1], they are sorted by max x in
+ * descending order, so the ray cast to +x stops at the first curve lying
+ * to the left of the pixel. The vertical bands are sorted by max y in the
+ * same way. The curves parallel to the band direction are not listed.
+ */
+struct ttf_bands
+{
+    float bounds[4];              /* xmin, ymin, xmax, ymax of the curves in EM */
+    int ncurves;                  /* number of curves */
+    int nhbands;                  /* number of horizontal bands */
+    int nvbands;                  /* number of vertical bands */
+    int nrefs;                    /* length of refs array */
+    float (*curves)[6];           /* curve control points */
+    int *hband;                   /* first reference of horizontal bands, nhbands + 1 items */
+    int *vband;                   /* first reference of vertical bands, nvbands + 1 items */
+    int *refs;                    /* curve indices of the bands */
+};
+
+/**
+ * @brief Mesher statistics of the glyph or of the glyph set
+ *
+ * The counters and times are collected only if the library is compiled
+ * with TTF_MESHER_STATS defined, otherwise only glyphs and failed fields
+ * are filled. The times are in seconds.
+ */
+struct ttf_mesher_stats
+{
+    int glyphs;                   /* number of the meshed glyphs */
+    int failed;                   /* number of the glyphs failed by mesher */
+    int vertices;                 /* vertices swept */
+    int hull_steps;               /* convex hull steps to find the edge under the swept vertex */
+    int edges;                    /* edges created */
+    int triangles;                /* triangles created */
+    int flips;                    /* edge flips performed by optimization */
+    int find_edge_probes;         /* vertex edge links visited by the edge search */
+    int constraints;              /* contour edge insertions */
+    int repairs;                  /* fixed duplicated points and contour twists */
+    double time_sweep;            /* time of sweep_points stage */
+    double time_optimize;         /* time of optimize_all stages */
+    double time_constraints;      /* time of handle_constraints stage */
+    double time_remove_excess;    /* time of remove_excess_triangles stage */
+};
+
+/**
+ * @brief Work budget of the mesher for one glyph
+ *
+ * The zero limit means no limit. The steps are the mesher debug points
+ * (the swept vertices, edge flips, constraint insertions and so on), the
+ * time is measured from the mesher start, the outline linearization and
+ * the contour analysis before it are not limited. The cancel flag can be set by
+ * another thread, it stops the meshing of the current and next glyphs
+ * until it is cleared. The clock is polled every 16 steps.
+ */
+struct ttf_mesher_budget
+{
+    int max_steps;                /* limit of mesher steps */
+    int max_flips;                /* limit of edge flips of the mesh optimization */
+    double max_time_ns;           /* limit of mesher time, nanoseconds */
+    volatile int *cancel;         /* meshing is cancelled if *cancel != 0 (can be NULL) */
+};
+
+/**
+ * @brief Caller-provided output buffers of the glyph mesh
+ *
+ * Vertex is 2 coordinates (x, y) for 2d mesh and 3 coordinates (x, y, z) for
+ * 3d mesh, triangle is 3 indices, normal is 3 floats or 2 bytes of octahedral
+ * encoding. The stride is the distance between the neighbour elements in bytes,
+ * zero stride means tightly packed elements. So the interleaved vertex formats
+ * can be filled directly. Zero-initialized format fields give the same layout
+ * as ttf_mesh_t and ttf_mesh3d_t structures have.
+ *
+ * TTF_VERT_S16 coordinate is round(coord * vert_scale) clamped to int16_t
+ * range. TTF_NORMAL_OCT16 normal is (u, v) pair of int8_t, it is decoded as
+ * x = u / 127, y = v / 127, n = (x, y, 1 - |x| - |y|), and if n.z < 0 then
+ * n.x = (1 - |y|) * sign(x), n.y = (1 - |x|) * sign(y), then normalize(n).
+ * With 16-bit indices the written indices (including base_vertex) must be
+ * less than 65536, otherwise TTF_ERR_BUFSIZE is returned.
+ */
+struct ttf_mesh_target
+{
+    void *vert;                   /* vertex buffer */
+    int vert_stride;              /* distance between vertices, bytes (0 - packed) */
+    int max_vert;                 /* capacity of vertex buffer */
+    void *faces;                  /* triangle buffer */
+    int face_stride;              /* distance between triangles, bytes (0 - packed) */
+    int max_faces;                /* capacity of triangle buffer */
+    void *normals;                /* normal buffer (3d only, can be NULL) */
+    int normal_stride;            /* distance between normals, bytes (0 - packed) */
+    int base_vertex;              /* value added to every written index */
+    int index_size;               /* size of index: 2 (uint16_t) or 4 (int), 0 means 4 */
+    int vert_format;              /* vertex format TTF_VERT_XXX */
+    float vert_scale;             /* TTF_VERT_S16 scale, 0 means TTF_VERT_S16_SCALE */
+    int normal_format;            /* normal format TTF_NORMAL_XXX */
+    int nvert;                    /* out: number of written vertices */
+    int nfaces;                   /* out: number of written triangles */
+    const ttf_allocator_t *allocator; /* allocator of the temporary objects of the call or NULL */
+};
+
+/**
+ * @brief User memory allocator
+ *
+ * All three functions must be set, or all of them must be NULL to use the
+ * standard library functions. The ctx is passed to every function.
+ */
+struct ttf_allocator
+{
+    void *(*alloc)(void *ctx, size_t size);
+    void *(*realloc)(void *ctx, void *ptr, size_t size);
+    void (*free)(void *ctx, void *ptr);
+    void *ctx;
+};
+
 extern const ubrange_t ubranges[163];
 
+/**
+ * @brief Set the global allocator of the library objects
+ * @param allocator Allocator, it is copied, or NULL to use the standard functions
+ *
+ * The objects must be freed by the same allocator, so the allocator should
+ * be set before the library is used. The function is not thread safe.
+ */
+void ttf_set_allocator(const ttf_allocator_t *allocator);
+
+/**
+ * @brief Set the allocator of the calling thread
+ * @param allocator Allocator, it is not copied, or NULL to use the global one
+ * @return Previous allocator of the thread
+ *
+ * The thread allocator overrides the global one for all library calls in
+ * the thread, so it can be set around a single call (for example, to use
+ * the thread arena or the frame bump allocator). The objects must be freed
+ * while the same allocator is active. The working threads of the SDF atlas
+ * generator use the global allocator for their temporary buffers.
+ */
+const ttf_allocator_t *ttf_set_thread_allocator(const ttf_allocator_t *allocator);
+
 /**
  * @brief Load a font from memory
  * @param data Data pointer
@@ -404,6 +910,37 @@ int ttf_load_from_mem(const uint8_t *data, int size, ttf_t **output, bool header
  */
 int ttf_load_from_file(const char *filename, ttf_t **output, bool headers_only);
 
+/**
+ * @brief Load a font from memory with the specified loading mode
+ * @param data Data pointer
+ * @param size Data size
+ * @param output Pointer to font object or NULL if error was occurred
+ * @param flags Loading mode TTF_LOAD_XXX
+ * @return Operation result TTF_XXX
+ *
+ * TTF_LOAD_HEADERS is equal to headers_only mode of ttf_load_from_mem.
+ * TTF_LOAD_QUANTIZED flag can be combined with TTF_LOAD_FULL mode, it keeps
+ * the glyph outlines in ttf_glyph_t::qoutline instead of ttf_glyph_t::outline
+ * in less than half of the memory.
+ * TTF_LOAD_COMPONENTS flag can be combined with TTF_LOAD_FULL mode, the
+ * composite glyphs are left without outlines and only keep their components
+ * (ttf_glyph_t::components), the functions flatten them when they are used.
+ * TTF_LOAD_METRICS mode loads the glyphs array with the advances, bearings
+ * and bounds of glyphs but without the outlines. It is enough for text
+ * measurement (see ttf_measure_text) and takes less time and memory than
+ * the full loading.
+ */
+int ttf_load_from_mem_ex(const uint8_t *data, int size, ttf_t **output, int flags);
+
+/**
+ * @brief Load a font from file with the specified loading mode
+ * @param filename TTF font file name
+ * @param output Pointer to font object or NULL if error was occurred
+ * @param flags Loading mode TTF_LOAD_XXX
+ * @return Operation result TTF_XXX
+ */
+int ttf_load_from_file_ex(const char *filename, ttf_t **output, int flags);
+
 /**
  * @brief List available fonts in directory
  * @param directories Array of standard C strings
@@ -481,6 +1018,64 @@ ttf_t *ttf_list_match(ttf_t **list, ttf_t *deflt, const char *requirements, ...)
  */
 int ttf_list_match_id(ttf_t **list, const char *requirements, ...);
 
+/**
+ * @brief Compile the font matching requirements
+ * @param requirements Requirements string (see ttf_list_match)
+ * @return Compiled query object or NULL if no memory
+ *
+ * The function parses the requirements string and its arguments once. The
+ * family names are copied and the text is reduced to the per-range character
+ * counts, so the arguments may be released after the call. The query can be
+ * used with ttf_list_query_id or ttf_index_match any number of times.
+ */
+ttf_query_t *ttf_query_compile(const char *requirements, ...);
+
+/**
+ * @brief Same as ttf_query_compile but accepts the va_list arguments.
+ */
+ttf_query_t *ttf_query_vcompile(const char *requirements, va_list args);
+
+/**
+ * @brief Matching font from list by the compiled query
+ * @param list NULL-terminated array of references to ttf_t objects
+ * @param query Compiled query object
+ * @return Index of matched font from \a list or -1 value if no font matched
+ *
+ * The result is the same as the ttf_list_match_id result for the
+ * requirements that the query was compiled from.
+ */
+int ttf_list_query_id(ttf_t **list, const ttf_query_t *query);
+
+/**
+ * @brief Build the search index over the font list
+ * @param list NULL-terminated array of references to ttf_t objects
+ * @return Index object or NULL if no memory
+ *
+ * The index keeps the bit sets of fonts by style flags, weight classes,
+ * unicode ranges and family names (including every family name prefix
+ * ending before a space). So the ttf_index_match function evaluates each
+ * modifier by a few bit set operations instead of scanning the whole list.
+ * The \a list and its fonts must not be changed or freed while the index
+ * is in use.
+ */
+ttf_index_t *ttf_index_list(ttf_t **list);
+
+/**
+ * @brief Matching font from indexed list by the compiled query
+ * @param index Index object
+ * @param query Compiled query object
+ * @return Index of matched font from the indexed list or -1 value if no font matched
+ *
+ * The result is the same as the ttf_list_match_id result (up to 32 modifiers).
+ */
+int ttf_index_match_id(const ttf_index_t *index, const ttf_query_t *query);
+
+/**
+ * @brief Same as ttf_index_match_id.
+ * @return Matched font from the indexed list or \a deflt value if no font matched
+ */
+ttf_t *ttf_index_match(const ttf_index_t *index, ttf_t *deflt, const ttf_query_t *query);
+
 /**
  * @brief Translate unicode character to glyph index in font object
  * @param ttf Pointer to font object
@@ -489,6 +1084,89 @@ int ttf_list_match_id(ttf_t **list, const char *requirements, ...);
  */
 int ttf_find_glyph(const ttf_t *ttf, uint32_t utf32_char);
 
+/**
+ * @brief Horizontal kerning of the glyph pair
+ * @param ttf Pointer to font object loaded in TTF_LOAD_FULL or TTF_LOAD_METRICS mode
+ * @param left_glyph Index of the left glyph in glyphs array
+ * @param right_glyph Index of the right glyph in glyphs array
+ * @return Advance adjustment of the left glyph in em units
+ *
+ * The kerning is read from the PairPos lookups (formats 1 and 2) of
+ * the "kern" feature of GPOS table, or from the format 0 subtables of
+ * legacy "kern" table if GPOS has no "kern" feature. The lookups of all
+ * scripts and languages are merged. In every lookup the first subtable
+ * matching the glyph pair defines the value, the values of the lookups
+ * (or of the legacy subtables) are summed.
+ */
+float ttf_kerning(const ttf_t *ttf, int left_glyph, int right_glyph);
+
+/**
+ * @brief Horizontal kerning of the glyph run
+ * @param ttf Pointer to font object
+ * @param glyphs Array of glyph indeces
+ * @param count Length of \a glyphs array
+ * @param kerning Output array of \a count length, kerning[i] is the kerning
+ *        between glyphs[i] and glyphs[i + 1], the last value is zero
+ */
+void ttf_kerning_run(const ttf_t *ttf, const int *glyphs, int count, float *kerning);
+
+/**
+ * @brief Check the presence of the character in font
+ * @param ttf Pointer to font object
+ * @param utf32_char Unicode character (utf16 or utf32)
+ * @return true if the font maps the character to a non-missing glyph
+ *
+ * Unlike ttf_find_glyph, this function works with fonts loaded in the
+ * headers_only mode (for example, with the fonts of ttf_list_fonts).
+ */
+bool ttf_has_char(const ttf_t *ttf, uint32_t utf32_char);
+
+/**
+ * @brief Split the text into runs of fonts from the fallback chain
+ * @param list NULL-terminated array of references to ttf_t objects (the fallback chain)
+ * @param utf8 Text in utf-8 encoding
+ * @param len Length of \a utf8 in bytes or -1 for null-terminated string
+ * @param runs Output array of runs (can be NULL if \a max_runs is 0)
+ * @param max_runs Length of \a runs array
+ * @return Total number of runs in text, it can exceed the \a max_runs
+ *
+ * Every character is assigned to the first font of the \a list which covers
+ * it (see ttf_has_char). The spaces, punctuation, combining marks, joiners
+ * and variation selectors are kept in the run of previous character if its
+ * font covers them. The characters covered by no font are collected into the
+ * runs with font index -1. Invalid utf-8 sequences are treated as U+FFFD.
+ * Adjacent characters with the same font are joined into single run.
+ */
+int ttf_resolve_fallback(ttf_t **list, const char *utf8, int len, ttf_run_t *runs, int max_runs);
+
+/**
+ * @brief Measure the width of text
+ * @param ttf Pointer to font object loaded in TTF_LOAD_FULL or TTF_LOAD_METRICS mode
+ * @param utf8 Text in utf-8 encoding
+ * @param len Length of \a utf8 in bytes or -1 for null-terminated string
+ * @param width Output width of the longest text line in em units (can be NULL)
+ * @param missing Output number of characters missing in font (can be NULL)
+ * @return Operation result TTF_DONE or TTF_ERR_NO_METRICS
+ *
+ * The function sums the advances and kerning of glyphs without loading of their
+ * outlines.
+ * The text lines are separated by '\n' character. The missing characters
+ * are measured by the advance of glyph #0.
+ */
+int ttf_measure_text(const ttf_t *ttf, const char *utf8, int len, float *width, int *missing);
+
+/**
+ * @brief Get the glyph outline in em units
+ * @param glyph Pointer to glyph object
+ * @return Pointer to outline copy or NULL if no memory in system or if glyph have no outline
+ *
+ * The function decodes ttf_glyph_t::qoutline of the font loaded with
+ * TTF_LOAD_QUANTIZED flag and flattens the composite glyph of the font
+ * loaded with TTF_LOAD_COMPONENTS flag. The outline must be freed by
+ * ttf_free_outline.
+ */
+ttf_outline_t *ttf_glyph_outline(const ttf_glyph_t *glyph);
+
 /**
  * @brief Convert continuous qbezier curves to their three-point variant
  * @param glyph Pointer to glyph object
@@ -523,6 +1201,33 @@ int ttf_outline_evenodd_base(const ttf_outline_t *outline, const float point[2],
  */
 bool ttf_outline_evenodd(const ttf_outline_t *outline, const float point[2], int subglyph);
 
+/**
+ * @brief Prepare outline for the batch point queries
+ * @param outline Outline which prepared by ttf_linear_outline function
+ * @param subglyph Subglyph of interest or -1 if does not matter
+ * @return Prepared outline or NULL if no memory
+ *
+ * The edges are distributed to horizontal bands, so every query checks only
+ * the few edges of its band instead of all the outline edges. The outline
+ * is not referenced by the prepared object and can be freed.
+ */
+ttf_prepared_outline_t *ttf_outline_prepare(const ttf_outline_t *outline, int subglyph);
+
+/**
+ * @brief Even-odd algorithm for the array of points
+ * @param prepared Outline which prepared by ttf_outline_prepare function
+ * @param points Point coordinates, n pairs of (x, y)
+ * @param n Number of points
+ * @param inside Output array of n items: true if point is on filled glyph region
+ * @param dist Output array of n distances at left of the point to a most closer
+ *        edge (-1 if there is no edge), can be NULL if does not matter
+ * @return Operation result TTF_DONE
+ *
+ * The result is the same as ttf_outline_evenodd gives for every point.
+ */
+int ttf_outline_contains_batch(const ttf_prepared_outline_t *prepared, const float *points, int n,
+                               bool *inside, float *dist);
+
 /**
  * @brief Even-odd algorithm for retriving the contour information
  * @param outline Outline which prepared by ttf_linear_outline function
@@ -540,6 +1245,8 @@ bool ttf_outline_contour_info(const ttf_outline_t *outline, int subglyph, int co
  * @param xscale Scaling the glyph horizontally
  * @param yscale Scaling the glyph vertically
  * @return Null terminated string or NULL if no memory in system
+ *
+ * The string is allocated by the library allocator (see ttf_set_allocator).
  */
 char *ttf_glyph2svgpath(ttf_glyph_t *glyph, float xscale, float yscale);
 
@@ -550,9 +1257,55 @@ char *ttf_glyph2svgpath(ttf_glyph_t *glyph, float xscale, float yscale);
  * @param quality Number of points to circle (see TTF_QUALITY_XXX)
  * @param features Process features and tricks (see TTF_FEATURES_DFLT, TTF_FEATURE_XXX)
  * @return Operation result TTF_XXX
+ *
+ * TTF_FEATURE_MONOTONE feature splits the glyph into y-monotone pieces and
+ * triangulates them without the Delaunay optimization. It is several times
+ * faster, but the triangles are thin. The glyphs with the overlapped
+ * contours are meshed by the default engine.
  */
 int ttf_glyph2mesh(ttf_glyph_t *glyph, ttf_mesh_t **output, uint8_t quality, int features);
 
+/**
+ * @brief Create the cache of the glyph meshes of font
+ * @param ttf Pointer to font object
+ * @param quality Number of points to circle (see TTF_QUALITY_XXX)
+ * @param features Process features and tricks (see TTF_FEATURES_DFLT, TTF_FEATURE_XXX)
+ * @return Pointer to cache object or NULL if no memory in system
+ *
+ * The cache size depends on the number of meshed glyphs only, so the
+ * short-lived cache is cheap also for the large fonts. The cache object
+ * must be freed by ttf_free_mesh_cache before the font.
+ */
+ttf_mesh_cache_t *ttf_create_mesh_cache(ttf_t *ttf, uint8_t quality, int features);
+
+/**
+ * @brief Get the glyph mesh from the cache
+ * @param cache Pointer to cache object
+ * @param index Glyph index in font
+ * @param output Pointer to mesh object owned by cache or NULL if error occurred
+ * @return Operation result TTF_XXX
+ *
+ * The glyph is meshed by the first call only. The composite glyph mesh
+ * is assembled from the transformed meshes of its components if they
+ * have no OVERLAP_COMPOUND flag and their bounding boxes do not intersect,
+ * otherwise, or if a component can not be meshed, the flattened outline
+ * is meshed as by ttf_glyph2mesh.
+ * The cache object is not thread safe.
+ */
+int ttf_cached_glyph2mesh(ttf_mesh_cache_t *cache, int index, const ttf_mesh_t **output);
+
+/**
+ * @brief Convert glyph to triangle fans for stencil-then-cover rendering
+ * @param glyph Pointer to glyph object
+ * @param quality Number of points to circle (see TTF_QUALITY_XXX)
+ * @param output Pointer to fan object or NULL if error occurred
+ * @return Operation result TTF_DONE, TTF_ERR_NO_OUTLINE or TTF_ERR_NOMEM
+ *
+ * The function does not triangulate the outline, so it takes linear time
+ * and does not fail on the contours rejected by mesher (see ttf_fan_t).
+ */
+int ttf_glyph2fan(ttf_glyph_t *glyph, uint8_t quality, ttf_fan_t **output);
+
 /**
  * @brief Convert glyph to mesh3d-object
  * @param glyph Pointer to glyph object
@@ -561,9 +1314,295 @@ int ttf_glyph2mesh(ttf_glyph_t *glyph, ttf_mesh_t **output, uint8_t quality, int
  * @param features Process features and tricks (see TTF_FEATURES_DFLT, TTF_FEATURE_XXX)
  * @param depth Depth of the object
  * @return Operation result TTF_XXX
+ *
+ * The vertices of the front plane go first, then the vertices of the back
+ * plane and the side wall vertices. By default each side quad has its own four
+ * vertices. With TTF_FEATURE_SHARED_SIDES feature the side vertices of smooth
+ * contour points are shared by the adjacent quads (the normals are the same),
+ * and split only at the sharp corners.
  */
 int ttf_glyph2mesh3d(ttf_glyph_t *glyph, ttf_mesh3d_t **output, uint8_t quality, int features, float depth);
 
+/**
+ * @brief Convert glyph to mesh3d-object extruded by profile
+ * @param glyph Pointer to glyph object
+ * @param output Pointer to mesh3d object or NULL if error occurred
+ * @param quality Number of points to circle (see TTF_QUALITY_XXX)
+ * @param features Process features and tricks (see TTF_FEATURES_DFLT, TTF_FEATURE_XXX)
+ * @param profile Array of nsteps (inset, z) pairs
+ * @param nsteps Number of profile steps, at least 2
+ * @return Operation result TTF_XXX, TTF_ERR_ARG if profile is NULL or nsteps < 2
+ *
+ * The glyph is triangulated once. The front cap is placed at the first profile
+ * step and the back cap at the last one, the side strips are built between
+ * every two neighbour steps. The outline of the step is the glyph outline
+ * moved inward by the step inset along the contour normals (the negative
+ * inset moves it outward). The z values should decrease along the profile.
+ * For example the profile {0.02, 0.1}, {0, 0.08}, {0, -0.08}, {0.02, -0.1}
+ * gives the object of 0.2 depth with 0.02 bevels. The outline is offset
+ * per vertex, so the insets larger than the local curve radius or the half
+ * of stroke width cause self-intersections. The vertex layout is the same as
+ * ttf_glyph2mesh3d one, with (nsteps - 1) quads per contour edge.
+ */
+int ttf_glyph2mesh3d_profile(ttf_glyph_t *glyph, ttf_mesh3d_t **output, uint8_t quality, int features,
+                             const float *profile, int nsteps);
+
+/**
+ * @brief Convert glyph to mesh with quadratic curve triangles (Loop-Blinn)
+ * @param glyph Pointer to glyph object
+ * @param output Pointer to curve mesh object or NULL if error occurred
+ * @param features Process features and tricks (see TTF_FEATURES_DFLT, TTF_FEATURE_XXX)
+ * @return Operation result TTF_XXX
+ *
+ * The curves are not linearized. The polygon of on-curve points, which goes
+ * through the control points of concave curves and along the chords of convex
+ * ones, is triangulated, and one curve triangle is added for every quadratic
+ * curve. So the glyph is drawn exactly at any scale (see ttf_curvemesh_t).
+ * The curves with the hull triangles overlapping other segments are splitted.
+ */
+int ttf_glyph2curvemesh(ttf_glyph_t *glyph, ttf_curvemesh_t **output, int features);
+
+/**
+ * @brief Check if the point is filled by the curve mesh
+ * @param mesh Pointer to curve mesh object
+ * @param x Point x coordinate in EM
+ * @param y Point y coordinate in EM
+ * @return true if the point is filled
+ *
+ * The function does the same test as the fragment shader must do,
+ * it can be used for validation.
+ */
+bool ttf_curvemesh_contains(const ttf_curvemesh_t *mesh, float x, float y);
+
+/**
+ * @brief Run the mesher on glyph and get its statistics
+ * @param glyph Pointer to glyph object
+ * @param quality Number of points to circle (see TTF_QUALITY_XXX)
+ * @param stats Output statistics of the glyph
+ * @return TTF_DONE, TTF_ERR_MESHER if mesher failed or other TTF_XXX error
+ *
+ * The statistics are filled also if the mesher failed. No output mesh is
+ * built, the stage times are the same as in ttf_glyph2mesh function.
+ */
+int ttf_glyph_mesher_stats(ttf_glyph_t *glyph, uint8_t quality, ttf_mesher_stats_t *stats);
+
+/**
+ * @brief Run the mesher on all font glyphs and sum up the statistics
+ * @param ttf Pointer to font object
+ * @param quality Number of points to circle (see TTF_QUALITY_XXX)
+ * @param total Output sum of the glyph statistics
+ * @param glyphs Output statistics of every glyph, array of ttf->nglyphs length (can be NULL)
+ * @return TTF_DONE or TTF_ERR_NOMEM
+ *
+ * The glyphs without outline have zero statistics. Sort the glyphs array
+ * by a time or a counter to find the glyphs responsible for slow meshing.
+ */
+int ttf_font_mesher_stats(ttf_t *ttf, uint8_t quality, ttf_mesher_stats_t *total, ttf_mesher_stats_t *glyphs);
+
+/**
+ * @brief Set the mesher budget of the calling thread
+ * @param budget Budget, it is not copied, or NULL to run the mesher without limits
+ * @return Previous budget of the thread
+ *
+ * The budget is applied to every glyph meshed in the thread by the mesh
+ * functions. When the budget is exhausted, the function aborts the glyph
+ * with TTF_ERR_BUDGET result, no partial mesh is returned. The aborted
+ * glyphs are not stored by the mesh cache, so they are meshed again on the
+ * next request. The monotone engine (TTF_FEATURE_MONOTONE) has no loops
+ * without bound and is not limited, the budget applies to its fallback mesher.
+ * Use ttf_glyph2fan to draw the glyph aborted by the budget.
+ */
+const ttf_mesher_budget_t *ttf_set_thread_mesher_budget(const ttf_mesher_budget_t *budget);
+
+/**
+ * @brief Convert glyph to mesh and write it to caller-provided buffers
+ * @param glyph Pointer to glyph object
+ * @param quality Number of points to circle (see TTF_QUALITY_XXX)
+ * @param features Process features and tricks (see TTF_FEATURES_DFLT, TTF_FEATURE_XXX)
+ * @param target Output buffers, target->nvert and target->nfaces are set on return
+ * @return Operation result TTF_XXX
+ *
+ * The output is the same as of ttf_glyph2mesh function, but no output
+ * object is allocated and no linear outline is returned. If the target
+ * capacity is not enough, TTF_ERR_BUFSIZE is returned and nothing is written.
+ * Use ttf_glyph_mesh_bounds to get the required capacity. TTF_FEATURE_OPT_CACHE
+ * feature is ignored by this function.
+ */
+int ttf_glyph2mesh_to(ttf_glyph_t *glyph, uint8_t quality, int features, ttf_mesh_target_t *target);
+
+/**
+ * @brief Convert glyph to 3d mesh and write it to caller-provided buffers
+ * @param depth Depth of the object
+ *
+ * This function is similar to ttf_glyph2mesh_to but writes the output of
+ * ttf_glyph2mesh3d function. Use ttf_glyph_mesh3d_bounds to get the
+ * required capacity.
+ */
+int ttf_glyph2mesh3d_to(ttf_glyph_t *glyph, uint8_t quality, int features, float depth, ttf_mesh_target_t *target);
+
+/**
+ * @brief Get the upper bound of the glyph mesh size
+ * @param glyph Pointer to glyph object
+ * @param quality Number of points to circle (see TTF_QUALITY_XXX)
+ * @param max_vert Maximum number of vertices of ttf_glyph2mesh_to output
+ * @param max_faces Maximum number of triangles of ttf_glyph2mesh_to output
+ *
+ * The bound is calculated without meshing, from the linear outline size.
+ */
+void ttf_glyph_mesh_bounds(const ttf_glyph_t *glyph, uint8_t quality, int *max_vert, int *max_faces);
+
+/**
+ * @brief Get the upper bound of the glyph 3d mesh size
+ *
+ * This function is similar to ttf_glyph_mesh_bounds but for
+ * ttf_glyph2mesh3d_to function.
+ */
+void ttf_glyph_mesh3d_bounds(const ttf_glyph_t *glyph, uint8_t quality, int *max_vert, int *max_faces);
+
+/**
+ * @brief Reorder mesh for the GPU vertex cache
+ * @param mesh Pointer to mesh object
+ * @return Operation result TTF_DONE or TTF_ERR_NOMEM
+ *
+ * The faces are reordered for the post-transform vertex cache reuse by
+ * T. Forsyth algorithm, then the vertices are renumbered in order of the
+ * first use for the vertex fetch locality. The algorithm is tuned for LRU
+ * cache, so the original order of faces is kept if the reordering does not
+ * reduce the misses of 16 entries FIFO cache (this is usual for the small
+ * glyph meshes). The mesh geometry is not changed, but the vertex indices do
+ * not match the outline points anymore. The same is done by ttf_glyph2mesh
+ * if TTF_FEATURE_OPT_CACHE feature is set.
+ */
+int ttf_mesh_optimize(ttf_mesh_t *mesh);
+
+/**
+ * @brief Reorder mesh3d for the GPU vertex cache
+ *
+ * This function is similar to ttf_mesh_optimize, the normals are
+ * reordered together with the vertices.
+ */
+int ttf_mesh3d_optimize(ttf_mesh3d_t *mesh);
+
+/**
+ * @brief Average cache miss ratio (ACMR) of the triangle list
+ * @param faces Vertex indices, three per triangle
+ * @param nfaces Number of triangles
+ * @param cache_size Size of the simulated FIFO vertex cache (16 or 32 is typical)
+ * @param acmr Output number of the transformed vertices per triangle (0.5 ... 3)
+ * @return Operation result TTF_DONE or TTF_ERR_NOMEM
+ */
+int ttf_mesh_acmr(const int *faces, int nfaces, int cache_size, float *acmr);
+
+/**
+ * @brief Pixel box of the glyph bitmap
+ * @param glyph Pointer to glyph object
+ * @param scale Number of pixels per EM
+ * @param offset Subpixel offset {x, y} of the glyph origin in pixels or NULL
+ * @param box Output {left, top, width, height}: the pixel column of the bitmap
+ *        left edge and the pixel row of its top edge relative to the origin
+ *        (y axis goes up), bitmap width and height in pixels
+ */
+void ttf_glyph_bitmap_box(const ttf_glyph_t *glyph, float scale, const float offset[2], int box[4]);
+
+/**
+ * @brief Rasterize glyph to 8-bit anti-aliased coverage bitmap
+ * @param glyph Pointer to glyph object
+ * @param scale Number of pixels per EM
+ * @param offset Subpixel offset {x, y} of the glyph origin in pixels or NULL
+ * @param buffer Output bitmap of box[3] rows (see ttf_glyph_bitmap_box), the top row goes first
+ * @param stride Row length of the buffer in bytes, not less than box[2]
+ * @return Operation result TTF_DONE, TTF_ERR_NO_OUTLINE, TTF_ERR_BUFSIZE or TTF_ERR_NOMEM
+ *
+ * The quadratic outline is rasterized by the signed area accumulation
+ * without the mesher. The coverage is exact for the flattened curves,
+ * the overlapped contours are filled by the non-zero rule. The accumulation
+ * pass uses SSE2 if it is available (define TTF_NO_SIMD to disable).
+ */
+int ttf_glyph2bitmap(ttf_glyph_t *glyph, float scale, const float offset[2], uint8_t *buffer, int stride);
+
+/**
+ * @brief Build signed distance field atlas of the glyph set
+ * @param ttf Pointer to font object
+ * @param glyphs Glyph indices
+ * @param count Length of glyphs array
+ * @param scale Number of texels per EM
+ * @param range Distance range in texels, it is also the padding of glyph rectangles
+ * @param width Atlas width in texels or 0 to choose the near to square atlas
+ * @param flags TTF_SDF_NONZERO or TTF_SDF_EVENODD fill rule
+ * @param threads Number of working threads or 0 for the number of processors
+ * @param output Pointer to atlas object or NULL if error occurred
+ * @return Operation result TTF_XXX, TTF_ERR_ARG if count is negative or
+ *         scale or range is not positive
+ *
+ * The distance to the quadratic outline is calculated exactly, every texel
+ * checks only the segments of its grid cell, which are closer than range.
+ * The glyph rows are processed by tiles in parallel (define TTF_NO_THREADS
+ * to build the library without threads).
+ */
+int ttf_glyphs2sdf(ttf_t *ttf, const int *glyphs, int count, float scale, float range,
+                   int width, int flags, int threads, ttf_atlas_t **output);
+
+/**
+ * @brief Export glyph curves with band lists for direct outline rendering on GPU
+ * @param glyph Pointer to glyph object
+ * @param nbands Number of horizontal and vertical bands (1...16) or 0 to choose it by curves count
+ * @param output Pointer to band structure or NULL if error occurred
+ * @return Operation result TTF_XXX
+ *
+ * The output is a single memory block, its arrays can be uploaded to the
+ * buffer textures as is. The result depends only on the glyph outline.
+ */
+int ttf_glyph2bands(ttf_glyph_t *glyph, int nbands, ttf_bands_t **output);
+
+/**
+ * @brief Pixel coverage by the band structure, CPU reference of the shader
+ * @param bands Pointer to band structure
+ * @param x Pixel center in EM
+ * @param y Pixel center in EM
+ * @param ppem Number of pixels per EM
+ * @return Coverage in range 0...1
+ *
+ * The coverage is the average of the horizontal and vertical ray winding
+ * numbers, every crossing is weighted by its distance to the pixel center.
+ * The fill rule is non-zero.
+ */
+float ttf_bands_coverage(const ttf_bands_t *bands, float x, float y, float ppem);
+
+/**
+ * @brief Convert the text to 2d mesh
+ * @param ttf Pointer to font object
+ * @param utf8 Text in utf-8 encoding, lines are separated by '\n' character
+ * @param len Length of \a utf8 in bytes or -1 for null-terminated string
+ * @param quality Number of points to circle (see TTF_QUALITY_XXX)
+ * @param opts Layout options or NULL for default layout
+ * @param output Output text mesh object (NULL if error was occurred)
+ * @return Operation result TTF_XXX
+ *
+ * The text is placed by the glyph advances and kerning, starting from the
+ * baseline origin of the first line. Each next line is placed below the
+ * previous one by the line height: OS/2 typo metrics if USE_TYPO_METRICS
+ * flag is set in font, otherwise the hhea ascender, descender and line gap.
+ * Each distinct glyph is meshed once (the composite glyphs are assembled
+ * from the component meshes, see ttf_cached_glyph2mesh), and all the glyphs
+ * are merged into single vertex and index buffer (the face indices are
+ * global), so the text can be drawn by single call. The glyphs array keeps
+ * the position and the vertex and face ranges of every character. A glyph
+ * that can not be meshed causes TTF_ERR_MESHER result if TTF_FEATURE_IGN_ERR
+ * is not set in the layout features, otherwise it is left empty.
+ */
+int ttf_text2mesh(ttf_t *ttf, const char *utf8, int len, uint8_t quality,
+                  const ttf_layout_t *opts, ttf_text_mesh_t **output);
+
+/**
+ * @brief Convert the text to 3d mesh
+ * @param depth The depth of the output mesh (see ttf_glyph2mesh3d)
+ *
+ * This function is similar to ttf_text2mesh but builds the glyphs by
+ * ttf_glyph2mesh3d function.
+ */
+int ttf_text2mesh3d(ttf_t *ttf, const char *utf8, int len, uint8_t quality,
+                    const ttf_layout_t *opts, float depth, ttf_text_mesh3d_t **output);
+
 /**
  * @brief Export ttf font to Wavefront .obj file
  * @param ttf Pointer to font object
@@ -573,6 +1612,29 @@ int ttf_glyph2mesh3d(ttf_glyph_t *glyph, ttf_mesh3d_t **output, uint8_t quality,
  */
 int ttf_export_to_obj(ttf_t *ttf, const char *file_name, uint8_t quality);
 
+/**
+ * @brief Start recording of the trace events
+ * @return false if the library is compiled without TTF_TRACING defined
+ *
+ * The begin/end events are recorded by ttf_load_from_file, ttf_list_fonts,
+ * ttf_linear_outline, create_mesher, mesher and its stages, ttf_glyph2mesh,
+ * ttf_glyph2mesh3d and ttf_export_to_obj functions in all threads. Every
+ * thread writes the events to its own buffer without locks.
+ */
+bool ttf_trace_start(void);
+
+/**
+ * @brief Stop recording and write the trace events to file
+ * @param file_name File name of output JSON file in Chrome trace event format
+ * (it can be opened by chrome://tracing or Perfetto UI)
+ * @return Operation result TTF_DONE, TTF_ERR_OPEN or TTF_ERR_WRITING
+ *
+ * The function must be called when no library functions are running in
+ * other threads. The file without events is written if the library is
+ * compiled without TTF_TRACING defined.
+ */
+int ttf_trace_stop(const char *file_name);
+
 /**
  * @brief Free the outline object
  * @param outline Pointer to outline object
@@ -600,6 +1662,71 @@ void ttf_free_mesh(ttf_mesh_t *mesh);
  */
 void ttf_free_mesh3d(ttf_mesh3d_t *mesh);
 
+/**
+ * @brief Free memory used by curve mesh object
+ * @param mesh Pointer to mesh object
+ *
+ * It is necessary to call after working with mesh object
+ * which was allocated by ttf_glyph2curvemesh function
+ */
+void ttf_free_curvemesh(ttf_curvemesh_t *mesh);
+
+/**
+ * @brief Free memory used by fan object
+ * @param fan Pointer to object from ttf_glyph2fan function
+ */
+void ttf_free_fan(ttf_fan_t *fan);
+
+/**
+ * @brief Free memory used by SDF atlas object
+ * @param atlas Pointer to atlas object
+ */
+void ttf_free_atlas(ttf_atlas_t *atlas);
+
+/**
+ * @brief Free memory used by prepared outline object
+ * @param prepared Pointer to object from ttf_outline_prepare function
+ */
+void ttf_free_prepared_outline(ttf_prepared_outline_t *prepared);
+
+/**
+ * @brief Free memory used by band structure
+ * @param bands Pointer to object from ttf_glyph2bands function
+ */
+void ttf_free_bands(ttf_bands_t *bands);
+
+/**
+ * @brief Free the mesh cache with all its meshes
+ * @param cache Pointer to object from ttf_create_mesh_cache function
+ */
+void ttf_free_mesh_cache(ttf_mesh_cache_t *cache);
+
+/**
+ * @brief Free the text mesh object created with ttf_text2mesh()
+ * @param mesh Pointer to mesh object
+ */
+void ttf_free_text_mesh(ttf_text_mesh_t *mesh);
+
+/**
+ * @brief Free the text mesh object created with ttf_text2mesh3d()
+ * @param mesh Pointer to mesh object
+ */
+void ttf_free_text_mesh3d(ttf_text_mesh3d_t *mesh);
+
+/**
+ * @brief Free the query object created with ttf_query_compile()
+ * @param query Query object
+ */
+void ttf_free_query(ttf_query_t *query);
+
+/**
+ * @brief Free the index object created with ttf_index_list()
+ * @param index Index object
+ *
+ * The indexed font list is not freed by this function.
+ */
+void ttf_free_index(ttf_index_t *index);
+
 /**
  * @brief Free the font list created with ttf_list_fonts()
  * @param list font list
@@ -611,7 +1738,10 @@ void ttf_free_list(ttf_t **list);
  * @param ttf Pointer to font object
  *
  * It is necessary to call after working with font object which was
- * allocated by ttf_load_from_mem or ttf_load_from_file function
+ * allocated by ttf_load_from_mem or ttf_load_from_file function.
+ * All the font data (glyphs, outlines, names, characters and kerning)
+ * is placed in the memory slabs of font object, so the pointers to this
+ * data must not be freed separately.
  */
 void ttf_free(ttf_t *ttf);
 